@@ -3,57 +3,348 @@
 #include "c/user_interface/action_window.h"
 #include "c/stateful.h"
 #include "c/user_interface/loading_window.h"
+#include "c/user_interface/menu_window.h"
+#include "c/modules/storage.h"
+#include "c/modules/perf.h"
 static uint8_t *raw_data;
-static AppTimer *s_retry_timer, *s_ready_timer;
+static AppTimer *s_retry_timer, *s_ready_timer, *s_transfer_timer, *s_tile_retry_timer;
 static bool data_transfer_lock = false;
 static bool clay_needs_config = false;
+// true once pebblekit has confirmed that tile_array matches its config
+static bool tiles_synced = false;
 static int outbox_attempts = 0;
+// milliseconds since comm_callback_start() at which each phase of the handshake completed, 0 until it has
+static uint32_t s_handshake_start = 0;
+static struct {
+  uint32_t hello;
+  uint32_t ready;
+  uint32_t synced;
+} s_handshake;
+// true once pebblekit has answered READY
+static bool s_pebblekit_ready = false;
+// sequence numbers of the chunks received by a windowed transfer
+static uint64_t s_chunks_received = 0;
+// bytes allocated for the transfer under way, chunks and the completed size are checked against it
+static int s_transfer_size = 0;
+// inbox opened by comm_init, reported to pebblekit so it can size its chunks
+static uint32_t s_inbox_size = 0;
+// a transfer we couldn't afford, pebblekit is told so it can send it in smaller pieces
+static bool s_refused_pending = false;
+static uint8_t s_refused_type = 0;
+static int s_refused_size = 0;
+// smallest tile transfer and icon batch refused since the last of its kind arrived, 0 if none was
+static int s_refused_tile_size = 0;
+static int s_refused_icon_size = 0;
 
+// the message the outbox is carrying, nothing else is sent until outbox_sent or outbox_failed says it has gone
+enum outboxMessage {
+  OUTBOX_NONE = 0,
+  OUTBOX_READY,
+  OUTBOX_PRESS,
+  OUTBOX_STATE,
+  OUTBOX_TILE,
+  OUTBOX_ICONS,
+  OUTBOX_PERF,
+  OUTBOX_REFUSED
+};
+static uint8_t s_outbox_message = OUTBOX_NONE;
+static OutboxStats s_outbox_stats;
+
+// button presses waiting for the outbox, sent ahead of everything else
+typedef struct {
+  uint16_t index;
+  uint8_t button;
+  uint8_t count;
+  uint8_t attempts;
+} PressRequest;
+static PressRequest s_press_queue[PRESS_QUEUE_SIZE];
+static uint8_t s_press_queue_count = 0;
+static PressRequest s_press_in_flight;
+
+// a tile request waiting for the transfer lock, sent ahead of any icons
+static bool s_tile_request_pending = false;
+static bool s_tile_request_full = false;
+static bool s_tile_request_in_flight = false;
+// first tile of the window to ask for, TILE_WINDOW_CURRENT keeps the window we hold
+static uint16_t s_tile_request_first = TILE_WINDOW_CURRENT;
+// the window the request in flight asked for, asked for again if its tiles can't be decoded
+static uint16_t s_tile_request_sent_first = TILE_WINDOW_CURRENT;
+// page requests that timed out or were dropped in a row, each waits twice as long before it is asked for again
+static uint8_t s_tile_retry_attempts = 0;
+// a state snapshot of an opened tile, sent ahead of everything else as it doesn't start a transfer
+static bool s_state_request_pending = false;
+static uint16_t s_state_request_index = 0;
+// perf counters asked for by pebblekit or the diagnostics window, sent as a single message
+static bool s_perf_pending = false;
+
+// icon requests waiting for the transfer lock, at most one per icon_array slot so the queue can't overflow
 typedef struct {
-  char icon_key[9];
+  char icon_key[ICON_KEY_SIZE];
   uint8_t icon_index;
-} RetryTimerData;
-RetryTimerData retry_data;
+  uint8_t priority;
+} IconRequest;
+static IconRequest s_icon_queue[ICON_ARRAY_SIZE];
+static uint8_t s_icon_queue_count = 0;
+// icons asked for by the batch request currently in flight
+static IconRequest s_icons_in_flight[ICON_BATCH_SIZE];
+static uint8_t s_icons_in_flight_count = 0;
+
+static void comm_tile_request_send(bool full);
+static void comm_dispatch();
+void comm_ready_callback(void *data);
+
+// records when a handshake phase first completed, 0 stays free to mean not yet
+static void comm_handshake_mark(uint32_t *phase) {
+  if (*phase == 0) { *phase = MAX(perf_now_ms() - s_handshake_start, 1u); }
+}
+
+// called as pebblekit confirms our tiles, ends the handshake
+static void comm_handshake_synced() {
+  if (s_handshake.synced) { return; }
+  comm_handshake_mark(&s_handshake.synced);
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Handshake: hello %d ms, pebblekit ready %d ms, tiles synced %d ms",
+          (int) s_handshake.hello, (int) s_handshake.ready, (int) s_handshake.synced);
+  #endif
+}
+static void comm_retry_callback(void *data);
+
+static void comm_icon_queue_remove(uint8_t position) {
+  s_icon_queue_count--;
+  memmove(&s_icon_queue[position], &s_icon_queue[position + 1], (s_icon_queue_count - position) * sizeof(IconRequest));
+}
+
+static void comm_tile_retry_callback(void *data) {
+  s_tile_retry_timer = NULL;
+  s_tile_request_pending = true;
+  comm_dispatch();
+}
+
+// asks for the page in flight again after a backoff, as the menu only asks for pages when the selection moves.
+// Until our tiles are synced the READY retry asks for them instead
+static void comm_tile_request_retry() {
+  if (!tiles_synced || s_tile_request_pending || s_tile_retry_timer) { return; }
+  // unless a newer page has been asked for since
+  if (s_tile_request_first == TILE_WINDOW_CURRENT) { s_tile_request_first = s_tile_request_sent_first; }
+  uint32_t timeout = MIN((uint32_t) OUTBOX_FAILED_TIMEOUT << s_tile_retry_attempts, (uint32_t) RETRY_READY_TIMEOUT);
+  s_tile_retry_attempts = MIN(s_tile_retry_attempts + 1, 4);
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Asking for tiles from %d again in %d ms", s_tile_request_first, (int) timeout);
+  #endif
+  s_tile_retry_timer = app_timer_register(timeout, comm_tile_retry_callback, NULL);
+}
+
+static void comm_transfer_timeout_callback(void *data) {
+  s_transfer_timer = NULL;
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Transfer timed out, %d icons in flight", s_icons_in_flight_count);
+  #endif
+  if (raw_data) { free(raw_data); }
+  raw_data = NULL;
+  // the icons stay pending and are asked for again the next time they are drawn
+  if (s_tile_request_in_flight) { comm_tile_request_retry(); }
+  data_transfer_lock = false;
+  s_tile_request_in_flight = false;
+  s_icons_in_flight_count = 0;
+  comm_dispatch();
+}
+
+static void comm_transfer_lock() {
+  data_transfer_lock = true;
+  if (s_transfer_timer) { app_timer_cancel(s_transfer_timer); }
+  s_transfer_timer = app_timer_register(TRANSFER_TIMEOUT, comm_transfer_timeout_callback, NULL);
+}
+
+// queues the in flight icons again, either because the connection was reset or pebblekit left them out of a batch
+static void comm_icon_requeue_in_flight(bool only_pending) {
+  IconRequest in_flight[ICON_BATCH_SIZE];
+  uint8_t count = s_icons_in_flight_count;
+  memcpy(in_flight, s_icons_in_flight, count * sizeof(IconRequest));
+  s_icons_in_flight_count = 0;
+  for(uint8_t i=0; i < count; i++) {
+    if (!only_pending || data_icon_array_is_pending(in_flight[i].icon_key, in_flight[i].icon_index)) {
+      comm_icon_request(in_flight[i].icon_key, in_flight[i].icon_index, in_flight[i].priority);
+    }
+  }
+}
+
+// releases the transfer lock and sends whatever is queued next
+static void comm_transfer_unlock() {
+  data_transfer_lock = false;
+  s_tile_request_in_flight = false;
+  s_icons_in_flight_count = 0;
+  if (s_transfer_timer) { app_timer_cancel(s_transfer_timer); }
+  s_transfer_timer = NULL;
+  comm_dispatch();
+}
+
+// abandons the transfer under way after a malformed message, the request is made again like a timed out one
+static void comm_transfer_drop(uint8_t **data) {
+  free(*data);
+  *data = NULL;
+  if (s_tile_request_in_flight) { comm_tile_request_retry(); }
+  comm_transfer_unlock();
+}
+
+//! Turns down a transfer too large for the heap. Pebblekit is told ahead of anything else and sends the tiles
+//! as a smaller window, or fewer icons per batch, when they are asked for again
+//! @param transfer_type TRANSFER_TYPE_* of the transfer
+//! @param size TransferLength of the transfer
+static void comm_transfer_refuse(uint8_t transfer_type, int size) {
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Refusing transfer of %d bytes, free bytes: %d", size, (int) heap_bytes_free());
+  #endif
+  s_refused_pending = true;
+  s_refused_type = transfer_type;
+  s_refused_size = size;
+  // asked for again straight away while pebblekit's transfers keep shrinking, after that the handshake, the
+  // menu and redrawn icons ask at their own pace
+  int *smallest = (transfer_type == TRANSFER_TYPE_ICON_BATCH) ? &s_refused_icon_size : &s_refused_tile_size;
+  bool shrinking = *smallest == 0 || size < *smallest;
+  if (shrinking) {
+    *smallest = size;
+    if (transfer_type == TRANSFER_TYPE_ICON_BATCH) {
+      comm_icon_requeue_in_flight(true);
+    } else {
+      s_tile_request_pending = true;
+    }
+  } else if (transfer_type != TRANSFER_TYPE_ICON_BATCH) {
+    comm_tile_request_retry();
+  }
+  comm_transfer_unlock();
+}
+
+// caches the window launches open on, the one holding default_idx. Pages fetched while scrolling are not
+// cached, or every scroll past a page boundary would write to flash. A window too large for the cache is cut
+// down to the tiles around default_idx, pebblekit sends the rest as a delta on the next launch
+static void comm_tile_cache_write() {
+  if (!tile_array || tile_array->default_idx < tile_array->first ||
+      tile_array->default_idx >= tile_array->first + tile_array->used) { return; }
+  if (tile_array->bytes <= TILE_CACHE_MAX_SIZE) {
+    storage_tile_cache_write((uint8_t*) tile_array, tile_array->bytes, tile_array->hash);
+    return;
+  }
+  TileArray *image = data_tile_array_window_image(TILE_CACHE_MAX_SIZE);
+  if (!image) { return; }
+  storage_tile_cache_write((uint8_t*) image, image->bytes, image->hash);
+  free(image);
+}
 
 void process_data(DictionaryIterator *dict, uint8_t **data, uint8_t transfer_type) {
     // Get the received image chunk
     Tuple *size_t = dict_find(dict, MESSAGE_KEY_TransferLength);
     if(size_t) {
       int size = size_t->value->int32;
-      // Allocate buffer for image data
-      *data = (uint8_t*) malloc(size * sizeof(uint8_t));
+      // a new transfer replaces one that was abandoned part way through
+      if (*data) { free(*data); }
+      *data = NULL;
+      s_transfer_size = 0;
+      s_chunks_received = 0;
+      if (size <= 0) {
+        comm_transfer_unlock();
+        return;
+      }
+      // Allocate buffer for image data, leaving room to decode it
+      if ((uint32_t) size * 2 + TRANSFER_HEAP_RESERVE > heap_bytes_free() ||
+          !(*data = (uint8_t*) malloc(size * sizeof(uint8_t)))) {
+        comm_transfer_refuse(transfer_type, size);
+        return;
+      }
+      s_transfer_size = size;
+      perf_heap_sample();
     }
+    // chunks of a transfer that already timed out have nowhere to go
+    if(!*data) { return; }
     Tuple *chunk_t = dict_find(dict, MESSAGE_KEY_TransferChunk);
     if(chunk_t) {
       uint8_t *chunk_data = chunk_t->value->data;
 
       Tuple *chunk_size_t = dict_find(dict, MESSAGE_KEY_TransferChunkLength);
-      int chunk_size = chunk_size_t->value->int32;
       Tuple *index_t = dict_find(dict, MESSAGE_KEY_TransferIndex);
-      int index = index_t->value->int32;
+      int chunk_size = (chunk_size_t) ? chunk_size_t->value->int32 : -1;
+      int index = (index_t) ? index_t->value->int32 : -1;
+      // a chunk must fit both the tuple it came in and the buffer it goes to
+      if (chunk_size < 0 || chunk_size > chunk_t->length || index < 0 || index > s_transfer_size - chunk_size) {
+        #if DEBUG > 0
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Chunk of %d bytes at %d outside transfer of %d bytes", chunk_size, index, s_transfer_size);
+        #endif
+        comm_transfer_drop(data);
+        return;
+      }
 
-      // Save the chunk
+      // Save the chunk, windowed chunks may arrive out of order or more than once but always land at their own index
       memcpy(&(*data)[index], chunk_data, chunk_size);
+      perf_transfer_chunk(transfer_type, chunk_size);
+      Tuple *seq_t = dict_find(dict, MESSAGE_KEY_TransferSeq);
+      if (seq_t && (uint32_t) seq_t->value->int32 < 64) { s_chunks_received |= (uint64_t) 1 << seq_t->value->int32; }
+      if (s_transfer_timer) { app_timer_reschedule(s_transfer_timer, TRANSFER_TIMEOUT); }
     }
 
     // Complete?
     Tuple *complete_t = dict_find(dict, MESSAGE_KEY_TransferComplete);
     if(complete_t) {
+      // a windowed transfer sends its chunk count, drop it if any chunk is missing and let the request be made again
+      Tuple *count_t = dict_find(dict, MESSAGE_KEY_TransferSeq);
+      if (count_t) {
+        uint8_t chunk_count = MIN((uint32_t) count_t->value->int32, 64u);
+        uint64_t expected = (chunk_count == 64) ? UINT64_MAX : ((uint64_t) 1 << chunk_count) - 1;
+        if (s_chunks_received != expected) {
+          #if DEBUG > 0
+          APP_LOG(APP_LOG_LEVEL_DEBUG, "Transfer missing chunks, dropping it");
+          #endif
+          comm_transfer_drop(data);
+          return;
+        }
+      }
+      if (complete_t->value->int32 < 0 || complete_t->value->int32 > s_transfer_size) {
+        comm_transfer_drop(data);
+        return;
+      }
+      bool request_full = false;
       switch(transfer_type) {
-        case TRANSFER_TYPE_ICON:
-          data_icon_array_add_icon(*data);
+        case TRANSFER_TYPE_ICON_BATCH:
+          s_refused_icon_size = 0;
+          data_icon_array_add_icons(*data, complete_t->value->int32);
+          // pebblekit leaves out icons that don't fit its batch budget, they go back in the queue
+          comm_icon_requeue_in_flight(true);
         break;
         case TRANSFER_TYPE_TILE:
-          data_tile_array_pack_tiles(*data, complete_t->value->int32);
+          if (!data_tile_array_pack_tiles(*data, complete_t->value->int32)) {
+            // the current tiles stay. Unless a newer request is waiting, the ready retry asks for the same window
+            // again once pebblekit answers
+            if (!s_tile_request_pending) {
+              s_tile_request_first = s_tile_request_sent_first;
+              tiles_synced = false;
+              if (!s_ready_timer) { s_ready_timer = app_timer_register(RETRY_READY_TIMEOUT, comm_ready_callback, NULL); }
+            }
+            break;
+          }
+          s_refused_tile_size = 0;
+          s_tile_retry_attempts = 0;
+          // a late page makes its retry unnecessary
+          if (s_tile_retry_timer) { app_timer_cancel(s_tile_retry_timer); }
+          s_tile_retry_timer = NULL;
+          tiles_synced = true;
+          comm_handshake_synced();
+          comm_tile_cache_write();
+        break;
+        case TRANSFER_TYPE_TILE_DELTA:
+          // fall back to a full transfer if the patched tiles don't match what pebblekit has
+          request_full = !data_tile_array_patch_tiles(*data, complete_t->value->int32);
+          tiles_synced = !request_full;
+          if (tiles_synced) { s_refused_tile_size = 0; s_tile_retry_attempts = 0; comm_handshake_synced(); }
+          if (tiles_synced) { comm_tile_cache_write(); }
         break;
       }
+      // the heap is at its lowest with the blob and what was built from it both allocated
+      perf_heap_sample();
       free(*data);
       *data = NULL;
-      data_transfer_lock = false;
       #if DEBUG > 0
       APP_LOG(APP_LOG_LEVEL_DEBUG, "Transfer complete, free bytes: %d", heap_bytes_free());
       #endif
-      
+      if (request_full) { comm_tile_request_send(true); }
+      comm_transfer_unlock();
     }
 }
 
@@ -61,12 +352,13 @@ void process_data(DictionaryIterator *dict, uint8_t **data, uint8_t transfer_typ
 static void inbox(DictionaryIterator *dict, void *context) {
     Tuple *type_t = dict_find(dict, MESSAGE_KEY_TransferType);
     Tuple *color_t = dict_find(dict, MESSAGE_KEY_Color);
+    if (!type_t) { return; }
     switch(type_t->value->int32) {
-      case TRANSFER_TYPE_ICON:
+      case TRANSFER_TYPE_ICON_BATCH:
         #if DEBUG > 0
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Received icon chunk");
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Received icon batch chunk");
         #endif
-        process_data(dict, &raw_data, TRANSFER_TYPE_ICON);
+        process_data(dict, &raw_data, TRANSFER_TYPE_ICON_BATCH);
         break;
       case TRANSFER_TYPE_TILE:
         #if DEBUG > 0
@@ -75,11 +367,26 @@ static void inbox(DictionaryIterator *dict, void *context) {
         clay_needs_config = false;
         process_data(dict, &raw_data, TRANSFER_TYPE_TILE);
         break;
+      case TRANSFER_TYPE_TILE_DELTA:
+        #if DEBUG > 0
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Received tile delta chunk");
+        #endif
+        process_data(dict, &raw_data, TRANSFER_TYPE_TILE_DELTA);
+        break;
       case TRANSFER_TYPE_XHR:
         break;
       case TRANSFER_TYPE_COLOR:
         if (color_t) { action_window_set_color(color_t->value->int32); }
         break;
+      case TRANSFER_TYPE_STATE: {
+        Tuple *index_t = dict_find(dict, MESSAGE_KEY_RequestIndex);
+        Tuple *states_t = dict_find(dict, MESSAGE_KEY_ButtonStates);
+        if (index_t && states_t) { action_window_set_states(index_t->value->int32, states_t->value->data, states_t->length); }
+        break;
+      }
+      case TRANSFER_TYPE_PERF:
+        comm_perf_send();
+        break;
       case TRANSFER_TYPE_ERROR:
         #if DEBUG > 0
         APP_LOG(APP_LOG_LEVEL_DEBUG, "Received Error");
@@ -91,18 +398,32 @@ static void inbox(DictionaryIterator *dict, void *context) {
         APP_LOG(APP_LOG_LEVEL_DEBUG, "Received acknowledge");
         #endif
         break;
-      case TRANSFER_TYPE_READY:
+      case TRANSFER_TYPE_READY: {
+        // sent by pebblekit as soon as it starts and in answer to ours, whichever comes first starts the tiles
+        Tuple *version_t = dict_find(dict, MESSAGE_KEY_Version);
         #if DEBUG > 0
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "JS Environment Ready");
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "JS Environment Ready, protocol %d", version_t ? (int) version_t->value->int32 : 0);
         #endif
+        if (version_t && version_t->value->int32 != PROTOCOL_VERSION) {
+          APP_LOG(APP_LOG_LEVEL_WARNING, "Pebblekit protocol %d, expected %d", (int) version_t->value->int32, PROTOCOL_VERSION);
+        }
+        comm_handshake_mark(&s_handshake.ready);
+        s_pebblekit_ready = true;
         comm_tile_request();
         break;
+      }
       case TRANSFER_TYPE_NO_CLAY:
         #if DEBUG > 0
         APP_LOG(APP_LOG_LEVEL_DEBUG, "No clay config present");
         #endif
+        // this answers our tile request, so nothing else is coming for it
+        if (s_tile_request_in_flight) { comm_transfer_unlock(); }
         if(!clay_needs_config) {
           clay_needs_config = true;
+          storage_tile_cache_clear();
+          action_window_pop();
+          menu_window_pop();
+          data_tile_array_free();
           loading_window_pop();
           loading_window_push("No tiles configured in watch app");
         }
@@ -110,112 +431,407 @@ static void inbox(DictionaryIterator *dict, void *context) {
       case TRANSFER_TYPE_REFRESH:
         pebblekit_connection_callback(true);
         break;
+      case TRANSFER_TYPE_CACHE_VALID:
+        #if DEBUG > 0
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Cached tiles are current");
+        #endif
+        tiles_synced = true;
+        comm_handshake_synced();
+        comm_transfer_unlock();
+        break;
 
     }
 }
-void retry_timer_callback(void *data) {
-  RetryTimerData *timerData = (RetryTimerData*) data;
-  comm_icon_request(timerData->icon_key, timerData->icon_index);
-  free(data);
+static void comm_retry_callback(void *data) {
+  s_retry_timer = NULL;
+  comm_dispatch();
+}
+
+// tells pebblekit how many tiles we hold, how large a chunk our inbox takes and how much heap a transfer can
+// use right now
+static void comm_write_limits(DictionaryIterator *dict) {
+  dict_write_uint8(dict, MESSAGE_KEY_MaxTiles, MAX_TILES);
+  dict_write_uint32(dict, MESSAGE_KEY_InboxMax, app_message_inbox_size_maximum());
+  dict_write_uint32(dict, MESSAGE_KEY_InboxSize, s_inbox_size);
+  dict_write_uint32(dict, MESSAGE_KEY_HeapFree, heap_bytes_free());
 }
 
-// ask for a tile data after ready
+//! Tells pebblekit we are ready along with our protocol version and capabilities, repeated until our tiles are
+//! synced. Retries start at HANDSHAKE_RETRY_TIMEOUT and double up to RETRY_READY_TIMEOUT, once pebblekit has
+//! answered they only cover a tile request that was lost
 void comm_ready_callback(void *data) {
-  if (!tile_array) {
+  if (!tiles_synced) {
     DictionaryIterator *dict;
-    uint32_t result = app_message_outbox_begin(&dict);
+    // anything already in the outbox will get pebblekit's attention just as well
+    uint32_t result = (s_outbox_message == OUTBOX_NONE) ? app_message_outbox_begin(&dict) : APP_MSG_BUSY;
     #if DEBUG > 1
     APP_LOG(APP_LOG_LEVEL_DEBUG, "result: %d", (int)result);
     #endif
     if (result == APP_MSG_OK) {
       dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_READY);
+      dict_write_uint8(dict, MESSAGE_KEY_Version, PROTOCOL_VERSION);
+      dict_write_uint32(dict, MESSAGE_KEY_Capabilities, CAPABILITIES);
+      comm_write_limits(dict);
       dict_write_end(dict);
       app_message_outbox_send();
+      s_outbox_message = OUTBOX_READY;
+      comm_handshake_mark(&s_handshake.hello);
     }
     outbox_attempts = MIN(30, outbox_attempts + 1);
+    uint32_t timeout = (s_pebblekit_ready || outbox_attempts > 5) ? RETRY_READY_TIMEOUT :
+        MIN(HANDSHAKE_RETRY_TIMEOUT << (outbox_attempts - 1), RETRY_READY_TIMEOUT);
     #if DEBUG > 1
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Not ready, waiting %d ms", 500 * outbox_attempts);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Not ready, waiting %d ms", (int) timeout);
     #endif
-    s_ready_timer = app_timer_register(500 * outbox_attempts, comm_ready_callback, NULL);
+    s_ready_timer = app_timer_register(timeout, comm_ready_callback, NULL);
   } else {
     s_ready_timer = NULL;
   }
 }
 
-// ask pebblekit to lookup and send a related icon based on hash key
-void comm_icon_request(char* icon_key, uint8_t icon_index) {
-    if (!data_transfer_lock) {
-      s_retry_timer = NULL;
-      // Asks pebblekit for an icon based on a hash key, to be inserted at provided index in data_icon_array
-      data_transfer_lock = true;
-      DictionaryIterator *dict;
-      uint32_t result = app_message_outbox_begin(&dict);
-      if (result == APP_MSG_OK) {
-        dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_ICON);
-        dict_write_uint8(dict, MESSAGE_KEY_IconIndex, icon_index);
-        dict_write_cstring(dict, MESSAGE_KEY_IconKey, icon_key);
-        dict_write_end(dict);
-        app_message_outbox_send();
+// sends the next queued request once the previous transfer has completed, tiles go first and icons wait
+// until pebblekit has answered a tile request so they aren't sent before it is listening
+static void comm_dispatch() {
+  // one message at a time, the next goes once outbox_sent or outbox_failed has been called for this one
+  if (s_retry_timer || s_outbox_message != OUTBOX_NONE) { return; }
+  // pebblekit answers presses and state requests with a single message, so they can go out while a transfer
+  // is under way
+  bool send_press = s_press_queue_count > 0;
+  bool send_state = s_state_request_pending && tiles_synced;
+  bool send_single = send_press || send_state || s_perf_pending || s_refused_pending;
+  if (data_transfer_lock && !send_single) { return; }
+  if (!send_single && !s_tile_request_pending && (!tiles_synced || s_icon_queue_count == 0)) { return; }
+
+  DictionaryIterator *dict;
+  if (app_message_outbox_begin(&dict) != APP_MSG_OK) {
+    // the outbox is still busy with a message we didn't send
+    s_retry_timer = app_timer_register(OUTBOX_RETRY_TIMEOUT, comm_retry_callback, NULL);
+    return;
+  }
+  if (send_press) {
+    // ask pebblekit to find and call a REST endpoint based on tile id and the button pressed
+    s_press_in_flight = s_press_queue[0];
+    s_press_queue_count--;
+    memmove(&s_press_queue[0], &s_press_queue[1], s_press_queue_count * sizeof(PressRequest));
+    s_press_in_flight.attempts++;
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_XHR);
+    dict_write_uint16(dict, MESSAGE_KEY_RequestIndex, s_press_in_flight.index);
+    dict_write_uint8(dict, MESSAGE_KEY_RequestButton, s_press_in_flight.button);
+    if (s_press_in_flight.count > 1) { dict_write_uint8(dict, MESSAGE_KEY_RequestRepeat, s_press_in_flight.count); }
+    s_outbox_message = OUTBOX_PRESS;
+  } else if (send_state) {
+    s_state_request_pending = false;
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_STATE);
+    dict_write_uint16(dict, MESSAGE_KEY_RequestIndex, s_state_request_index);
+    s_outbox_message = OUTBOX_STATE;
+  } else if (s_perf_pending) {
+    s_perf_pending = false;
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_PERF);
+    dict_write_data(dict, MESSAGE_KEY_PerfCounters, (uint8_t*) perf_counters(), sizeof(PerfCounters));
+    s_outbox_message = OUTBOX_PERF;
+  } else if (s_refused_pending) {
+    s_refused_pending = false;
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_REFUSED);
+    dict_write_uint8(dict, MESSAGE_KEY_RefusedType, s_refused_type);
+    dict_write_uint32(dict, MESSAGE_KEY_TransferLength, s_refused_size);
+    dict_write_uint32(dict, MESSAGE_KEY_HeapFree, heap_bytes_free());
+    s_outbox_message = OUTBOX_REFUSED;
+  } else if (s_tile_request_pending) {
+    s_outbox_message = OUTBOX_TILE;
+    s_tile_request_pending = false;
+    s_tile_request_in_flight = true;
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_TILE);
+    // our hello may have gone before pebblekit was listening, so the tile request repeats what it said
+    dict_write_uint32(dict, MESSAGE_KEY_Capabilities, CAPABILITIES);
+    comm_write_limits(dict);
+    if (tile_array) {
+      uint16_t first = (s_tile_request_first != TILE_WINDOW_CURRENT) ? s_tile_request_first : tile_array->first;
+      dict_write_uint16(dict, MESSAGE_KEY_TileWindow, first);
+    }
+    if (tile_array && !s_tile_request_full) {
+      // lets pebblekit skip the transfer if our tiles are current, or send only the tiles that changed
+      uint8_t tile_hashes[MAX_TILES * 4];
+      dict_write_uint32(dict, MESSAGE_KEY_TileHash, tile_array->hash);
+      dict_write_uint16(dict, MESSAGE_KEY_TileBase, tile_array->first);
+      dict_write_data(dict, MESSAGE_KEY_TileHashes, tile_hashes, data_tile_array_get_hashes(tile_hashes));
+    }
+    s_tile_request_sent_first = s_tile_request_first;
+    s_tile_request_first = TILE_WINDOW_CURRENT;
+  } else {
+    // up to ICON_BATCH_SIZE icons, highest priority first and oldest first within a priority.
+    // Each is written as its slot index followed by its null terminated key
+    uint8_t icon_keys[ICON_BATCH_SIZE * (ICON_KEY_SIZE + 1)];
+    uint16_t size = 0;
+    while (s_icon_queue_count > 0 && s_icons_in_flight_count < ICON_BATCH_SIZE) {
+      uint8_t next = 0;
+      for(uint8_t i=1; i < s_icon_queue_count; i++) {
+        if (s_icon_queue[i].priority > s_icon_queue[next].priority) { next = i; }
       }
-    } else {
-      // data transfer is in-flight (locked), so create a timer to re-call this function with params in 100ms
-      RetryTimerData *retry_data = malloc(sizeof(RetryTimerData));
-      retry_data->icon_index = icon_index;
-      strcpy(retry_data->icon_key, icon_key);
-      s_retry_timer = app_timer_register(100, retry_timer_callback, (void*) retry_data);
+      IconRequest *request = &s_icons_in_flight[s_icons_in_flight_count++];
+      *request = s_icon_queue[next];
+      comm_icon_queue_remove(next);
+      #if DEBUG > 1
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Requesting icon %s, priority %d, %d queued", request->icon_key, request->priority, s_icon_queue_count);
+      #endif
+      icon_keys[size++] = request->icon_index;
+      strcpy((char*) &icon_keys[size], request->icon_key);
+      size += strlen(request->icon_key) + 1;
     }
+    // Asks pebblekit for icons based on their hash keys, to be inserted at the provided indexes in data_icon_array
+    dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_ICON_BATCH);
+    dict_write_data(dict, MESSAGE_KEY_IconKeys, icon_keys, size);
+    dict_write_uint32(dict, MESSAGE_KEY_HeapFree, heap_bytes_free());
+    s_outbox_message = OUTBOX_ICONS;
+  }
+  dict_write_end(dict);
+  app_message_outbox_send();
+  if (s_outbox_message == OUTBOX_TILE || s_outbox_message == OUTBOX_ICONS) { comm_transfer_lock(); }
+}
 
+//! Puts a press back at the front of the queue after a failed send, or gives up on it after PRESS_MAX_ATTEMPTS
+static void comm_press_retry(PressRequest *press) {
+  if (press->attempts >= PRESS_MAX_ATTEMPTS || s_press_queue_count == PRESS_QUEUE_SIZE) {
+    #if DEBUG > 0
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Dropping press of button %d after %d attempts", press->button, press->attempts);
+    #endif
+    s_outbox_stats.dropped++;
+    action_window_set_color(ACTION_COLOR_ERROR);
+    return;
+  }
+  memmove(&s_press_queue[1], &s_press_queue[0], s_press_queue_count * sizeof(PressRequest));
+  s_press_queue[0] = *press;
+  s_press_queue_count++;
 }
 
-// ask pebblekit to send down its tile data
-void comm_tile_request() {
-    if (!data_transfer_lock) {
-      data_transfer_lock = true;
-      DictionaryIterator *dict;
-      
-      uint32_t result = app_message_outbox_begin(&dict);
-      if (result == APP_MSG_OK) {
-        dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_TILE);
-        dict_write_end(dict);
-        app_message_outbox_send();
-      } 
+static void outbox_sent(DictionaryIterator *dict, void *context) {
+  s_outbox_message = OUTBOX_NONE;
+  s_outbox_stats.sent++;
+  comm_dispatch();
+}
+
+// whatever failed is asked for again after OUTBOX_FAILED_TIMEOUT, a transfer it would have started is abandoned
+static void outbox_failed(DictionaryIterator *dict, AppMessageResult reason, void *context) {
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Outbox failed: %d, message %d", (int) reason, s_outbox_message);
+  #endif
+  s_outbox_stats.failed++;
+  switch(s_outbox_message) {
+    case OUTBOX_PRESS:
+      comm_press_retry(&s_press_in_flight);
+      break;
+    case OUTBOX_STATE:
+      s_state_request_pending = true;
+      break;
+    case OUTBOX_PERF:
+      s_perf_pending = true;
+      break;
+    case OUTBOX_REFUSED:
+      s_refused_pending = true;
+      break;
+    case OUTBOX_TILE:
+      s_tile_request_pending = true;
+      // unless a newer page has been asked for since
+      if (s_tile_request_first == TILE_WINDOW_CURRENT) { s_tile_request_first = s_tile_request_sent_first; }
+      data_transfer_lock = false;
+      s_tile_request_in_flight = false;
+      break;
+    case OUTBOX_ICONS:
+      data_transfer_lock = false;
+      comm_icon_requeue_in_flight(false);
+      break;
+  }
+  if (s_outbox_message == OUTBOX_TILE || s_outbox_message == OUTBOX_ICONS) {
+    if (s_transfer_timer) { app_timer_cancel(s_transfer_timer); }
+    s_transfer_timer = NULL;
+  }
+  s_outbox_message = OUTBOX_NONE;
+  if (s_retry_timer) { app_timer_cancel(s_retry_timer); }
+  s_retry_timer = app_timer_register(OUTBOX_FAILED_TIMEOUT, comm_retry_callback, NULL);
+}
+
+//! Queues a request for pebblekit to lookup and send an icon, requests for the same key are merged
+//! @param icon_key Icon key as used in index.js
+//! @param icon_index Slot in icon_array the icon is inserted at, replaces any request queued for that slot
+//! @param priority One of ICON_PRIORITY_*, higher priorities are sent first
+void comm_icon_request(char* icon_key, uint8_t icon_index, uint8_t priority) {
+  if (icon_index >= ICON_ARRAY_SIZE || strlen(icon_key) == 0) { return; }
+  for(uint8_t i=0; i < s_icons_in_flight_count; i++) {
+    if (s_icons_in_flight[i].icon_index == icon_index && strcmp(s_icons_in_flight[i].icon_key, icon_key) == 0) { return; }
+  }
+
+  // the slot has been given to another key, so whatever was queued for it is stale
+  for(uint8_t i=s_icon_queue_count; i > 0; i--) {
+    if (s_icon_queue[i - 1].icon_index == icon_index && strcmp(s_icon_queue[i - 1].icon_key, icon_key) != 0) {
+      comm_icon_queue_remove(i - 1);
     }
+  }
+
+  IconRequest *request = NULL;
+  for(uint8_t i=0; i < s_icon_queue_count && !request; i++) {
+    if (strcmp(s_icon_queue[i].icon_key, icon_key) == 0) { request = &s_icon_queue[i]; }
+  }
+  if (request) {
+    request->priority = MAX(request->priority, priority);
+  } else {
+    request = &s_icon_queue[s_icon_queue_count++];
+    strncpy(request->icon_key, icon_key, ICON_KEY_SIZE - 1);
+    request->icon_key[ICON_KEY_SIZE - 1] = '\0';
+    request->priority = priority;
+  }
+  request->icon_index = icon_index;
+  comm_dispatch();
 }
 
-// ask pebblekit to find and call a REST endpoint based on tile id and the button pressed
-void comm_xhr_request(void *context, uint8_t id, uint8_t button) {
-    DictionaryIterator *dict;
-    
-    uint32_t result = app_message_outbox_begin(&dict);
-    if (result == APP_MSG_OK) {
-        dict_write_uint8(dict, MESSAGE_KEY_TransferType, TRANSFER_TYPE_XHR);
-        dict_write_uint8(dict, MESSAGE_KEY_RequestIndex, id);
-        dict_write_uint8(dict, MESSAGE_KEY_RequestButton, button);
-        dict_write_end(dict);
-        app_message_outbox_send();
+//! Drops a queued icon request. A request already in flight is left to complete, its icon is discarded on
+//! arrival if the slot has been given to another key in the meantime
+//! @param icon_key Icon key as used in index.js
+//! @param icon_index Slot in icon_array the request was made for
+void comm_icon_cancel(char* icon_key, uint8_t icon_index) {
+  for(uint8_t i=s_icon_queue_count; i > 0; i--) {
+    if (s_icon_queue[i - 1].icon_index == icon_index && strcmp(s_icon_queue[i - 1].icon_key, icon_key) == 0) {
+      #if DEBUG > 1
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Cancelled icon request %s, %d queued", icon_key, s_icon_queue_count - 1);
+      #endif
+      comm_icon_queue_remove(i - 1);
     }
+  }
+}
+
+// ask pebblekit to send down its tile data, a full transfer ignores any tiles we already hold
+static void comm_tile_request_send(bool full) {
+  // the transfer already under way will bring the tiles up to date
+  if (s_tile_request_in_flight && !full) { return; }
+  s_tile_request_full = (s_tile_request_pending && s_tile_request_full) || full;
+  s_tile_request_pending = true;
+  comm_dispatch();
+}
+
+void comm_tile_request() {
+  comm_tile_request_send(false);
+}
+
+//! Asks pebblekit for the window of tiles centred on a tile we don't hold, or are close to running out of.
+//! Windows are as wide as the one we hold, pebblekit sends fewer than MAX_TILES if we couldn't afford more
+//! @param index Absolute index of the tile
+void comm_tile_page_request(uint16_t index) {
+  // pages are only asked for once a full tile request has told us how many tiles there are
+  if (!tile_array || !tiles_synced || tile_array->used == 0 || tile_array->total <= tile_array->used) { return; }
+  uint16_t first = (index > tile_array->used / 2) ? index - tile_array->used / 2 : 0;
+  first = MIN(first, tile_array->total - tile_array->used);
+  if (first == tile_array->first && !s_tile_request_pending) { return; }
+  if (s_tile_request_pending && first == s_tile_request_first) { return; }
+  #if DEBUG > 1
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Requesting tiles from %d for tile %d", first, index);
+  #endif
+  // a newer page replaces one still waiting to be sent
+  s_tile_request_full = s_tile_request_pending && s_tile_request_full;
+  s_tile_request_first = first;
+  s_tile_request_pending = true;
+  comm_dispatch();
+}
+
+//! Asks pebblekit for the current state of every button of a tile with a status endpoint, answered by a
+//! single TRANSFER_TYPE_STATE message, see action_window_set_states()
+//! @param index Absolute index of the tile
+void comm_state_request(uint16_t index) {
+  s_state_request_index = index;
+  s_state_request_pending = true;
+  comm_dispatch();
+}
+
+//! Queues a button press for pebblekit, presses go out ahead of any other request. A press that finds the
+//! queue full is dropped and the action window shows an error
+//! @param id Absolute index of the tile
+//! @param button One of UP..DOWN_HOLD
+//! @param count Number of presses the request stands for, see action_window_press()
+void comm_xhr_request(void *context, uint16_t id, uint8_t button, uint8_t count) {
+  if (s_press_queue_count == PRESS_QUEUE_SIZE) {
+    #if DEBUG > 0
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Press queue full, dropping press of button %d", button);
+    #endif
+    s_outbox_stats.dropped++;
+    action_window_set_color(ACTION_COLOR_ERROR);
+    return;
+  }
+  s_press_queue[s_press_queue_count++] = (PressRequest) {.index = id, .button = button, .count = count, .attempts = 0};
+  comm_dispatch();
+  if (s_press_queue_count > 0) { s_outbox_stats.queued++; }
+}
+
+//! Sends the perf counters to pebblekit as one TRANSFER_TYPE_PERF message, see perf_counters()
+void comm_perf_send() {
+  s_perf_pending = true;
+  comm_dispatch();
+}
+
+OutboxStats *comm_outbox_stats() {
+  return &s_outbox_stats;
 }
 
 // kicks of loop to wait for pebblekit ready and then request tile data
 void comm_callback_start() {
   data_tile_array_free();
-  data_transfer_lock = false;
+  tiles_synced = false;
   outbox_attempts = 0;
+  if (raw_data) { free(raw_data); }
+  raw_data = NULL;
+  // the connection was reset so nothing in flight will complete, ask for the icons again once pebblekit is back
+  data_transfer_lock = false;
+  s_tile_request_pending = false;
+  s_tile_request_in_flight = false;
+  s_tile_request_first = TILE_WINDOW_CURRENT;
+  s_tile_request_sent_first = TILE_WINDOW_CURRENT;
+  s_tile_retry_attempts = 0;
+  if (s_tile_retry_timer) { app_timer_cancel(s_tile_retry_timer); }
+  s_tile_retry_timer = NULL;
+  s_state_request_pending = false;
+  s_perf_pending = false;
+  s_refused_pending = false;
+  s_refused_tile_size = 0;
+  s_refused_icon_size = 0;
+  // a press in the outbox may have been lost with the connection, sending it again is better than dropping it
+  if (s_outbox_message == OUTBOX_PRESS) { comm_press_retry(&s_press_in_flight); }
+  s_outbox_message = OUTBOX_NONE;
+  comm_icon_requeue_in_flight(false);
   if (s_retry_timer) {app_timer_cancel(s_retry_timer);}
   if (s_ready_timer) {app_timer_cancel(s_ready_timer);}
+  if (s_transfer_timer) {app_timer_cancel(s_transfer_timer);}
   s_retry_timer = NULL;
   s_ready_timer = NULL;
-  app_timer_register(RETRY_READY_TIMEOUT, comm_ready_callback, NULL);
+  s_transfer_timer = NULL;
+
+  // render the last known tiles straight away, pebblekit will replace them later if they are stale
+  uint16_t cache_size;
+  uint8_t *cache = storage_tile_cache_read(&cache_size);
+  if (cache) {
+    #if DEBUG > 0
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Loading %d bytes of cached tile data", cache_size);
+    #endif
+    data_tile_array_load(cache, cache_size);
+  }
+  // say hello straight away, a warm pebblekit answers within a round trip
+  s_handshake_start = perf_now_ms();
+  memset(&s_handshake, 0, sizeof(s_handshake));
+  s_pebblekit_ready = false;
+  comm_ready_callback(NULL);
 }
 
 
 void comm_init() {
   s_ready_timer = NULL;
   s_retry_timer = NULL;
+  s_transfer_timer = NULL;
+  s_icon_queue_count = 0;
+  s_icons_in_flight_count = 0;
   data_icon_array_init(ICON_ARRAY_SIZE);
+  s_outbox_message = OUTBOX_NONE;
+  s_press_queue_count = 0;
   app_message_register_inbox_received(inbox);
+  app_message_register_outbox_sent(outbox_sent);
+  app_message_register_outbox_failed(outbox_failed);
 
-  app_message_open(INBOX_SIZE, OUTBOX_SIZE);
+  s_inbox_size = MIN(INBOX_SIZE, app_message_inbox_size_maximum());
+  app_message_open(s_inbox_size, OUTBOX_SIZE);
 }
 
 void comm_deinit() {
@@ -225,7 +841,9 @@ void comm_deinit() {
   data_icon_array_free();
   if (s_retry_timer) {app_timer_cancel(s_retry_timer);}
   if (s_ready_timer) {app_timer_cancel(s_ready_timer);}
+  if (s_transfer_timer) {app_timer_cancel(s_transfer_timer);}
   s_ready_timer = NULL;
   s_retry_timer = NULL;
+  s_transfer_timer = NULL;
   // Free image data buffer
 }
@@ -1,18 +1,44 @@
 #pragma once
 #include <pebble.h>
+// messages through the outbox since launch. queued counts messages that had to wait for the outbox, dropped
+// counts presses given up on because the queue was full or they kept failing
+typedef struct {
+  uint16_t queued;
+  uint16_t sent;
+  uint16_t failed;
+  uint16_t dropped;
+} OutboxStats;
+
 void comm_init();
 
 void comm_deinit();
 
-void comm_icon_request(char* iconKey, uint8_t iconIndex);
+void comm_icon_request(char* iconKey, uint8_t iconIndex, uint8_t priority);
+void comm_icon_cancel(char* iconKey, uint8_t iconIndex);
 void comm_tile_request();
-void comm_xhr_request(void *context, uint8_t id, uint8_t button);
+void comm_tile_page_request(uint16_t index);
+void comm_xhr_request(void *context, uint16_t id, uint8_t button, uint8_t count);
+void comm_state_request(uint16_t index);
+void comm_perf_send();
 void comm_callback_start();
+OutboxStats *comm_outbox_stats();
 
+// largest inbox asked for, the platform may allow less, see comm_init
 #ifdef PBL_PLATFORM_APLITE
     #define INBOX_SIZE 256
 #else
     #define INBOX_SIZE 8200
 #endif
 
-#define OUTBOX_SIZE 64
\ No newline at end of file
+// icons asked for in a single batch request
+#ifdef PBL_PLATFORM_APLITE
+    #define ICON_BATCH_SIZE 2
+#else
+    #define ICON_BATCH_SIZE 4
+#endif
+
+// TileWindow of a tile request that keeps the window already held
+#define TILE_WINDOW_CURRENT 0xffff
+
+// room for a tile request carrying MAX_TILES tile hashes and the watch limits
+#define OUTBOX_SIZE (112 + MAX_TILES * 4)
\ No newline at end of file
@@ -3,178 +3,1060 @@
 #include "c/user_interface/menu_window.h"
 #include "c/user_interface/action_window.h"
 #include "c/modules/comm.h"
+#include "c/modules/storage.h"
+#include "c/modules/perf.h"
 #include "c/stateful.h"
 
 TileArray *tile_array = NULL;
 IconArray *icon_array = NULL;
 GBitmap *default_icon = NULL;
 
-static void data_tile_array_init(uint8_t size) {
-  tile_array = malloc(sizeof(TileArray));
-  tile_array->tiles = malloc(size * sizeof(Tile*));
-  tile_array->used = 0;
-  tile_array->size = size;
+// pages of recently opened tiles, keyed by tile hash
+static TilePage *s_tile_pages[TILE_PAGE_CACHE_SIZE];
+static uint32_t s_tile_page_tick = 0;
+
+//! Drops expanded tile pages, they are decoded again from the button table when next needed
+//! @param keep_latest Keep the most recently used page, which the action window may be showing
+static void data_tile_pages_trim(bool keep_latest) {
+  uint8_t latest = 0;
+  for(uint8_t i=1; i < TILE_PAGE_CACHE_SIZE; i++) {
+    if (s_tile_pages[i] && (!s_tile_pages[latest] || s_tile_pages[i]->last_used > s_tile_pages[latest]->last_used)) { latest = i; }
+  }
+  for(uint8_t i=0; i < TILE_PAGE_CACHE_SIZE; i++) {
+    if (!s_tile_pages[i] || (keep_latest && i == latest)) { continue; }
+    free(s_tile_pages[i]);
+    s_tile_pages[i] = NULL;
+  }
+}
+
+// free is O(1) as tile_array, its tiles and their strings all live in a single allocation
+void data_tile_array_free() {
+  data_tile_pages_trim(false);
+  if (!tile_array) { return; }
+  free(tile_array);
+  tile_array = NULL;
+}
+
+//! @param index Absolute index of a tile
+//! @return NULL if the tile is outside the window of tiles held by the watch
+Tile *data_tile_array_get_tile(uint16_t index) {
+  if (!tile_array || index < tile_array->first || index - tile_array->first >= tile_array->used) { return NULL; }
+  return &tile_array->tiles[index - tile_array->first];
+}
+
+//! Incremental FNV-1a hash
+//! @param hash HASH_SEED or the result of a previous call
+//! @param data Bytes to hash
+//! @param size Number of bytes in data
+uint32_t data_hash(uint32_t hash, uint8_t *data, int size) {
+  for(int i=0; i < size; i++) {
+    hash ^= data[i];
+    hash *= HASH_PRIME;
+  }
+  return hash;
+}
+
+//! Allocates tile_array, its tiles, string pool and button table as one block
+//! @param buttons_stored_size Size of the button table as stored, which may be compressed
+static bool data_tile_array_alloc(uint8_t used, uint16_t pool_size, uint16_t buttons_stored_size) {
+  size_t bytes = sizeof(TileArray) + used * sizeof(Tile) + pool_size + buttons_stored_size;
+  tile_array = (TileArray*) malloc(bytes);
+  if (!tile_array) { return false; }
+  tile_array->tiles = (Tile*) &tile_array[1];
+  tile_array->strings = (char*) &tile_array->tiles[used];
+  tile_array->buttons = &tile_array->strings[pool_size];
+  tile_array->buttons_size = buttons_stored_size;
+  tile_array->buttons_stored_size = buttons_stored_size;
+  tile_array->buttons_flags = 0;
+  tile_array->bytes = bytes;
+  tile_array->used = used;
+  tile_array->total = used;
+  tile_array->first = 0;
+  tile_array->hash = 0;
   tile_array->default_idx = 0;
   tile_array->open_default = false;
+  return true;
+}
+
+// string table of a TILE_FORMAT_TABLE blob, see data_tile_table_read
+typedef struct {
+  uint8_t flags;
+  uint16_t size;
+  uint16_t stored_size;
+  int offset;
+} TileTable;
+
+//! Reads the header of a string table and skips over the table
+//! @return false if the table runs past the end of data
+static bool data_tile_table_read(TileTable *table, uint8_t *data, int data_size, int *ptr) {
+  if (*ptr + 5 > data_size) { return false; }
+  table->flags = data[(*ptr)++];
+  table->size = data[*ptr] | data[*ptr + 1] << 8;
+  table->stored_size = data[*ptr + 2] | data[*ptr + 3] << 8;
+  *ptr += 4;
+  table->offset = *ptr;
+  *ptr += table->stored_size;
+  return *ptr <= data_size && ((table->flags & TILE_TABLE_COMPRESSED) || table->stored_size == table->size);
+}
+
+//! Expands a string table straight into the string pool, so compression costs no extra memory.
+//! A token below 0x80 is followed by token + 1 literal bytes, any other token copies (token & 0x7f) + 3 bytes
+//! from a little endian uint16 distance back in the output, see compressTable() in index.js
+//! @return false if the table is malformed
+static bool data_tile_table_expand(TileTable *table, uint8_t *data, char *pool) {
+  uint8_t *in = &data[table->offset];
+  if (!(table->flags & TILE_TABLE_COMPRESSED)) {
+    memmove(pool, in, table->size);
+  } else {
+    uint16_t in_ptr = 0, out_ptr = 0;
+    while (in_ptr < table->stored_size) {
+      uint8_t token = in[in_ptr++];
+      if (token < 0x80) {
+        uint16_t count = token + 1;
+        if (in_ptr + count > table->stored_size || out_ptr + count > table->size) { return false; }
+        memcpy(&pool[out_ptr], &in[in_ptr], count);
+        in_ptr += count;
+        out_ptr += count;
+      } else {
+        if (in_ptr + 2 > table->stored_size) { return false; }
+        uint16_t count = (token & 0x7f) + 3;
+        uint16_t distance = in[in_ptr] | in[in_ptr + 1] << 8;
+        in_ptr += 2;
+        if (distance == 0 || distance > out_ptr || out_ptr + count > table->size) { return false; }
+        // copies may overlap the bytes they produce, so go a byte at a time
+        for(uint16_t i=0; i < count; i++, out_ptr++) {
+          pool[out_ptr] = pool[out_ptr - distance];
+        }
+      }
+    }
+    if (out_ptr != table->size) { return false; }
+  }
+  // offsets are clamped to the table, so its last string must be terminated
+  if (table->size) { pool[table->size - 1] = '\0'; }
+  return true;
+}
+
+//! Expands the button table of tile_array
+//! @return The expanded strings, a buffer to release with data_tile_buttons_close for a compressed table.
+//! NULL if there isn't enough memory
+static char *data_tile_buttons_open() {
+  if (!(tile_array->buttons_flags & TILE_TABLE_COMPRESSED)) { return tile_array->buttons; }
+  char *buttons = (char*) malloc(tile_array->buttons_size);
+  if (!buttons) { return NULL; }
+  TileTable table = {.flags = tile_array->buttons_flags, .size = tile_array->buttons_size,
+                     .stored_size = tile_array->buttons_stored_size, .offset = 0};
+  if (!data_tile_table_expand(&table, (uint8_t*) tile_array->buttons, buttons)) {
+    free(buttons);
+    return NULL;
+  }
+  return buttons;
+}
+
+static void data_tile_buttons_close(char *buttons) {
+  if (buttons != tile_array->buttons) { free(buttons); }
+}
+
+//! @param index Index of a string within a tile, its texts then its icon keys
+//! @return true for the title and title icon, which live in the string pool as the menu needs them
+static bool data_tile_is_menu_string(uint8_t index) {
+  return index % TILE_STRING_COUNT == TITLE;
+}
+
+static uint16_t data_tile_get_offset(Tile *tile, uint8_t index) {
+  return (index < TILE_STRING_COUNT) ? tile->texts[index] : tile->icon_key[index - TILE_STRING_COUNT];
 }
 
-static void data_tile_array_add_tile(Tile *tile) {
-  if (!tile_array) { 
-    free(tile);
-    return; 
+static void data_tile_set_offset(Tile *tile, uint8_t index, uint16_t offset) {
+  if (index < TILE_STRING_COUNT) {
+    tile->texts[index] = offset;
+  } else {
+    tile->icon_key[index - TILE_STRING_COUNT] = offset;
+  }
+}
+
+//! Finds the page of a tile, expanding its button strings out of the compressed button table if needed
+//! @return NULL if there isn't enough memory
+static TilePage *data_tile_page(Tile *tile) {
+  TilePage **slot = &s_tile_pages[0];
+  for(uint8_t i=0; i < TILE_PAGE_CACHE_SIZE; i++) {
+    TilePage *page = s_tile_pages[i];
+    if (page && page->hash == tile->hash) {
+      page->last_used = ++s_tile_page_tick;
+      return page;
+    }
+    if (*slot && (!page || page->last_used < (*slot)->last_used)) { slot = &s_tile_pages[i]; }
+  }
+  if (heap_bytes_free() < TILE_PAGE_MIN_FREE) { data_tile_pages_trim(true); }
+
+  char *buttons = data_tile_buttons_open();
+  if (!buttons) { return NULL; }
+  uint16_t strings_size = 0;
+  for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+    if (!data_tile_is_menu_string(j)) { strings_size += strlen(&buttons[data_tile_get_offset(tile, j)]) + 1; }
   }
-  if(tile_array->used >= MAX_TILES) {
+  TilePage *page = (TilePage*) malloc(sizeof(TilePage) + strings_size);
+  if (page) {
+    uint16_t ptr = 0;
+    for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+      page->offsets[j] = ptr;
+      if (data_tile_is_menu_string(j)) { continue; }
+      char *string = &buttons[data_tile_get_offset(tile, j)];
+      strcpy(&page->strings[ptr], string);
+      ptr += strlen(string) + 1;
+    }
+    page->hash = tile->hash;
+    page->last_used = ++s_tile_page_tick;
+    // the slot is empty or holds the least recently used page
+    if (*slot) { free(*slot); }
+    *slot = page;
     #if DEBUG > 1
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "Hit MAX_TILES(%d), skipping tile", MAX_TILES);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Expanded tile %08lx, %d bytes", tile->hash, (int) (sizeof(TilePage) + strings_size));
     #endif
-    free(tile);
+  }
+  data_tile_buttons_close(buttons);
+  return page;
+}
+
+//! Makes the button strings of a tile available, expanding them out of a compressed button table.
+//! Called as a tile is opened so its strings stay put while the action window shows them
+//! @return false if there isn't enough memory, the tile's buttons then read as empty strings
+bool data_tile_materialize(Tile *tile) {
+  if (!tile_array || !(tile_array->buttons_flags & TILE_TABLE_COMPRESSED)) { return true; }
+  return data_tile_page(tile) != NULL;
+}
+
+static char *data_tile_get_string(Tile *tile, uint8_t index) {
+  uint16_t offset = data_tile_get_offset(tile, index);
+  if (data_tile_is_menu_string(index)) { return &tile_array->strings[offset]; }
+  if (!(tile_array->buttons_flags & TILE_TABLE_COMPRESSED)) { return &tile_array->buttons[offset]; }
+  TilePage *page = data_tile_page(tile);
+  return (page) ? &page->strings[page->offsets[index]] : "";
+}
+
+char *data_tile_get_text(Tile *tile, uint8_t index) {
+  return data_tile_get_string(tile, index);
+}
+
+char *data_tile_get_icon_key(Tile *tile, uint8_t index) {
+  return data_tile_get_string(tile, TILE_STRING_COUNT + index);
+}
+
+// where data_tile_decode puts the strings of a tile
+typedef struct {
+  // menu and button string tables of a TILE_FORMAT_TABLE blob, both NULL for TILE_FORMAT_INLINE
+  TileTable *menu_table;
+  TileTable *button_table;
+  // expanded button strings, a TILE_FORMAT_TABLE button table sits at their start
+  char *buttons;
+  uint16_t pool_ptr;
+  uint16_t buttons_ptr;
+} TileDecoder;
+
+//! Skips over one tile in a tile blob, tiles are only decoded once every one of them has been measured
+//! @param decoder Tables of the blob, a TILE_FORMAT_TABLE tile holds offsets of either width
+//! @param pool_size Increased by the string pool bytes the tile needs beyond the menu table
+//! @param buttons_size Increased by the button table bytes the tile needs beyond the received button table
+//! @return false if the tile runs past the end of data or points into an empty table
+static bool data_tile_measure(uint8_t *data, int data_size, int *ptr, TileDecoder *decoder, uint32_t *pool_size,
+                              uint32_t *buttons_size) {
+  *ptr += TILE_PREFIX_SIZE;
+  for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+    if (decoder->menu_table) {
+      TileTable *table = data_tile_is_menu_string(j) ? decoder->menu_table : decoder->button_table;
+      if (table->size == 0) { return false; }
+      *ptr += (table->flags & TILE_TABLE_WIDE) ? 2 : 1;
+      continue;
+    }
+    if (*ptr >= data_size) { return false; }
+    uint8_t size = data[(*ptr)++];
+    *(data_tile_is_menu_string(j) ? pool_size : buttons_size) += MAX(size, 1);
+    *ptr += size;
+  }
+  return *ptr <= data_size;
+}
+
+//! Copies a length prefixed string from data into a string pool
+//! @return Offset of the copied string within the pool
+static uint16_t data_tile_copy_string(uint8_t *data, int *ptr, char *pool, uint16_t *pool_ptr) {
+  uint8_t size = data[(*ptr)++];
+  uint16_t offset = *pool_ptr;
+  memcpy(&pool[offset], &data[*ptr], size);
+  // an empty length still needs a terminator, and a malformed string must not run past its slot
+  pool[offset + MAX(size, 1) - 1] = '\0';
+  *pool_ptr += MAX(size, 1);
+  *ptr += size;
+  return offset;
+}
+
+//! Hashes a string the way TILE_FORMAT_INLINE sends it, its size including the terminator then its bytes
+static uint32_t data_tile_hash_string(uint32_t hash, char *string) {
+  uint8_t size = strlen(string) + 1;
+  hash = data_hash(hash, &size, 1);
+  return data_hash(hash, (uint8_t*) string, size);
+}
+
+//! Decodes one tile from a tile blob into tile_array. The tile is hashed as TILE_FORMAT_INLINE would send it,
+//! so hashes don't depend on the format
+//! @param decoder Where the strings go, TILE_FORMAT_TABLE tables must already be expanded
+static void data_tile_decode(Tile *tile, uint8_t *data, int *ptr, TileDecoder *decoder) {
+  int tile_start = *ptr;
+  tile->color = PBL_IF_COLOR_ELSE((GColor) data[*ptr], GColorBlack); (*ptr)++;
+  tile->highlight = PBL_IF_COLOR_ELSE((GColor) data[*ptr], GColorWhite); (*ptr)++;
+  tile->coalesce = data[(*ptr)++];
+  if (!decoder->menu_table) {
+    for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+      data_tile_set_offset(tile, j, (data_tile_is_menu_string(j)) ?
+          data_tile_copy_string(data, ptr, tile_array->strings, &decoder->pool_ptr) :
+          data_tile_copy_string(data, ptr, decoder->buttons, &decoder->buttons_ptr));
+    }
+    tile->hash = data_hash(HASH_SEED, &data[tile_start], *ptr - tile_start);
     return;
   }
 
-  if (tile_array->size < MAX_TILES && tile_array->used == tile_array->size) {
-    #if DEBUG > 1
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "Resizing tile_array from %d to %d", tile_array->size, tile_array->size * 2);
-    #endif
-    tile_array->size = MIN(MAX_TILES, tile_array->size *2);
-    tile_array->tiles = realloc(tile_array->tiles, tile_array->size * sizeof(Tile*));
+  uint32_t hash = data_hash(HASH_SEED, &data[tile_start], TILE_PREFIX_SIZE);
+  for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+    bool menu_string = data_tile_is_menu_string(j);
+    TileTable *table = (menu_string) ? decoder->menu_table : decoder->button_table;
+    uint16_t offset = data[(*ptr)++];
+    if (table->flags & TILE_TABLE_WIDE) { offset |= data[(*ptr)++] << 8; }
+    offset = MIN(offset, table->size - 1);
+    data_tile_set_offset(tile, j, offset);
+    hash = data_tile_hash_string(hash, (menu_string) ? &tile_array->strings[offset] : &decoder->buttons[offset]);
   }
-  
-  tile_array->tiles[tile_array->used++] = tile;
+  tile->hash = hash;
 }
 
-void data_tile_array_free() {
-  if (!tile_array) { return; }
+//! Copies a string out of another string pool
+//! @return Offset of the copied string within pool
+static uint16_t data_tile_copy_pooled_string(char *string, char *pool, uint16_t *pool_ptr) {
+  uint16_t size = strlen(string) + 1;
+  uint16_t offset = *pool_ptr;
+  memcpy(&pool[offset], string, size);
+  *pool_ptr += size;
+  return offset;
+}
+
+//! Copies a tile and its strings out of another TileArray into tile_array
+//! @param source_buttons Expanded button strings of source
+static void data_tile_copy(Tile *tile, TileArray *source, char *source_buttons, Tile *source_tile, TileDecoder *decoder) {
+  *tile = *source_tile;
+  for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+    uint16_t offset = data_tile_get_offset(source_tile, j);
+    data_tile_set_offset(tile, j, (data_tile_is_menu_string(j)) ?
+        data_tile_copy_pooled_string(&source->strings[offset], tile_array->strings, &decoder->pool_ptr) :
+        data_tile_copy_pooled_string(&source_buttons[offset], decoder->buttons, &decoder->buttons_ptr));
+  }
+}
+
+//! Adds the string pool and button table bytes a tile of tile_array takes to pool_size and buttons_size
+//! @param buttons Expanded button strings of tile_array
+static void data_tile_pool_size(Tile *tile, char *buttons, uint32_t *pool_size, uint32_t *buttons_size) {
+  for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+    uint16_t offset = data_tile_get_offset(tile, j);
+    if (data_tile_is_menu_string(j)) {
+      *pool_size += strlen(&tile_array->strings[offset]) + 1;
+    } else {
+      *buttons_size += strlen(&buttons[offset]) + 1;
+    }
+  }
+}
+
+//! The config hash covers the tile blob header and every tile hash, mirrored by configHash() in index.js
+static void data_tile_array_rehash() {
+  uint8_t header[] = {tile_array->total, tile_array->total >> 8, tile_array->first, tile_array->first >> 8,
+                      tile_array->used, tile_array->default_idx, tile_array->default_idx >> 8, tile_array->open_default};
+  uint32_t hash = data_hash(HASH_SEED, header, sizeof(header));
+  for(uint8_t i=0; i < tile_array->used; i++) {
+    uint32_t tile_hash = tile_array->tiles[i].hash;
+    uint8_t tile_hash_bytes[] = {tile_hash, tile_hash >> 8, tile_hash >> 16, tile_hash >> 24};
+    hash = data_hash(hash, tile_hash_bytes, sizeof(tile_hash_bytes));
+  }
+  tile_array->hash = hash;
+}
+
+// windows hold pointers into the old tile_array, point them at the new one once it is in place
+static void data_tile_array_refresh_windows() {
+  if (tile_array) {
+    menu_window_push();
+  } else {
+    menu_window_pop();
+  }
+  action_window_refresh_tile();
+}
+
+//! Reads the header of a tile blob, the count of tiles sent is capped at MAX_TILES
+//! @return false if data is too short
+static bool data_tile_read_header(TileHeader *header, uint8_t *data, int data_size, int *ptr) {
+  if (*ptr + TILE_HEADER_SIZE > data_size) { return false; }
+  header->format = data[(*ptr)++];
+  header->total = data[*ptr] | data[*ptr + 1] << 8;
+  header->first = data[*ptr + 2] | data[*ptr + 3] << 8;
+  header->count = data[*ptr + 4];
+  header->default_idx = data[*ptr + 5] | data[*ptr + 6] << 8;
+  header->open_default = data[*ptr + 7];
+  *ptr += 8;
+  return true;
+}
+
+//! Sets the window and header fields of a freshly allocated tile_array
+static void data_tile_array_set_header(TileHeader *header) {
+  tile_array->first = header->first;
+  tile_array->total = MAX(header->total, header->first + tile_array->used);
+  tile_array->default_idx = (tile_array->total) ? MIN(header->default_idx, tile_array->total - 1) : 0;
+  tile_array->open_default = header->open_default;
+}
+
+//! Writes the hash of every tile into out as little endian uint32's
+//! @return Number of bytes written, at most MAX_TILES * 4
+uint16_t data_tile_array_get_hashes(uint8_t *out) {
+  if (!tile_array) { return 0; }
+  // out holds MAX_TILES hashes
+  uint8_t used = MIN(tile_array->used, MAX_TILES);
+  for(uint8_t i=0; i < used; i++) {
+    uint32_t tile_hash = tile_array->tiles[i].hash;
+    out[i * 4] = tile_hash;
+    out[i * 4 + 1] = tile_hash >> 8;
+    out[i * 4 + 2] = tile_hash >> 16;
+    out[i * 4 + 3] = tile_hash >> 24;
+  }
+  return used * 4;
+}
+
+//! Copies the widest window of tile_array around default_idx that fits max_size bytes into a new image, for
+//! windows too large to cache whole. The image's button table is stored expanded
+//! @param max_size Largest image to return
+//! @return A malloc'd image which the caller must free, its size in bytes is its TileArray.bytes. NULL if
+//! default_idx is outside the window, not even its own tile fits or there isn't enough memory
+TileArray *data_tile_array_window_image(uint32_t max_size) {
+  if (!tile_array || tile_array->default_idx < tile_array->first ||
+      tile_array->default_idx >= tile_array->first + tile_array->used) { return NULL; }
+  char *source_buttons = data_tile_buttons_open();
+  if (!source_buttons) { return NULL; }
+
+  // strings are length prefixed by a byte, so a tile never needs more than 16 bits of either
+  uint16_t pool_sizes[MAX_TILES], buttons_sizes[MAX_TILES];
   for(uint8_t i=0; i < tile_array->used; i++) {
-    for(uint8_t j=0; j < ARRAY_LENGTH((*tile_array->tiles[i]).texts); j++) {
-      if ((*tile_array->tiles[i]).texts[j]) { free((*tile_array->tiles[i]).texts[j]); }
-      if ((*tile_array->tiles[i]).icon_key[j]) { free((*tile_array->tiles[i]).icon_key[j]); }
+    uint32_t tile_pool_size = 0, tile_buttons_size = 0;
+    data_tile_pool_size(&tile_array->tiles[i], source_buttons, &tile_pool_size, &tile_buttons_size);
+    pool_sizes[i] = tile_pool_size;
+    buttons_sizes[i] = tile_buttons_size;
+  }
+  // shrink the window from the full one until it fits, keeping default_idx as central as the window allows
+  uint8_t center = tile_array->default_idx - tile_array->first;
+  uint8_t used = tile_array->used, start = 0;
+  uint32_t pool_size = 0, buttons_size = 0;
+  for(; used > 0; used--) {
+    start = (center > used / 2) ? center - used / 2 : 0;
+    start = MIN(start, tile_array->used - used);
+    pool_size = buttons_size = 0;
+    for(uint8_t i=start; i < start + used; i++) {
+      pool_size += pool_sizes[i];
+      buttons_size += buttons_sizes[i];
     }
-    free(tile_array->tiles[i]);
+    if (sizeof(TileArray) + used * sizeof(Tile) + pool_size + buttons_size <= max_size) { break; }
   }
-  free(tile_array->tiles);
-  free(tile_array);
+  if (used == 0) {
+    data_tile_buttons_close(source_buttons);
+    return NULL;
+  }
+
+  TileArray *source = tile_array;
   tile_array = NULL;
+  if (!data_tile_array_alloc(used, pool_size, buttons_size)) {
+    tile_array = source;
+    data_tile_buttons_close(source_buttons);
+    return NULL;
+  }
+  TileHeader header = {.total = source->total, .first = source->first + start, .default_idx = source->default_idx,
+                       .open_default = source->open_default};
+  data_tile_array_set_header(&header);
+  TileDecoder decoder = {.buttons = tile_array->buttons};
+  for(uint8_t i=0; i < used; i++) {
+    data_tile_copy(&tile_array->tiles[i], source, source_buttons, &source->tiles[start + i], &decoder);
+  }
+  data_tile_array_rehash();
+
+  TileArray *image = tile_array;
+  tile_array = source;
+  data_tile_buttons_close(source_buttons);
+  #if DEBUG > 1
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Cut %d of %d tiles from %d into %d bytes", used, source->used, image->first, (int) image->bytes);
+  #endif
+  return image;
 }
 
-void data_tile_array_pack_tiles(uint8_t *data, int data_size){
-    data_tile_array_free();
-    data_tile_array_init(4);
+//! Checks every tile of an image read back from persistent storage points into its own string pool and button
+//! table, and that both end in a terminator, so a corrupt or partly written image can't be read out of bounds
+//! @param pool_size Bytes between the tiles and the button table
+static bool data_tile_array_image_valid(TileArray *image, uint32_t pool_size) {
+  char *strings = (char*) &((Tile*) &image[1])[image->used];
+  char *buttons = &strings[pool_size];
+  bool compressed = image->buttons_flags & TILE_TABLE_COMPRESSED;
+  if ((image->buttons_flags & ~TILE_TABLE_COMPRESSED) || (!compressed && image->buttons_size != image->buttons_stored_size)) {
+    return false;
+  }
+  if (image->used == 0) { return true; }
+  // a compressed table is terminated as it is expanded, see data_tile_table_expand
+  if (pool_size == 0 || strings[pool_size - 1] != '\0' || image->buttons_size == 0 ||
+      (!compressed && buttons[image->buttons_size - 1] != '\0')) {
+    return false;
+  }
+  Tile *tiles = (Tile*) &image[1];
+  for(uint8_t i=0; i < image->used; i++) {
+    for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+      uint16_t offset = data_tile_get_offset(&tiles[i], j);
+      if (offset >= (data_tile_is_menu_string(j) ? pool_size : image->buttons_size)) { return false; }
+    }
+  }
+  return true;
+}
+
+//! Adopts a tile_array image previously read back from persistent storage
+//! @param data Image as written by storage_tile_cache_write, ownership passes to tile_array
+//! @param data_size Size of data in bytes
+bool data_tile_array_load(uint8_t *data, int data_size) {
+  TileArray *image = (TileArray*) data;
+  // the image may be corrupt, or hold a wider window than MAX_TILES allows here
+  if (data_size < (int) sizeof(TileArray) || image->bytes != (uint32_t) data_size ||
+      sizeof(TileArray) + image->used * sizeof(Tile) + image->buttons_stored_size > (uint32_t) data_size ||
+      image->used > MAX_TILES || image->first + image->used > image->total || image->default_idx >= image->total ||
+      !data_tile_array_image_valid(image, data_size - sizeof(TileArray) - image->used * sizeof(Tile) - image->buttons_stored_size)) {
+    free(data);
+    return false;
+  }
+  data_tile_array_free();
+  tile_array = image;
+  tile_array->tiles = (Tile*) &tile_array[1];
+  tile_array->strings = (char*) &tile_array->tiles[tile_array->used];
+  // the button table ends the block
+  tile_array->buttons = (char*) data + data_size - tile_array->buttons_stored_size;
+  data_tile_array_refresh_windows();
+  return true;
+}
+
+//! Reads the format byte and, for TILE_FORMAT_TABLE, the menu and button string tables of a tile blob
+//! @return false if the format is unknown or a table runs past the end of data
+static bool data_tile_read_tables(uint8_t format, uint8_t *data, int data_size, int *ptr, TileDecoder *decoder,
+                                  TileTable *menu_table, TileTable *button_table) {
+  memset(decoder, 0, sizeof(TileDecoder));
+  if (format == TILE_FORMAT_INLINE) { return true; }
+  if (format != TILE_FORMAT_TABLE) { return false; }
+  decoder->menu_table = menu_table;
+  decoder->button_table = button_table;
+  return data_tile_table_read(menu_table, data, data_size, ptr) && data_tile_table_read(button_table, data, data_size, ptr);
+}
 
-    Tile *tile;
+//! Replaces tile_array with a full tile blob from pebblekit
+//! Layout: format, total tile count (uint16 LE), absolute index of the first tile sent (uint16 LE), count of
+//! tiles sent, default_idx (uint16 LE), open_default, the menu and button string tables for TILE_FORMAT_TABLE,
+//! the tiles, then trailing icon keys to download ahead of time. The current tiles are only replaced once the
+//! new window has been decoded, so a malformed blob or a failed allocation leaves them in place
+//! @return false if the blob could not be decoded and tile_array is unchanged
+bool data_tile_array_pack_tiles(uint8_t *data, int data_size){
     int ptr = 0;
-    uint8_t tile_count = data[ptr++];
-    tile_array->default_idx = data[ptr++];
-    tile_array->open_default = data[ptr++];
-    uint8_t i = 0;
-    while (i < tile_count) {
-      tile = (Tile*) malloc(sizeof(Tile));
-      uint8_t text_size = 0;
-      uint8_t key_size = 0;
-      tile->color = PBL_IF_COLOR_ELSE((GColor) data[ptr], GColorBlack); ptr++;
-      tile->highlight = PBL_IF_COLOR_ELSE((GColor) data[ptr], GColorWhite); ptr++;
-      
-      for(uint8_t i=0; i < ARRAY_LENGTH(tile->texts); i++) {
-        text_size = data[ptr++];
-        tile->texts[i] = (char*) malloc(text_size * sizeof(char));
-        strncpy(tile->texts[i], (char*) &data[ptr], text_size);
-        ptr += text_size;
+    TileHeader header;
+    TileDecoder decoder;
+    TileTable menu_table, button_table;
+    if (!data_tile_read_header(&header, data, data_size, &ptr) ||
+        !data_tile_read_tables(header.format, data, data_size, &ptr, &decoder, &menu_table, &button_table)) {
+      #if DEBUG > 0
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Unsupported tile blob, format %d", data[0]);
+      #endif
+      return false;
+    }
+    int tiles_start = ptr;
+    uint8_t tile_count = header.count;
+
+    // first pass sizes the string pool and button table so the whole window can be allocated at once
+    uint8_t used = MIN(tile_count, MAX_TILES);
+    uint32_t pool_size = (decoder.menu_table) ? menu_table.size : 0;
+    uint32_t buttons_size = (decoder.menu_table) ? button_table.stored_size : 0;
+    bool valid = true;
+    for(uint8_t i=0; i < tile_count && valid; i++) {
+      uint32_t tile_pool_size = 0, tile_buttons_size = 0;
+      valid = data_tile_measure(data, data_size, &ptr, &decoder, &tile_pool_size, &tile_buttons_size);
+      if (i < used) {
+        pool_size += tile_pool_size;
+        buttons_size += tile_buttons_size;
       }
+    }
+    int tiles_end = ptr;
+    // string offsets are 16 bit, a truncated blob or one too large to address is dropped whole
+    if (!valid || pool_size > UINT16_MAX || buttons_size > UINT16_MAX) {
+      #if DEBUG > 0
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Malformed tile blob of %d bytes", data_size);
+      #endif
+      return false;
+    }
+
+    #if DEBUG > 1
+    if (used < tile_count) {
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Hit MAX_TILES(%d), skipping %d tiles", MAX_TILES, tile_count - used);
+    }
+    #endif
+
+    TileArray *source = tile_array;
+    tile_array = NULL;
+    if (!data_tile_array_alloc(used, pool_size, buttons_size)) {
+      tile_array = source;
+      return false;
+    }
+    data_tile_array_set_header(&header);
 
-      for(uint8_t i=0; i < ARRAY_LENGTH(tile->icon_key); i++) {
-        key_size = data[ptr++];
-        tile->icon_key[i] = (char*) malloc(key_size * sizeof(char));
-        strncpy(tile->icon_key[i], (char*) &data[ptr], key_size);
-        ptr += key_size;
+    decoder.buttons = tile_array->buttons;
+    if (decoder.menu_table) {
+      // the button table is kept as received, a compressed one is only expanded here to hash the tiles
+      tile_array->buttons_flags = button_table.flags & TILE_TABLE_COMPRESSED;
+      tile_array->buttons_size = button_table.size;
+      if (tile_array->buttons_flags) {
+        memcpy(tile_array->buttons, &data[button_table.offset], button_table.stored_size);
       }
-      data_tile_array_add_tile(tile); 
-      i++;
+      decoder.pool_ptr = menu_table.size;
+      if ((!tile_array->buttons_flags && !data_tile_table_expand(&button_table, data, tile_array->buttons)) ||
+          !data_tile_table_expand(&menu_table, data, tile_array->strings) || !(decoder.buttons = data_tile_buttons_open())) {
+        data_tile_array_free();
+        tile_array = source;
+        return false;
+      }
+    }
+    ptr = tiles_start;
+    for(uint8_t i=0; i < used; i++) {
+      data_tile_decode(&tile_array->tiles[i], data, &ptr, &decoder);
     }
+    data_tile_buttons_close(decoder.buttons);
+    data_tile_array_rehash();
+
+    TileArray *packed = tile_array;
+    tile_array = source;
+    data_tile_array_free();
+    tile_array = packed;
+
+    // trailing icon keys are a download hint only
+    ptr = tiles_end;
     while (ptr < data_size) {
       uint8_t str_size = data[ptr++];
-      char *tmp_str = (char*) malloc(str_size * sizeof(char));
-      strncpy(tmp_str, (char*) &data[ptr], str_size);
-      data_icon_array_search(tmp_str);
-      free(tmp_str);
+      if (ptr + str_size > data_size) { break; }
+      char key[ICON_KEY_SIZE];
+      strncpy(key, (char*) &data[ptr], MIN(str_size, ICON_KEY_SIZE - 1));
+      key[MIN(str_size, ICON_KEY_SIZE - 1)] = '\0';
+      data_icon_array_search(key, ICON_PRIORITY_PREFETCH);
       ptr += str_size;
     }
 
-    menu_window_push();
+    data_tile_array_refresh_windows();
 
     #if DEBUG > 1 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Completed tile assignment");
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Completed tile assignment, %d tiles from %d of %d in %d bytes", tile_array->used, tile_array->first, tile_array->total, (int) tile_array->bytes);
     #endif
+    return true;
+  }
+
+//! Applies a delta blob from pebblekit on top of the current tile_array. The patched button table is
+//! always stored expanded, the next full transfer compresses it again
+//! Delta layout: the header of a full tile blob, the first index of the window the delta is based on
+//! (uint16 LE), config hash (uint32 LE), change_count, the menu and button string tables for TILE_FORMAT_TABLE,
+//! then change_count * (tile index within the new window, tile). Tiles that aren't sent are copied from the
+//! same absolute index of the current window, so a window that has moved only needs its new tiles
+//! @return false if there was nothing to patch or the result does not match pebblekit's config hash, tile_array is
+//! then unchanged
+bool data_tile_array_patch_tiles(uint8_t *data, int data_size) {
+  if (!tile_array) { return false; }
+  int ptr = 0;
+  TileHeader header;
+  if (!data_tile_read_header(&header, data, data_size, &ptr) || ptr + 7 > data_size) { return false; }
+  uint8_t used = MIN(header.count, MAX_TILES);
+  uint16_t base = data[ptr] | data[ptr + 1] << 8;
+  ptr += 2;
+  uint32_t expected_hash = data[ptr] | data[ptr + 1] << 8 | data[ptr + 2] << 16 | (uint32_t) data[ptr + 3] << 24;
+  ptr += 4;
+  uint8_t change_count = data[ptr++];
+  change_count = MIN(change_count, MAX_TILES);
+  TileDecoder decoder;
+  TileTable menu_table, button_table;
+  // the delta was made against another window than the one we hold
+  if (base != tile_array->first ||
+      !data_tile_read_tables(header.format, data, data_size, &ptr, &decoder, &menu_table, &button_table)) {
+    return false;
+  }
+
+  // unchanged tiles are copied out of the current button strings, which may need expanding first
+  char *source_buttons = data_tile_buttons_open();
+  if (!source_buttons) { return false; }
+
+  // map each tile to its replacement in data, or TILE_NONE to keep the current tile
+  uint8_t changes[MAX_TILES];
+  int change_offsets[MAX_TILES];
+  memset(changes, TILE_NONE, sizeof(changes));
+  uint32_t pool_size = (decoder.menu_table) ? menu_table.size : 0;
+  uint32_t buttons_size = (decoder.menu_table) ? button_table.size : 0;
+  for(uint8_t i=0; i < change_count; i++) {
+    uint32_t tile_pool_size = 0, tile_buttons_size = 0;
+    uint8_t index = (ptr < data_size) ? data[ptr] : 0;
+    change_offsets[i] = ++ptr;
+    // a truncated delta is dropped whole, a full transfer replaces it
+    if (!data_tile_measure(data, data_size, &ptr, &decoder, &tile_pool_size, &tile_buttons_size)) {
+      data_tile_buttons_close(source_buttons);
+      return false;
+    }
+    if (index < used) { 
+      changes[index] = i;
+      pool_size += tile_pool_size;
+      buttons_size += tile_buttons_size;
+    }
+  }
+  for(uint8_t i=0; i < used; i++) {
+    if (changes[i] != TILE_NONE) { continue; }
+    // a tile that was neither kept nor sent means we are out of sync
+    Tile *source_tile = data_tile_array_get_tile(header.first + i);
+    if (!source_tile) {
+      data_tile_buttons_close(source_buttons);
+      return false;
+    }
+    data_tile_pool_size(source_tile, source_buttons, &pool_size, &buttons_size);
+  }
+  if (pool_size > UINT16_MAX || buttons_size > UINT16_MAX) {
+    data_tile_buttons_close(source_buttons);
+    return false;
+  }
+
+  TileArray *source = tile_array;
+  tile_array = NULL;
+  if (!data_tile_array_alloc(used, pool_size, buttons_size)) {
+    tile_array = source;
+    data_tile_buttons_close(source_buttons);
+    return false;
+  }
+  data_tile_array_set_header(&header);
+  decoder.buttons = tile_array->buttons;
+  if (decoder.menu_table) {
+    decoder.pool_ptr = menu_table.size;
+    decoder.buttons_ptr = button_table.size;
+    if (!data_tile_table_expand(&menu_table, data, tile_array->strings) ||
+        !data_tile_table_expand(&button_table, data, tile_array->buttons)) {
+      data_tile_array_free();
+      tile_array = source;
+      data_tile_buttons_close(source_buttons);
+      return false;
+    }
+  }
 
+  for(uint8_t i=0; i < used; i++) {
+    if (changes[i] != TILE_NONE) {
+      ptr = change_offsets[changes[i]];
+      data_tile_decode(&tile_array->tiles[i], data, &ptr, &decoder);
+    } else {
+      data_tile_copy(&tile_array->tiles[i], source, source_buttons, &source->tiles[header.first + i - source->first], &decoder);
+    }
   }
+  data_tile_array_rehash();
+
+  TileArray *patched = tile_array;
+  tile_array = source;
+  data_tile_buttons_close(source_buttons);
+  // tiles that don't match pebblekit's are never shown, the old window stays until the full transfer replaces it
+  if (patched->hash != expected_hash) {
+    #if DEBUG > 0
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Patched hash mismatch %08lx != %08lx", patched->hash, expected_hash);
+    #endif
+    tile_array = patched;
+    data_tile_array_free();
+    tile_array = source;
+    return false;
+  }
+  data_tile_array_free();
+  tile_array = patched;
+
+  #if DEBUG > 1 
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Patched %d of %d tiles, %d bytes", change_count, tile_array->used, (int) tile_array->bytes);
+  #endif
+
+  data_tile_array_refresh_windows();
+  return true;
+}
   
 void data_icon_array_init(uint8_t size) {
-  icon_array = malloc(sizeof(IconArray));
-  icon_array->ptr = 0;
+  // icons live directly after the IconArray in the same allocation
+  icon_array = malloc(sizeof(IconArray) + size * sizeof(Icon));
+  icon_array->icons = (Icon*) &icon_array[1];
   icon_array->size = size;
-  
-  icon_array->icons = malloc(size * sizeof(Icon*));
-  for(uint8_t i=0; i < size; i++) {
-    icon_array->icons[i] = malloc(sizeof(Icon));
-    (*icon_array->icons[i]).icon = NULL;
-    (*icon_array->icons[i]).key = NULL;
-  }
+  icon_array->tick = 0;
+  icon_array->hits = 0;
+  icon_array->misses = 0;
+  icon_array->evictions = 0;
+  memset(icon_array->buckets, ICON_NONE, sizeof(icon_array->buckets));
+  memset(icon_array->icons, 0, size * sizeof(Icon));
   default_icon = gbitmap_create_with_resource(RESOURCE_ID_ICON_DEFAULT);
 }
 
 void data_icon_array_free() {
   if (!icon_array) { return; }
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Icon cache hits: %lu, misses: %lu, evictions: %lu", icon_array->hits, icon_array->misses, icon_array->evictions);
+  #endif
   for(uint8_t i=0; i < icon_array->size; i++) {
-      gbitmap_destroy((*icon_array->icons[i]).icon);
-      free((*icon_array->icons[i]).key);
-      free(icon_array->icons[i]);
+    if (icon_array->icons[i].icon) { gbitmap_destroy(icon_array->icons[i].icon); }
   }
-  free(icon_array->icons);
   free(icon_array);
+  icon_array = NULL;
   gbitmap_destroy(default_icon);
 }
 
-void data_icon_array_add_icon(uint8_t *data) {
-  if (!icon_array) { return; }
-  int ptr = 0;
-  uint8_t index = data[ptr++];
-  Icon *icon = icon_array->icons[index];
+static uint8_t data_icon_array_find(char *key, uint32_t hash) {
+  uint8_t index = icon_array->buckets[hash % ICON_BUCKETS];
+  while (index != ICON_NONE) {
+    Icon *icon = &icon_array->icons[index];
+    if (icon->hash == hash && strncmp(icon->key, key, ICON_KEY_SIZE - 1) == 0) { return index; }
+    index = icon->next;
+  }
+  return ICON_NONE;
+}
+
+static void data_icon_array_unlink(uint8_t index) {
+  Icon *icon = &icon_array->icons[index];
+  uint8_t *link = &icon_array->buckets[icon->hash % ICON_BUCKETS];
+  while (*link != ICON_NONE) {
+    if (*link == index) {
+      *link = icon->next;
+      break;
+    }
+    link = &icon_array->icons[*link].next;
+  }
+  icon->next = ICON_NONE;
+}
+
+//! Picks the slot to reuse for a new key: an empty slot, else the least recently used icon that is
+//! not on screen and not waiting on a download. Pinned icons are never reused, their bitmaps may be on screen
+//! @param priority One of ICON_PRIORITY_*, anything above a prefetch may take over the oldest unpinned download
+//! @return The slot, or ICON_NONE if every slot is pinned or waiting on pebblekit
+static uint8_t data_icon_array_victim(uint8_t priority) {
+  uint8_t victim = ICON_NONE;
+  uint8_t download = ICON_NONE;
+  for(uint8_t i=0; i < icon_array->size; i++) {
+    Icon *icon = &icon_array->icons[i];
+    if (icon->key[0] == '\0') { return i; }
+    if (icon->pinned) { continue; }
+    if (icon->pending) {
+      if (download == ICON_NONE || icon->last_used < icon_array->icons[download].last_used) { download = i; }
+    } else if (victim == ICON_NONE || icon->last_used < icon_array->icons[victim].last_used) {
+      victim = i;
+    }
+  }
+  if (victim != ICON_NONE || priority == ICON_PRIORITY_PREFETCH) { return victim; }
+  // downloads have no bitmap yet, give up the oldest one for an icon that is about to be drawn
+  if (download != ICON_NONE) { comm_icon_cancel(icon_array->icons[download].key, download); }
+  return download;
+}
+
+//! Creates a bitmap straight from pixels pebblekit has already converted to the platform's native layout
+//! @param data GBitmapFormat, width, height, palette size, the palette as GColor8 and the rows packed to whole bytes
+//! @param size Size of data in bytes
+static GBitmap *data_icon_create_native(uint8_t *data, uint16_t size) {
+  if (size < 4) { return NULL; }
+  GBitmapFormat format = (GBitmapFormat) data[0];
+  uint8_t width = data[1];
+  uint8_t height = data[2];
+  uint8_t palette_size = data[3];
+  uint8_t bits;
+  switch(format) {
+    case GBitmapFormat1Bit: bits = 1; break;
+    case GBitmapFormat8Bit: bits = 8; break;
+    case GBitmapFormat1BitPalette: bits = 1; break;
+    case GBitmapFormat2BitPalette: bits = 2; break;
+    case GBitmapFormat4BitPalette: bits = 4; break;
+    default: return NULL;
+  }
+  bool palettized = (format != GBitmapFormat1Bit && format != GBitmapFormat8Bit);
+  uint16_t row_size = (width * bits + 7) / 8;
+  uint16_t ptr = 4;
+  if (palette_size > (palettized ? (1 << bits) : 0) || ptr + palette_size + row_size * height > size) { return NULL; }
+
+  GBitmap *bitmap;
+  if (palettized) {
+    // the bitmap takes ownership of the palette, unused entries stay clear
+    GColor *palette = (GColor*) calloc(1 << bits, sizeof(GColor));
+    if (!palette) { return NULL; }
+    memcpy(palette, &data[ptr], palette_size);
+    bitmap = gbitmap_create_blank_with_palette(GSize(width, height), format, palette, true);
+    if (!bitmap) { free(palette); }
+  } else {
+    bitmap = gbitmap_create_blank(GSize(width, height), format);
+  }
+  if (!bitmap) { return NULL; }
+  ptr += palette_size;
+
+  // rows on the watch may be padded, so copy them one at a time
+  uint8_t *pixels = gbitmap_get_data(bitmap);
+  uint16_t bytes_per_row = gbitmap_get_bytes_per_row(bitmap);
+  for(uint8_t row=0; row < height; row++) {
+    memcpy(&pixels[row * bytes_per_row], &data[ptr + row * row_size], row_size);
+  }
+  return bitmap;
+}
+
+//! Creates a bitmap from icon bytes
+//! @param data An ICON_FORMAT_* byte followed by a resource id, a PNG or native pixels
+//! @param size Size of data in bytes
+static GBitmap *data_icon_create_bitmap(uint8_t *data, uint16_t size) {
+  if (size < 2) { return NULL; }
+  switch(data[0]) {
+    case ICON_FORMAT_RESOURCE:
+      return gbitmap_create_with_resource(data[1]);
+    case ICON_FORMAT_PNG:
+      // decoding needs room for the compressed and decoded image at once, expanded tile pages can make way
+      if (heap_bytes_free() < size) { data_tile_pages_trim(true); }
+      if (heap_bytes_free() < size) { return NULL; }
+      return gbitmap_create_from_png_data(&data[1], size - 1);
+    case ICON_FORMAT_NATIVE:
+      return data_icon_create_native(&data[1], size - 1);
+  }
+  return NULL;
+}
+
+//! Decodes an icon sent by pebblekit into its slot
+//! @param index Slot the icon was requested for
+//! @param key Key the icon was requested for, the icon is dropped if its slot has since been reused
+//! @param data Icon bytes, see data_icon_create_bitmap
+//! @param size Size of data in bytes. A size of 0 means pebblekit has no such icon
+//! @return true if a bitmap was created
+static bool data_icon_array_set_icon(uint8_t index, char *key, uint8_t *data, uint16_t size) {
+  if (index >= icon_array->size) { return false; }
+  Icon *icon = &icon_array->icons[index];
+  if (strncmp(icon->key, key, ICON_KEY_SIZE) != 0) { return false; }
+  icon->pending = false;
 
-  uint16_t icon_size = *(uint16_t*) &data[ptr];
-  if (heap_bytes_free() < icon_size) { return; }
-  ptr +=2;
   if (icon->icon) { gbitmap_destroy(icon->icon); }
-  icon->icon = NULL;
-  icon->icon = (icon_size == 1) ? gbitmap_create_with_resource(data[ptr]) : gbitmap_create_from_png_data(&data[ptr], icon_size);
+  icon->icon = data_icon_create_bitmap(data, size);
+  if (!icon->icon) { return false; }
+  storage_icon_write(icon->key, data, size);
 
   #if DEBUG > 1
-  APP_LOG(APP_LOG_LEVEL_DEBUG, "Created icon at index %d", index);
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Created icon %s at index %d", icon->key, index);
   #endif
-  menu_window_refresh_icons();
-  action_window_refresh_icons();
+  return true;
 }
 
-GBitmap *data_icon_array_search(char* key){
-  if (!icon_array || strlen(key) == 0) { return NULL; }
-  for (int i=0; i < icon_array->size; i++) {
-    Icon *icon = icon_array->icons[i];
-    if (icon->key && strcmp(key, icon->key) == 0) {
-      return icon->icon;
+//! Inserts every icon of a batch transfer, redrawing once at the end
+//! @param data Icon count, then per icon its slot index, key length, key, 16 bit size and the icon bytes
+//! @param data_size Size of data in bytes
+void data_icon_array_add_icons(uint8_t *data, int data_size) {
+  if (!icon_array || data_size < 1) { return; }
+  int ptr = 0;
+  uint8_t count = data[ptr++];
+  bool created = false;
+  for(uint8_t i=0; i < count && ptr + 2 <= data_size; i++) {
+    uint8_t index = data[ptr++];
+    uint8_t key_size = data[ptr++];
+    if (ptr + key_size + 2 > data_size) { break; }
+    char key[ICON_KEY_SIZE];
+    strncpy(key, (char*) &data[ptr], MIN(key_size, ICON_KEY_SIZE - 1));
+    key[MIN(key_size, ICON_KEY_SIZE - 1)] = '\0';
+    ptr += key_size;
+    uint16_t icon_size = data[ptr] | (data[ptr + 1] << 8);
+    ptr += 2;
+    if (ptr + icon_size > data_size) { break; }
+    created |= data_icon_array_set_icon(index, key, &data[ptr], icon_size);
+    ptr += icon_size;
+  }
+  if (created) {
+    menu_window_refresh_icons();
+    action_window_refresh_icons();
+  }
+}
+
+//! @return true if the icon in slot index is still waiting on pebblekit for key
+bool data_icon_array_is_pending(char *key, uint8_t index) {
+  if (!icon_array || index >= icon_array->size) { return false; }
+  Icon *icon = &icon_array->icons[index];
+  return icon->pending && strncmp(icon->key, key, ICON_KEY_SIZE) == 0;
+}
+
+//! Finds an icon, claiming a slot and loading or requesting it on a miss
+//! @return The icon, or NULL if no slot could be freed without destroying a pinned bitmap
+static Icon *data_icon_array_lookup(char *key, uint8_t priority) {
+  uint32_t hash = data_hash(HASH_SEED, (uint8_t*) key, strlen(key));
+  uint8_t index = data_icon_array_find(key, hash);
+  if (index != ICON_NONE) {
+    Icon *icon = &icon_array->icons[index];
+    icon_array->hits++;
+    icon->last_used = ++icon_array->tick;
+    // merged with the queued request, or requeued if an earlier request timed out
+    if (icon->pending) { comm_icon_request(icon->key, index, priority); }
+    return icon;
+  }
+
+  icon_array->misses++;
+  index = data_icon_array_victim(priority);
+  if (index == ICON_NONE) { return NULL; }
+  Icon *icon = &icon_array->icons[index];
+  if (icon->key[0] != '\0') {
+    icon_array->evictions++;
+    data_icon_array_unlink(index);
+  }
+  if (icon->icon) { gbitmap_destroy(icon->icon); }
+  icon->icon = NULL;
+
+  strncpy(icon->key, key, ICON_KEY_SIZE - 1);
+  icon->key[ICON_KEY_SIZE - 1] = '\0';
+  icon->hash = hash;
+  icon->last_used = ++icon_array->tick;
+  icon->pinned = false;
+  icon->pending = true;
+  icon->next = icon_array->buckets[hash % ICON_BUCKETS];
+  icon_array->buckets[hash % ICON_BUCKETS] = index;
+
+  // icons seen on a previous launch are decoded from persistent storage without asking pebblekit
+  uint16_t stored_size;
+  uint8_t *stored = storage_icon_read(icon->key, &stored_size);
+  if (stored) {
+    icon->icon = data_icon_create_bitmap(stored, stored_size);
+    free(stored);
+    if (icon->icon) {
+      icon->pending = false;
+      perf_icon_stored();
+      #if DEBUG > 1
+      APP_LOG(APP_LOG_LEVEL_DEBUG, "Loaded icon %s from storage", icon->key);
+      #endif
+      return icon;
     }
   }
   #if DEBUG > 1
   APP_LOG(APP_LOG_LEVEL_DEBUG, "Couldnt find %s locally, asking JS environment", key);
   #endif 
-  Icon *icon = icon_array->icons[icon_array->ptr];
+  comm_icon_request(icon->key, index, priority);
+  return icon;
+}
 
-  free(icon->key);
-  icon->key = NULL;
-  icon->key = (char*) malloc(strlen(key) + 1 * sizeof(char));
-  strcpy(icon->key, key);
+GBitmap *data_icon_array_search(char* key, uint8_t priority){
+  if (!icon_array || strlen(key) == 0) { return NULL; }
+  Icon *icon = data_icon_array_lookup(key, priority);
+  return (icon && icon->icon) ? icon->icon : default_icon;
+}
 
-  if (icon->icon) { gbitmap_destroy(icon->icon); }
-  icon->icon = NULL;
-  icon->icon = gbitmap_create_with_resource(RESOURCE_ID_ICON_DEFAULT);
+//! Marks an icon as on screen so it is not evicted while visible, requesting it if needed
+void data_icon_array_pin(char *key, uint8_t priority) {
+  if (!icon_array || strlen(key) == 0) { return; }
+  Icon *icon = data_icon_array_lookup(key, priority);
+  if (icon) { icon->pinned = true; }
+}
 
-  comm_icon_request(key, icon_array->ptr);
-  icon_array->ptr = (icon_array->ptr + 1) % icon_array->size;
-  return icon->icon;
-}
\ No newline at end of file
+//! Gives up on an icon that is still waiting on pebblekit, freeing its slot and dropping its queued request.
+//! Icons that are pinned or already loaded are kept
+void data_icon_array_cancel(char *key) {
+  if (!icon_array || strlen(key) == 0) { return; }
+  uint8_t index = data_icon_array_find(key, data_hash(HASH_SEED, (uint8_t*) key, strlen(key)));
+  if (index == ICON_NONE) { return; }
+  Icon *icon = &icon_array->icons[index];
+  if (!icon->pending || icon->pinned) { return; }
+  comm_icon_cancel(icon->key, index);
+  data_icon_array_unlink(index);
+  icon->key[0] = '\0';
+  icon->pending = false;
+}
+
+//! Clears all pins, called by whichever window takes the screen before pinning its own icons
+void data_icon_array_unpin_all() {
+  if (!icon_array) { return; }
+  for(uint8_t i=0; i < icon_array->size; i++) {
+    icon_array->icons[i].pinned = false;
+  }
+}
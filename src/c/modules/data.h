@@ -18,30 +18,99 @@
 #define MID_HOLD 3
 #define DOWN 4
 #define DOWN_HOLD 5
+#define TITLE 6
+// the up, mid and down buttons and their holds, whose strings come before the title
+#define BUTTON_COUNT TITLE
+#define TILE_STRING_COUNT 7
+#define TILE_NONE 0xff
+// color, highlight and coalesce flags start every encoded tile
+#define TILE_PREFIX_SIZE 3
 
+// first byte of a tile blob, see encodeTiles() in index.js
+#define TILE_FORMAT_INLINE 1
+#define TILE_FORMAT_TABLE 2
+#define TILE_TABLE_COMPRESSED 0x01
+#define TILE_TABLE_WIDE 0x02
+
+// FNV-1a, mirrored by fnv1a() in index.js
+#define HASH_SEED 2166136261u
+#define HASH_PRIME 16777619u
+
+// texts and icon_key are offsets into TileArray.strings for the TITLE strings the menu shows, and into the
+// expanded button table for the others, use data_tile_get_text / data_tile_get_icon_key
 typedef struct __attribute__((__packed__)) {
   GColor color;
   GColor highlight;
-  char* texts[7];
-  char* icon_key[7];
+  // bit n is set if presses of button n are coalesced, see action_window_press()
+  uint8_t coalesce;
+  uint16_t texts[TILE_STRING_COUNT];
+  uint16_t icon_key[TILE_STRING_COUNT];
+  uint32_t hash;
 } Tile;
 
+// tiles, strings and buttons point into the same allocation as the TileArray itself, the block is
+// relocatable so it can be written to persistent storage as is. The button table ends the block and is kept
+// as received, a compressed table is only expanded tile by tile as tiles are opened
 typedef struct __attribute__((__packed__)) {
-  Tile **tiles;
+  Tile *tiles;
+  char *strings;
+  char *buttons;
+  uint16_t buttons_size;
+  uint16_t buttons_stored_size;
+  uint8_t buttons_flags;
+  uint32_t hash;
+  uint32_t bytes;
+  // tiles holds a window of used tiles out of total, starting at absolute index first
+  uint16_t total;
+  uint16_t first;
   uint8_t used;
-  uint8_t size;
-  uint8_t default_idx;
+  uint16_t default_idx;
   bool open_default;
 } TileArray;
 
+// header of tile and delta blobs, see packTiles() in index.js
+typedef struct {
+  uint8_t format;
+  uint16_t total;
+  uint16_t first;
+  uint8_t count;
+  uint16_t default_idx;
+  bool open_default;
+} TileHeader;
+#define TILE_HEADER_SIZE 9
+
+// button strings of one tile expanded out of a compressed button table, offsets into strings are indexed
+// like the strings of a tile, texts then icon keys, see data_tile_materialize
+typedef struct __attribute__((__packed__)) {
+  uint32_t hash;
+  uint32_t last_used;
+  uint16_t offsets[TILE_STRING_COUNT * 2];
+  char strings[];
+} TilePage;
+
+// icon keys are 8 hex digits, see icons in index.js
+#define ICON_KEY_SIZE 9
+#define ICON_BUCKETS 16
+#define ICON_NONE 0xff
+
 typedef struct __attribute__((__packed__)) {
-  char *key;
+  char key[ICON_KEY_SIZE];
+  uint32_t hash;
+  uint32_t last_used;
   GBitmap *icon;
+  uint8_t next;
+  bool pinned;
+  bool pending;
 } Icon;
 
+// icons are chained per hash bucket through Icon.next and evicted least recently used first
 typedef struct __attribute__((__packed__)) {
-  Icon **icons;
-  uint8_t ptr;
+  Icon *icons;
+  uint8_t buckets[ICON_BUCKETS];
+  uint32_t tick;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
   uint8_t size;
 } IconArray;
 
@@ -49,9 +118,22 @@ TileArray *tile_array;
 IconArray *icon_array;
 GBitmap *default_icon;
 
-void data_icon_array_add_icon(uint8_t *data);
-GBitmap *data_icon_array_search(char* key);
+void data_icon_array_add_icons(uint8_t *data, int data_size);
+bool data_icon_array_is_pending(char *key, uint8_t index);
+GBitmap *data_icon_array_search(char* key, uint8_t priority);
 void data_icon_array_free();
+void data_icon_array_pin(char *key, uint8_t priority);
+void data_icon_array_cancel(char *key);
+void data_icon_array_unpin_all();
 void data_icon_array_init(uint8_t size);
-void data_tile_array_pack_tiles(uint8_t *data, int data_size);
-void data_tile_array_free();
\ No newline at end of file
+bool data_tile_array_pack_tiles(uint8_t *data, int data_size);
+bool data_tile_array_patch_tiles(uint8_t *data, int data_size);
+bool data_tile_array_load(uint8_t *data, int data_size);
+TileArray *data_tile_array_window_image(uint32_t max_size);
+uint16_t data_tile_array_get_hashes(uint8_t *out);
+void data_tile_array_free();
+Tile *data_tile_array_get_tile(uint16_t index);
+bool data_tile_materialize(Tile *tile);
+char *data_tile_get_text(Tile *tile, uint8_t index);
+char *data_tile_get_icon_key(Tile *tile, uint8_t index);
+uint32_t data_hash(uint32_t hash, uint8_t *data, int size);
\ No newline at end of file
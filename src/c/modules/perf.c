@@ -0,0 +1,74 @@
+#include <pebble.h>
+#include "c/modules/perf.h"
+#include "c/modules/data.h"
+#include "c/stateful.h"
+
+static PerfCounters s_counters;
+static uint32_t s_start_ms;
+
+void perf_init() {
+  memset(&s_counters, 0, sizeof(PerfCounters));
+  s_start_ms = perf_now_ms();
+  s_counters.heap_low = heap_bytes_free();
+}
+
+//! Milliseconds on the wall clock, only differences between two readings mean anything
+uint32_t perf_now_ms() {
+  time_t seconds;
+  uint16_t ms = time_ms(&seconds, NULL);
+  return (uint32_t) seconds * 1000 + ms;
+}
+
+//! Counts a received chunk
+//! @param transfer_type One of TRANSFER_TYPE_*, types other than tiles, deltas and icon batches are ignored
+//! @param size Bytes in the chunk
+void perf_transfer_chunk(uint8_t transfer_type, uint16_t size) {
+  uint8_t type;
+  switch(transfer_type) {
+    case TRANSFER_TYPE_TILE: type = PERF_TRANSFER_TILE; break;
+    case TRANSFER_TYPE_TILE_DELTA: type = PERF_TRANSFER_TILE_DELTA; break;
+    case TRANSFER_TYPE_ICON_BATCH: type = PERF_TRANSFER_ICON_BATCH; break;
+    default: return;
+  }
+  s_counters.transfer_bytes[type] += size;
+  s_counters.transfer_chunks[type]++;
+}
+
+//! Called whenever a tile is drawn, only the first since launch is recorded
+void perf_first_tile() {
+  if (s_counters.first_tile_ms) { return; }
+  s_counters.first_tile_ms = MAX(perf_now_ms() - s_start_ms, 1u);
+  #if DEBUG > 0
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "First tile drawn after %d ms", (int) s_counters.first_tile_ms);
+  #endif
+}
+
+void perf_icon_stored() {
+  s_counters.icon_stored++;
+}
+
+//! Lowers the heap low-water mark if less is free now, called after anything that allocates a lot
+void perf_heap_sample() {
+  s_counters.heap_low = MIN(s_counters.heap_low, (uint32_t) heap_bytes_free());
+}
+
+//! Records how long a window took to load
+//! @param window One of PERF_WINDOW_*
+//! @param start_ms perf_now_ms() as the window started loading
+void perf_window_loaded(uint8_t window, uint32_t start_ms) {
+  uint16_t elapsed = MIN(perf_now_ms() - start_ms, UINT16_MAX);
+  s_counters.window_load_ms[window] = elapsed;
+  s_counters.window_load_max_ms[window] = MAX(s_counters.window_load_max_ms[window], elapsed);
+  perf_heap_sample();
+}
+
+//! Current counters, icon and outbox counters are gathered from their modules as this is called
+PerfCounters *perf_counters() {
+  if (icon_array) {
+    s_counters.icon_hits = icon_array->hits;
+    s_counters.icon_misses = icon_array->misses;
+  }
+  s_counters.outbox = *comm_outbox_stats();
+  perf_heap_sample();
+  return &s_counters;
+}
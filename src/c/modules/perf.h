@@ -0,0 +1,41 @@
+#pragma once
+#include <pebble.h>
+#include "c/modules/comm.h"
+
+// transfers counted separately, see perf_transfer_chunk
+#define PERF_TRANSFER_TILE 0
+#define PERF_TRANSFER_TILE_DELTA 1
+#define PERF_TRANSFER_ICON_BATCH 2
+#define PERF_TRANSFER_TYPES 3
+
+// windows whose load time is recorded, see perf_window_loaded
+#define PERF_WINDOW_LOADING 0
+#define PERF_WINDOW_MENU 1
+#define PERF_WINDOW_ACTION 2
+#define PERF_WINDOWS 3
+
+// counters since launch, sent to pebblekit as is so the layout is mirrored by unpackPerf() in index.js
+typedef struct __attribute__((__packed__)) {
+  uint32_t transfer_bytes[PERF_TRANSFER_TYPES];
+  uint16_t transfer_chunks[PERF_TRANSFER_TYPES];
+  // from launch until the first tile was drawn
+  uint32_t first_tile_ms;
+  // icon_array lookups that found the icon, and of those that didn't how many were loaded from storage
+  uint32_t icon_hits;
+  uint32_t icon_misses;
+  uint16_t icon_stored;
+  OutboxStats outbox;
+  uint32_t heap_low;
+  // latest and slowest load of each window
+  uint16_t window_load_ms[PERF_WINDOWS];
+  uint16_t window_load_max_ms[PERF_WINDOWS];
+} PerfCounters;
+
+void perf_init();
+uint32_t perf_now_ms();
+void perf_transfer_chunk(uint8_t transfer_type, uint16_t size);
+void perf_first_tile();
+void perf_icon_stored();
+void perf_heap_sample();
+void perf_window_loaded(uint8_t window, uint32_t start_ms);
+PerfCounters *perf_counters();
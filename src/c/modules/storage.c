@@ -0,0 +1,232 @@
+#include <pebble.h>
+#include "c/modules/storage.h"
+#include "c/stateful.h"
+
+static IconStore s_icon_store;
+static bool s_icon_store_dirty = false;
+
+//! @return true if the cached tiles have this config hash, so writing them again would change nothing
+static bool storage_tile_cache_is_current(uint32_t hash) {
+  TileCacheHeader header;
+  if (persist_read_data(PERSIST_KEY_TILE_CACHE, &header, sizeof(TileCacheHeader)) != sizeof(TileCacheHeader)) { return false; }
+  return header.version == TILE_CACHE_VERSION && header.hash == hash;
+}
+
+//! Writes a tile_array image to persistent storage, split across TILE_CACHE_SLOTS keys.
+//! The header is written last so a partially written cache is never considered valid. Nothing is written if
+//! the cache already holds these tiles, flash wears with every write
+//! @param data tile_array image, see data_tile_array_load
+//! @param size Size of data in bytes
+//! @param hash Config hash of the tiles in data
+bool storage_tile_cache_write(uint8_t *data, uint32_t size, uint32_t hash) {
+  if (storage_tile_cache_is_current(hash)) { return true; }
+  storage_tile_cache_clear();
+  if (size > TILE_CACHE_MAX_SIZE) {
+    #if DEBUG > 0
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Tile data too large to cache (%d > %d), launches wait for pebblekit", (int) size, TILE_CACHE_MAX_SIZE);
+    #endif
+    return false;
+  }
+
+  for(uint32_t offset = 0; offset < size; offset += PERSIST_DATA_MAX_LENGTH) {
+    uint8_t slot = offset / PERSIST_DATA_MAX_LENGTH;
+    if (persist_write_data(PERSIST_KEY_TILE_CACHE_DATA + slot, &data[offset], MIN(PERSIST_DATA_MAX_LENGTH, size - offset)) < 0) {
+      return false;
+    }
+  }
+
+  TileCacheHeader header = {.version = TILE_CACHE_VERSION, .hash = hash, .size = size};
+  if (persist_write_data(PERSIST_KEY_TILE_CACHE, &header, sizeof(TileCacheHeader)) < 0) { return false; }
+
+  #if DEBUG > 1
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Cached %d bytes of tile data, hash: %08lx", (int) size, hash);
+  #endif
+  return true;
+}
+
+//! Reads a previously cached tile blob
+//! @param size Set to the size of the returned blob
+//! @return A malloc'd copy of the blob which the caller must free, or NULL if no valid cache exists
+uint8_t *storage_tile_cache_read(uint16_t *size) {
+  TileCacheHeader header;
+  if (persist_read_data(PERSIST_KEY_TILE_CACHE, &header, sizeof(TileCacheHeader)) != sizeof(TileCacheHeader)) { return NULL; }
+  if (header.version != TILE_CACHE_VERSION || header.size == 0 || header.size > TILE_CACHE_MAX_SIZE) { return NULL; }
+
+  uint8_t *data = (uint8_t*) malloc(header.size * sizeof(uint8_t));
+  if (!data) { return NULL; }
+
+  for(uint16_t offset = 0; offset < header.size; offset += PERSIST_DATA_MAX_LENGTH) {
+    uint8_t slot = offset / PERSIST_DATA_MAX_LENGTH;
+    int chunk_size = MIN(PERSIST_DATA_MAX_LENGTH, header.size - offset);
+    if (persist_read_data(PERSIST_KEY_TILE_CACHE_DATA + slot, &data[offset], chunk_size) != chunk_size) {
+      free(data);
+      return NULL;
+    }
+  }
+  *size = header.size;
+  return data;
+}
+
+void storage_tile_cache_clear() {
+  if (!persist_exists(PERSIST_KEY_TILE_CACHE)) { return; }
+  persist_delete(PERSIST_KEY_TILE_CACHE);
+  for(uint8_t slot = 0; slot < TILE_CACHE_SLOTS; slot++) {
+    persist_delete(PERSIST_KEY_TILE_CACHE_DATA + slot);
+  }
+}
+
+// writes the icon store directory back if it has changed
+static void storage_icon_flush() {
+  if (!s_icon_store_dirty) { return; }
+  persist_write_data(PERSIST_KEY_ICON_STORE, &s_icon_store, sizeof(IconStore));
+  s_icon_store_dirty = false;
+}
+
+static IconStoreEntry *storage_icon_find(char *key) {
+  for(uint8_t i=0; i < ICON_STORE_ENTRIES; i++) {
+    IconStoreEntry *entry = &s_icon_store.entries[i];
+    if (entry->size && strncmp(entry->key, key, ICON_STORE_KEY_SIZE) == 0) { return entry; }
+  }
+  return NULL;
+}
+
+static void storage_icon_evict(IconStoreEntry *entry) {
+  for(uint8_t i=0; i < ICON_STORE_MAX_SLOTS; i++) {
+    if (entry->slots[i] != ICON_STORE_NO_SLOT) { persist_delete(PERSIST_KEY_ICON_STORE_DATA + entry->slots[i]); }
+  }
+  memset(entry, 0, sizeof(IconStoreEntry));
+  memset(entry->slots, ICON_STORE_NO_SLOT, sizeof(entry->slots));
+}
+
+static bool storage_icon_slot_used(uint8_t slot) {
+  for(uint8_t i=0; i < ICON_STORE_ENTRIES; i++) {
+    IconStoreEntry *entry = &s_icon_store.entries[i];
+    for(uint8_t j=0; j < ICON_STORE_MAX_SLOTS; j++) {
+      if (entry->size && entry->slots[j] == slot) { return true; }
+    }
+  }
+  return false;
+}
+
+static uint8_t storage_icon_free_slots() {
+  uint8_t free_slots = 0;
+  for(uint8_t slot=0; slot < ICON_STORE_SLOTS; slot++) {
+    if (!storage_icon_slot_used(slot)) { free_slots++; }
+  }
+  return free_slots;
+}
+
+//! Evicts the least recently used icon
+//! @return false if the store is already empty
+static bool storage_icon_evict_oldest() {
+  IconStoreEntry *oldest = NULL;
+  for(uint8_t i=0; i < ICON_STORE_ENTRIES; i++) {
+    IconStoreEntry *entry = &s_icon_store.entries[i];
+    if (entry->size && (!oldest || entry->last_used < oldest->last_used)) { oldest = entry; }
+  }
+  if (!oldest) { return false; }
+  #if DEBUG > 1
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Evicting stored icon %.8s", oldest->key);
+  #endif
+  storage_icon_evict(oldest);
+  return true;
+}
+
+//! Persists the raw bytes of an icon under its key, evicting older icons to stay within budget
+//! @param key Icon key as used in index.js
+//! @param data Icon bytes as sent by pebblekit, see data_icon_create_bitmap
+//! @param size Size of data in bytes
+bool storage_icon_write(char *key, uint8_t *data, uint16_t size) {
+  if (size == 0 || strlen(key) == 0 || size > ICON_STORE_MAX_SLOTS * PERSIST_DATA_MAX_LENGTH) { return false; }
+  IconStoreEntry *entry = storage_icon_find(key);
+  if (entry) { storage_icon_evict(entry); }
+
+  uint8_t needed_slots = (size <= ICON_STORE_INLINE_SIZE) ? 0 : (size + PERSIST_DATA_MAX_LENGTH - 1) / PERSIST_DATA_MAX_LENGTH;
+  while (storage_icon_free_slots() < needed_slots) {
+    if (!storage_icon_evict_oldest()) { return false; }
+  }
+  while (!entry) {
+    for(uint8_t i=0; i < ICON_STORE_ENTRIES && !entry; i++) {
+      if (!s_icon_store.entries[i].size) { entry = &s_icon_store.entries[i]; }
+    }
+    if (!entry && !storage_icon_evict_oldest()) { return false; }
+  }
+
+  // size marks the entry and its slots as used, so set it before allocating slots
+  // keys fill the field without a terminator, shorter ones are padded with zeros
+  memset(entry->key, 0, ICON_STORE_KEY_SIZE);
+  memcpy(entry->key, key, MIN(strlen(key), ICON_STORE_KEY_SIZE));
+  entry->size = size;
+  memset(entry->slots, ICON_STORE_NO_SLOT, sizeof(entry->slots));
+  if (size <= ICON_STORE_INLINE_SIZE) {
+    memcpy(entry->inline_data, data, size);
+  } else {
+    uint8_t slot = 0;
+    for(uint8_t i=0; i < needed_slots; i++) {
+      while (storage_icon_slot_used(slot)) { slot++; }
+      uint16_t offset = i * PERSIST_DATA_MAX_LENGTH;
+      entry->slots[i] = slot;
+      if (persist_write_data(PERSIST_KEY_ICON_STORE_DATA + slot, &data[offset], MIN(PERSIST_DATA_MAX_LENGTH, size - offset)) < 0) {
+        storage_icon_evict(entry);
+        s_icon_store_dirty = true;
+        storage_icon_flush();
+        return false;
+      }
+    }
+  }
+  entry->last_used = ++s_icon_store.tick;
+  s_icon_store_dirty = true;
+  storage_icon_flush();
+
+  #if DEBUG > 1
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Stored icon %s, %d bytes", key, size);
+  #endif
+  return true;
+}
+
+//! Reads a stored icon
+//! @param key Icon key as used in index.js
+//! @param size Set to the size of the returned icon
+//! @return A malloc'd copy of the icon bytes which the caller must free, or NULL if the icon isn't stored
+uint8_t *storage_icon_read(char *key, uint16_t *size) {
+  IconStoreEntry *entry = storage_icon_find(key);
+  if (!entry) { return NULL; }
+
+  uint8_t *data = (uint8_t*) malloc(entry->size * sizeof(uint8_t));
+  if (!data) { return NULL; }
+  if (entry->size <= ICON_STORE_INLINE_SIZE) {
+    memcpy(data, entry->inline_data, entry->size);
+  } else {
+    for(uint8_t i=0; i * PERSIST_DATA_MAX_LENGTH < entry->size; i++) {
+      uint16_t offset = i * PERSIST_DATA_MAX_LENGTH;
+      int chunk_size = MIN(PERSIST_DATA_MAX_LENGTH, entry->size - offset);
+      if (persist_read_data(PERSIST_KEY_ICON_STORE_DATA + entry->slots[i], &data[offset], chunk_size) != chunk_size) {
+        free(data);
+        storage_icon_evict(entry);
+        s_icon_store_dirty = true;
+        return NULL;
+      }
+    }
+  }
+  // recency only matters relative to other stored icons, so it is flushed lazily
+  entry->last_used = ++s_icon_store.tick;
+  s_icon_store_dirty = true;
+  *size = entry->size;
+  return data;
+}
+
+void storage_init() {
+  if (persist_read_data(PERSIST_KEY_ICON_STORE, &s_icon_store, sizeof(IconStore)) != sizeof(IconStore) ||
+      s_icon_store.version != ICON_STORE_VERSION) {
+    memset(&s_icon_store, 0, sizeof(IconStore));
+    s_icon_store.version = ICON_STORE_VERSION;
+    for(uint8_t i=0; i < ICON_STORE_ENTRIES; i++) {
+      memset(s_icon_store.entries[i].slots, ICON_STORE_NO_SLOT, sizeof(s_icon_store.entries[i].slots));
+    }
+  }
+  s_icon_store_dirty = false;
+}
+
+void storage_deinit() {
+  storage_icon_flush();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <pebble.h>
+
+// persist keys, each key can hold at most PERSIST_DATA_MAX_LENGTH bytes and the app has ~4KB total
+#define PERSIST_KEY_COLOR 0
+#define PERSIST_KEY_TILE_CACHE 1
+#define PERSIST_KEY_TILE_CACHE_DATA 2
+#define PERSIST_KEY_ICON_STORE 9
+#define PERSIST_KEY_ICON_STORE_DATA 10
+
+// bump whenever the TileArray or Tile layout changes so stale caches are ignored
+#define TILE_CACHE_VERSION 4
+#define TILE_CACHE_SLOTS 7
+#define TILE_CACHE_MAX_SIZE (TILE_CACHE_SLOTS * PERSIST_DATA_MAX_LENGTH)
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t version;
+  uint32_t hash;
+  uint16_t size;
+} TileCacheHeader;
+
+// icons larger than ICON_STORE_MAX_SLOTS * PERSIST_DATA_MAX_LENGTH are only kept in memory
+#define ICON_STORE_VERSION 2
+#define ICON_STORE_SLOTS 6
+#define ICON_STORE_MAX_SLOTS 2
+#define ICON_STORE_ENTRIES 12
+#define ICON_STORE_KEY_SIZE 8
+#define ICON_STORE_NO_SLOT 0xff
+#define ICON_STORE_INLINE_SIZE 2
+
+// icons of up to ICON_STORE_INLINE_SIZE bytes, pebble resource ids, are kept inline without using a data slot
+typedef struct __attribute__((__packed__)) {
+  char key[ICON_STORE_KEY_SIZE];
+  uint16_t size;
+  uint8_t slots[ICON_STORE_MAX_SLOTS];
+  uint8_t inline_data[ICON_STORE_INLINE_SIZE];
+  uint32_t last_used;
+} IconStoreEntry;
+
+typedef struct __attribute__((__packed__)) {
+  uint8_t version;
+  uint32_t tick;
+  IconStoreEntry entries[ICON_STORE_ENTRIES];
+} IconStore;
+
+bool storage_tile_cache_write(uint8_t *data, uint32_t size, uint32_t hash);
+uint8_t *storage_tile_cache_read(uint16_t *size);
+void storage_tile_cache_clear();
+bool storage_icon_write(char *key, uint8_t *data, uint16_t size);
+uint8_t *storage_icon_read(char *key, uint16_t *size);
+void storage_init();
+void storage_deinit();
@@ -4,6 +4,8 @@
 #include "c/user_interface/menu_window.h"
 #include "c/modules/comm.h"
 #include "c/modules/data.h"
+#include "c/modules/storage.h"
+#include "c/modules/perf.h"
 #include "c/stateful.h"
 
 VibePattern short_vibe = { 
@@ -28,6 +30,8 @@ void pebblekit_connection_callback(bool connected) {
 
 static void init() {
   ubuntu18 = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_UBUNTU_BOLD_18));
+  perf_init();
+  storage_init();
   comm_init();
   connection_service_subscribe((ConnectionHandlers) {
     .pebblekit_connection_handler = pebblekit_connection_callback
@@ -39,6 +43,7 @@ static void deinit() {
   connection_service_unsubscribe();
   fonts_unload_custom_font(ubuntu18);
   comm_deinit();
+  storage_deinit();
 }
 
 int main() {
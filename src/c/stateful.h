@@ -7,10 +7,37 @@ GFont ubuntu18;
 #ifdef PBL_APLITE
 #define ICON_ARRAY_SIZE 4
 #endif
+// tiles held on the watch at once, the menu pages through longer configs, see comm_tile_page_request
+#ifdef PBL_PLATFORM_APLITE
+#define MAX_TILES 16
+#else
 #define MAX_TILES 64
+#endif
+#ifdef PBL_PLATFORM_APLITE
+#define ACTION_LAYOUT_CACHE_SIZE 4
+#else
+#define ACTION_LAYOUT_CACHE_SIZE 8
+#endif
+// opened tiles whose button strings are kept expanded, all but the latest are dropped when the heap runs low
+#define TILE_PAGE_CACHE_SIZE 3
+#define TILE_PAGE_MIN_FREE 2048
 
 
 #define RETRY_READY_TIMEOUT 5000
+// the first READY retry, retries double from here up to RETRY_READY_TIMEOUT
+#define HANDSHAKE_RETRY_TIMEOUT 250
+// a transfer that sees no chunks for this long is abandoned so queued requests are not blocked
+#define TRANSFER_TIMEOUT 10000
+#define OUTBOX_RETRY_TIMEOUT 100
+// presses of a coalescing button this close together are sent as one request
+#define PRESS_COALESCE_TIMEOUT 400
+// presses waiting for the outbox, and sends of one press before it is given up on
+#define PRESS_QUEUE_SIZE 4
+#define PRESS_MAX_ATTEMPTS 3
+// wait after a failed send before the outbox is used again
+#define OUTBOX_FAILED_TIMEOUT 500
+// heap left free beyond a transfer and the roughly equal amount decoding it takes, bigger transfers are refused
+#define TRANSFER_HEAP_RESERVE 2048
 
 #define SHORT_VIBE() vibes_enqueue_custom_pattern(short_vibe);
 #define LONG_VIBE() vibes_enqueue_custom_pattern(long_vibe);
@@ -18,6 +45,7 @@ inline char * BOOL(bool b) {
   return b ? "true" : "false";
 }
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
 VibePattern short_vibe; 
 VibePattern long_vibe; 
 
@@ -30,7 +58,45 @@ enum transferType {
   TRANSFER_TYPE_ACK = 5,
   TRANSFER_TYPE_READY = 6,
   TRANSFER_TYPE_NO_CLAY = 7,
-  TRANSFER_TYPE_REFRESH = 8
+  TRANSFER_TYPE_REFRESH = 8,
+  TRANSFER_TYPE_CACHE_VALID = 9,
+  TRANSFER_TYPE_TILE_DELTA = 10,
+  TRANSFER_TYPE_ICON_BATCH = 11,
+  TRANSFER_TYPE_STATE = 12,
+  TRANSFER_TYPE_PERF = 13,
+  TRANSFER_TYPE_REFUSED = 14
 };
 
+// first byte of every icon blob, pebblekit sends icons it can convert as native bitmaps so the watch skips PNG decoding
+enum iconFormat {
+  ICON_FORMAT_RESOURCE = 0,
+  ICON_FORMAT_PNG = 1,
+  ICON_FORMAT_NATIVE = 2
+};
+
+// icon requests are sent highest priority first
+enum iconPriority {
+  ICON_PRIORITY_PREFETCH = 0,
+  ICON_PRIORITY_MENU = 1,
+  ICON_PRIORITY_VISIBLE = 2
+};
+
+// action window colours, also sent by pebblekit as Color, see Color in index.js. The tile's own colours come back
+// with a short vibe, or silently for a button that has no label
+enum actionColor {
+  ACTION_COLOR_GOOD = 0,
+  ACTION_COLOR_BAD = 1,
+  ACTION_COLOR_ERROR = 2,
+  ACTION_COLOR_TILE = -1,
+  ACTION_COLOR_TILE_SILENT = -2
+};
+
+// sent to pebblekit with READY so it only uses what this build of the watch app understands
+#define PROTOCOL_VERSION 1
+#define CAPABILITY_TILE_TABLE 0x01
+#define CAPABILITY_TILE_COMPRESSION 0x02
+#define CAPABILITY_TRANSFER_WINDOW 0x04
+#define CAPABILITY_NATIVE_ICONS 0x08
+#define CAPABILITIES (CAPABILITY_TILE_TABLE | CAPABILITY_TILE_COMPRESSION | CAPABILITY_TRANSFER_WINDOW | CAPABILITY_NATIVE_ICONS)
+
 void pebblekit_connection_callback(bool connected);
\ No newline at end of file
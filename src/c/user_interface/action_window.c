@@ -4,6 +4,7 @@
 #include "c/user_interface/loading_window.h"
 #include "c/modules/data.h"
 #include "c/modules/comm.h"
+#include "c/modules/perf.h"
 #include "c/stateful.h"
 static Window *s_action_window;
 static ActionBarLayer *s_action_bar_layer;
@@ -11,24 +12,120 @@ static TextLayer *s_up_label_layer, *s_mid_label_layer, *s_down_label_layer;
 static GRect s_label_bounds;
 static uint8_t tap_toggle = 0;
 static Tile *tile;
-static uint8_t tile_index;
+static uint16_t tile_index;
+static uint32_t tile_hash;
+static ActionLayout s_layout_cache[ACTION_LAYOUT_CACHE_SIZE];
+static uint32_t s_layout_tick = 0;
+static ActionLayout *s_layout;
+// last state reported by pebblekit for each button of the tile, BUTTON_STATE_UNKNOWN until it answers
+static uint8_t s_button_states[BUTTON_COUNT];
+// presses of a coalescing button waiting for PRESS_COALESCE_TIMEOUT to pass without another
+static AppTimer *s_press_timer = NULL;
+static uint8_t s_press_button = 0;
+static uint8_t s_press_count = 0;
 
 void action_window_swap_buttons();
 
+// keeps the icons of the current button page from being evicted while they are on screen
+static void action_window_pin_icons() {
+    data_icon_array_unpin_all();
+    data_icon_array_pin(data_tile_get_icon_key(tile, UP + tap_toggle), ICON_PRIORITY_VISIBLE);
+    data_icon_array_pin(data_tile_get_icon_key(tile, MID + tap_toggle), ICON_PRIORITY_VISIBLE);
+    data_icon_array_pin(data_tile_get_icon_key(tile, DOWN + tap_toggle), ICON_PRIORITY_VISIBLE);
+}
+
+//! Measures the label frames of both button pages of a tile
+//! @param layout Receives the frames, indexed by page then by button
+//! @param bounds Bounds of the window's root layer
+static void action_window_layout_measure(ActionLayout *layout, GRect bounds) {
+    uint8_t pad = PBL_IF_RECT_ELSE(5, 30);
+    GRect text_bounds = GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h);
+    for(uint8_t page = 0; page < 2; page++) {
+        for(uint8_t button = 0; button < 3; button++) {
+            // the three labels split the window in thirds, the outer ones are padded towards the middle
+            GRect label_bounds = GRect(bounds.origin.x, bounds.origin.y + button * (bounds.size.h / 3), bounds.size.w, bounds.size.h / 3);
+            GSize text_size = graphics_text_layout_get_content_size(data_tile_get_text(tile, button * 2 + page), ubuntu18, text_bounds, GTextOverflowModeFill, GTextAlignmentRight);
+            text_size.h *= 1.332;
+            int16_t offset = (button == 0) ? pad : (button == 2) ? -pad : 0;
+            GEdgeInsets insets = {.top = offset + ((label_bounds.size.h - (text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3, .bottom = -offset};
+            layout->frames[page][button] = grect_inset(label_bounds, insets);
+        }
+    }
+}
+
+//! Looks up the label frames of a tile, measuring them only if the tile's texts have changed since it was last shown
+//! @param current_tile Tile to lay out, its hash covers its texts
+//! @param bounds Bounds of the window's root layer
+static ActionLayout *action_window_layout_get(Tile *current_tile, GRect bounds) {
+    ActionLayout *layout = NULL;
+    for(uint8_t i = 0; i < ACTION_LAYOUT_CACHE_SIZE; i++) {
+        ActionLayout *entry = &s_layout_cache[i];
+        if (entry->last_used && entry->hash == current_tile->hash) {
+            entry->last_used = ++s_layout_tick;
+            return entry;
+        }
+        // unused entries have last_used 0 so they are taken first
+        if (!layout || entry->last_used < layout->last_used) { layout = entry; }
+    }
+    action_window_layout_measure(layout, bounds);
+    layout->hash = current_tile->hash;
+    layout->last_used = ++s_layout_tick;
+    #if DEBUG > 1
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Measured layout of tile %08lx", current_tile->hash);
+    #endif
+    return layout;
+}
+
+// sends the presses waiting on s_press_timer as one request
+static void action_window_press_flush() {
+    if (s_press_timer) { app_timer_cancel(s_press_timer); }
+    s_press_timer = NULL;
+    if (s_press_count == 0) { return; }
+    #if DEBUG > 1
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Sending %d coalesced presses of button %d", s_press_count, s_press_button);
+    #endif
+    comm_xhr_request(NULL, tile_index, s_press_button, s_press_count);
+    s_press_count = 0;
+}
+
+static void action_window_press_timer_callback(void *data) {
+    s_press_timer = NULL;
+    action_window_press_flush();
+}
+
+//! Sends a button press to pebblekit. Presses of a button the tile marks as coalescing are held until
+//! PRESS_COALESCE_TIMEOUT passes without another and sent as a single request with their count
+//! @param button One of UP..DOWN_HOLD
+static void action_window_press(uint8_t button) {
+    if (!(tile->coalesce & (1 << button))) {
+        action_window_press_flush();
+        comm_xhr_request(NULL, tile_index, button, 1);
+        return;
+    }
+    if (s_press_count > 0 && (s_press_button != button || s_press_count == UINT8_MAX)) { action_window_press_flush(); }
+    s_press_button = button;
+    s_press_count++;
+    if (s_press_timer) {
+        app_timer_reschedule(s_press_timer, PRESS_COALESCE_TIMEOUT);
+    } else {
+        s_press_timer = app_timer_register(PRESS_COALESCE_TIMEOUT, action_window_press_timer_callback, NULL);
+    }
+}
+
 static void up_click_callback(ClickRecognizerRef recognizer, void *ctx) {
-    (strlen(tile->texts[tap_toggle + 0]) == 0) ? action_window_set_color(-2) : action_window_set_color(-1);
+    (strlen(data_tile_get_text(tile, tap_toggle + 0)) == 0) ? action_window_set_color(ACTION_COLOR_TILE_SILENT) : action_window_set_color(ACTION_COLOR_TILE);
     action_window_inset_highlight(BUTTON_ID_UP);
-    comm_xhr_request(ctx, tile_index, 0 + tap_toggle);
+    action_window_press(UP + tap_toggle);
 }
 static void mid_click_callback(ClickRecognizerRef recognizer, void *ctx) {
-    (strlen(tile->texts[tap_toggle + 2]) == 0) ? action_window_set_color(-2) : action_window_set_color(-1);
+    (strlen(data_tile_get_text(tile, tap_toggle + 2)) == 0) ? action_window_set_color(ACTION_COLOR_TILE_SILENT) : action_window_set_color(ACTION_COLOR_TILE);
     action_window_inset_highlight(BUTTON_ID_SELECT);
-    comm_xhr_request(ctx, tile_index, 2 + tap_toggle);
+    action_window_press(MID + tap_toggle);
 }
 static void down_click_callback(ClickRecognizerRef recognizer, void *ctx) {
-    (strlen(tile->texts[tap_toggle + 4]) == 0) ? action_window_set_color(-2) : action_window_set_color(-1);
+    (strlen(data_tile_get_text(tile, tap_toggle + 4)) == 0) ? action_window_set_color(ACTION_COLOR_TILE_SILENT) : action_window_set_color(ACTION_COLOR_TILE);
     action_window_inset_highlight(BUTTON_ID_DOWN);
-    comm_xhr_request(ctx, tile_index, 4 + tap_toggle);
+    action_window_press(DOWN + tap_toggle);
 }
 
 static void mid_hold_click_callback(ClickRecognizerRef recognizer, void *ctx) {
@@ -41,42 +138,48 @@ static void click_config_provider(void *ctx) {
     window_single_click_subscribe(BUTTON_ID_DOWN, down_click_callback);
 } 
 
-void action_window_swap_buttons() {
-    SHORT_VIBE();
-    action_window_inset_highlight(BUTTON_ID_BACK);
-    tap_toggle = !tap_toggle;
+// marks the labels of the current page by the state of their buttons, labels of unknown state stay white. Colour
+// platforms tint the label, black and white ones can only invert it, so they mark buttons that are on
+static void action_window_show_states() {
+    TextLayer *labels[] = {s_up_label_layer, s_mid_label_layer, s_down_label_layer};
+    for (uint8_t i = 0; i < ARRAY_LENGTH(labels); i++) {
+        GColor color = GColorWhite;
+        GColor background = GColorClear;
+        switch (s_button_states[i * 2 + tap_toggle]) {
+            case ACTION_COLOR_GOOD:
+                color = PBL_IF_COLOR_ELSE(GColorMintGreen, GColorBlack);
+                background = PBL_IF_COLOR_ELSE(GColorClear, GColorWhite);
+                break;
+            #ifdef PBL_COLOR
+            case ACTION_COLOR_BAD: color = GColorMelon; break;
+            case ACTION_COLOR_ERROR: color = GColorIcterine; break;
+            #endif
+        }
+        text_layer_set_text_color(labels[i], color);
+        text_layer_set_background_color(labels[i], background);
+    }
+}
 
-    GRect bounds = layer_get_bounds(window_get_root_layer(s_action_window));
-    GRect up_label_bounds = GRect(bounds.origin.x, bounds.origin.y, bounds.size.w, bounds.size.h / 3);
-    GRect mid_label_bounds = GRect(bounds.origin.x, bounds.origin.y + (up_label_bounds.origin.y + up_label_bounds.size.h),
-                                   bounds.size.w, bounds.size.h / 3);
-    GRect down_label_bounds = GRect(bounds.origin.x, bounds.origin.y + (mid_label_bounds.origin.y + mid_label_bounds.size.h),
-                                   bounds.size.w, bounds.size.h / 3);
-    GSize up_text_size = graphics_text_layout_get_content_size(tile->texts[0 + tap_toggle], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    up_text_size.h *= 1.332;
-    GSize mid_text_size = graphics_text_layout_get_content_size(tile->texts[2 + tap_toggle], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    mid_text_size.h *= 1.332;
-    GSize down_text_size = graphics_text_layout_get_content_size(tile->texts[4 + tap_toggle], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    down_text_size.h *= 1.332;
-    uint8_t pad = PBL_IF_RECT_ELSE(5, 30);
-    GEdgeInsets up_label_insets = {.top = pad  + ((up_label_bounds.size.h - (up_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3, .bottom = -pad};
-    GEdgeInsets mid_label_insets = {.top = ((mid_label_bounds.size.h - (mid_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3 };
-    GEdgeInsets down_label_insets = {.top = -pad + ((down_label_bounds.size.h - (down_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3, .bottom = pad};
-    layer_set_frame(text_layer_get_layer(s_up_label_layer), grect_inset(up_label_bounds, up_label_insets));
-    layer_set_frame(text_layer_get_layer(s_mid_label_layer), grect_inset(mid_label_bounds, mid_label_insets));
-    layer_set_frame(text_layer_get_layer(s_down_label_layer), grect_inset(down_label_bounds, down_label_insets));
-    text_layer_set_text(s_up_label_layer, tile->texts[tap_toggle]);
-    text_layer_set_text(s_mid_label_layer, tile->texts[2 + tap_toggle]);
-    text_layer_set_text(s_down_label_layer, tile->texts[4 + tap_toggle]);
+// lays out the labels and icons of the current button page
+static void action_window_show_page() {
+    // the previous page's icons lose their pins, so the action bar must stop pointing at them first
     action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_UP, default_icon);
-    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(tile->icon_key[tap_toggle]), true);
     action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_SELECT, default_icon);
-    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(tile->icon_key[2 + tap_toggle]), true);
     action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_DOWN, default_icon);
-    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(tile->icon_key[4 + tap_toggle]), true);
+    action_window_pin_icons();
+    layer_set_frame(text_layer_get_layer(s_up_label_layer), s_layout->frames[tap_toggle][0]);
+    layer_set_frame(text_layer_get_layer(s_mid_label_layer), s_layout->frames[tap_toggle][1]);
+    layer_set_frame(text_layer_get_layer(s_down_label_layer), s_layout->frames[tap_toggle][2]);
+    text_layer_set_text(s_up_label_layer, data_tile_get_text(tile, tap_toggle));
+    text_layer_set_text(s_mid_label_layer, data_tile_get_text(tile, 2 + tap_toggle));
+    text_layer_set_text(s_down_label_layer, data_tile_get_text(tile, 4 + tap_toggle));
+    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(data_tile_get_icon_key(tile, tap_toggle), ICON_PRIORITY_VISIBLE), true);
+    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(data_tile_get_icon_key(tile, 2 + tap_toggle), ICON_PRIORITY_VISIBLE), true);
+    action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(data_tile_get_icon_key(tile, 4 + tap_toggle), ICON_PRIORITY_VISIBLE), true);
     layer_mark_dirty(text_layer_get_layer(s_up_label_layer));
     layer_mark_dirty(text_layer_get_layer(s_mid_label_layer));
     layer_mark_dirty(text_layer_get_layer(s_down_label_layer));
+    action_window_show_states();
 
     #ifdef PBL_COLOR
         window_set_background_color(s_action_window, (!tap_toggle) ? tile->color :tile->highlight);
@@ -86,11 +189,33 @@ void action_window_swap_buttons() {
     #endif
 }
 
+void action_window_swap_buttons() {
+    SHORT_VIBE();
+    action_window_inset_highlight(BUTTON_ID_BACK);
+    tap_toggle = !tap_toggle;
+    action_window_show_page();
+}
+
+//! Points the window at its tile in a tile_array that has just replaced the previous one, the window is
+//! closed if its tile has changed or is no longer held
+void action_window_refresh_tile() {
+    if (!s_action_window) { return; }
+    Tile *current_tile = data_tile_array_get_tile(tile_index);
+    if (!current_tile || current_tile->hash != tile_hash) {
+        action_window_pop();
+        return;
+    }
+    tile = current_tile;
+    data_tile_materialize(tile);
+    // the labels still point at strings of the previous tile_array
+    action_window_show_page();
+}
+
 void action_window_refresh_icons() {
     if (window_stack_get_top_window() == s_action_window) {
-        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(tile->icon_key[tap_toggle]), true);
-        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(tile->icon_key[2 + tap_toggle]), true);
-        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(tile->icon_key[4 + tap_toggle]), true);
+        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(data_tile_get_icon_key(tile, tap_toggle), ICON_PRIORITY_VISIBLE), true);
+        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(data_tile_get_icon_key(tile, 2 + tap_toggle), ICON_PRIORITY_VISIBLE), true);
+        action_bar_layer_set_icon_animated(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(data_tile_get_icon_key(tile, 4 + tap_toggle), ICON_PRIORITY_VISIBLE), true);
         layer_mark_dirty(action_bar_layer_get_layer(s_action_bar_layer));
     }
 }
@@ -101,36 +226,16 @@ static void action_window_load(Window *window) {
     GRect bounds = layer_get_bounds(window_layer);
     s_action_bar_layer = action_bar_layer_create();
     tap_toggle = 0;
+    action_window_pin_icons();
 
-    // 5 pixel y pad on top
-   GRect up_label_bounds = GRect(bounds.origin.x, bounds.origin.y, bounds.size.w, bounds.size.h / 3);
-    GRect mid_label_bounds = GRect(bounds.origin.x, up_label_bounds.origin.y + up_label_bounds.size.h,
-                                   bounds.size.w, bounds.size.h / 3);
-    GRect down_label_bounds = GRect(bounds.origin.x, mid_label_bounds.origin.y + mid_label_bounds.size.h,
-                                   bounds.size.w, bounds.size.h / 3);
-    GSize up_text_size = graphics_text_layout_get_content_size(tile->texts[0], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    up_text_size.h *= 1.332;
-    GSize mid_text_size = graphics_text_layout_get_content_size(tile->texts[2], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    mid_text_size.h *= 1.332;
-    GSize down_text_size = graphics_text_layout_get_content_size(tile->texts[4], ubuntu18, GRect(bounds.origin.x, bounds.origin.y, bounds.size.w - (ACTION_BAR_WIDTH * 1.6), bounds.size.h), GTextOverflowModeFill, GTextAlignmentRight);
-    down_text_size.h *= 1.332;
-    uint8_t pad = PBL_IF_RECT_ELSE(5, 30);
-    GEdgeInsets up_label_insets = {.top = pad  + ((up_label_bounds.size.h - (up_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3, .bottom = -pad};
-    GEdgeInsets mid_label_insets = {.top = ((mid_label_bounds.size.h - (mid_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3 };
-    GEdgeInsets down_label_insets = {.top = -pad + ((down_label_bounds.size.h - (down_text_size.h)) /2), .left = ACTION_BAR_WIDTH * 0.3, .right = ACTION_BAR_WIDTH * 1.3, .bottom = pad};
-
-    
-    // GEdgeInsets up_label_insets = {.top = bounds.size.h * .131, .right = ACTION_BAR_WIDTH * 1.3 };
-    // GEdgeInsets mid_label_insets = {.top = bounds.size.h * .43, .right = ACTION_BAR_WIDTH * 1.3};
-    // // 5 pixel y pad on bottom
-    // GEdgeInsets down_label_insets = {.top = bounds.size.h * .728, .right = ACTION_BAR_WIDTH * 1.3};
-    s_up_label_layer = text_layer_create(grect_inset(up_label_bounds, up_label_insets));
-    s_mid_label_layer = text_layer_create(grect_inset(mid_label_bounds, mid_label_insets));
-    s_down_label_layer = text_layer_create(grect_inset(down_label_bounds, down_label_insets));
+    s_layout = action_window_layout_get(tile, bounds);
+    s_up_label_layer = text_layer_create(s_layout->frames[0][0]);
+    s_mid_label_layer = text_layer_create(s_layout->frames[0][1]);
+    s_down_label_layer = text_layer_create(s_layout->frames[0][2]);
     s_label_bounds = layer_get_frame(text_layer_get_layer(s_up_label_layer));
-    text_layer_set_text(s_up_label_layer, tile->texts[0]);
-    text_layer_set_text(s_mid_label_layer, tile->texts[2]);
-    text_layer_set_text(s_down_label_layer, tile->texts[4]);
+    text_layer_set_text(s_up_label_layer, data_tile_get_text(tile, 0));
+    text_layer_set_text(s_mid_label_layer, data_tile_get_text(tile, 2));
+    text_layer_set_text(s_down_label_layer, data_tile_get_text(tile, 4));
     text_layer_set_background_color(s_up_label_layer, GColorClear);
     text_layer_set_background_color(s_mid_label_layer, GColorClear);
     text_layer_set_background_color(s_down_label_layer, GColorClear);
@@ -152,9 +257,9 @@ static void action_window_load(Window *window) {
     layer_add_child(window_layer, text_layer_get_layer(s_down_label_layer));
 
     action_bar_layer_set_background_color(s_action_bar_layer, tile->highlight);
-    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(tile->icon_key[0]));
-    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(tile->icon_key[2]));
-    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(tile->icon_key[4]));
+    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_UP, data_icon_array_search(data_tile_get_icon_key(tile, 0), ICON_PRIORITY_VISIBLE));
+    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_SELECT, data_icon_array_search(data_tile_get_icon_key(tile, 2), ICON_PRIORITY_VISIBLE));
+    action_bar_layer_set_icon(s_action_bar_layer, BUTTON_ID_DOWN, data_icon_array_search(data_tile_get_icon_key(tile, 4), ICON_PRIORITY_VISIBLE));
     
     action_bar_layer_set_click_config_provider(s_action_bar_layer, click_config_provider);
     // accel_tap_service_subscribe(tap_handler);
@@ -165,6 +270,8 @@ static void action_window_load(Window *window) {
 
 static void action_window_unload(Window *window) {
     if (s_action_window) {
+        // presses made just before leaving the tile still go out
+        action_window_press_flush();
         text_layer_destroy(s_up_label_layer);
         text_layer_destroy(s_mid_label_layer);
         text_layer_destroy(s_down_label_layer);
@@ -187,22 +294,22 @@ void action_window_set_color(int type) {
         return;
     #endif
     switch(type) {
-        case 0:
+        case ACTION_COLOR_GOOD:
             LONG_VIBE();
             window_set_background_color(s_action_window, GColorIslamicGreen);
             action_bar_layer_set_background_color(s_action_bar_layer, GColorMayGreen);
             break;
-        case 1:
+        case ACTION_COLOR_BAD:
             LONG_VIBE();
             window_set_background_color(s_action_window, GColorFolly);
             action_bar_layer_set_background_color(s_action_bar_layer, GColorSunsetOrange);
             break;
-        case 2:
+        case ACTION_COLOR_ERROR:
             LONG_VIBE();
             window_set_background_color(s_action_window, GColorChromeYellow);
             action_bar_layer_set_background_color(s_action_bar_layer, GColorRajah);
             break;
-        case -1:
+        case ACTION_COLOR_TILE:
             SHORT_VIBE();
             // app_timer_cancel(app_timer);
             window_set_background_color(s_action_window, (tap_toggle) ? tile->highlight : tile->color);
@@ -216,6 +323,16 @@ void action_window_set_color(int type) {
     layer_mark_dirty(window_get_root_layer(s_action_window));
     layer_mark_dirty(action_bar_layer_get_layer(s_action_bar_layer));
 }
+//! Shows the states pebblekit reported for the buttons of a tile, ignored if that tile is no longer open
+//! @param index Absolute index of the tile the states were asked for
+//! @param states One Color value per button in UP..DOWN_HOLD order, or BUTTON_STATE_UNKNOWN
+//! @param size Number of states
+void action_window_set_states(uint16_t index, uint8_t *states, uint16_t size) {
+    if (!s_action_window || index != tile_index) { return; }
+    memcpy(s_button_states, states, MIN(size, sizeof(s_button_states)));
+    action_window_show_states();
+}
+
 void action_window_inset_highlight(ButtonId button_id) {
     GRect up_rect = layer_get_frame(text_layer_get_layer(s_up_label_layer));
     GRect mid_rect = layer_get_frame(text_layer_get_layer(s_mid_label_layer));
@@ -252,10 +369,14 @@ void action_window_pop() {
   action_window_unload(s_action_window);
 }
 
-void action_window_push(Tile *current_tile, uint8_t index) {
+void action_window_push(Tile *current_tile, uint16_t index) {
     if (!s_action_window) {
+        // the menu only decodes what it shows, the button strings are expanded as the tile is opened
+        data_tile_materialize(current_tile);
         tile = current_tile;
         tile_index = index;
+        tile_hash = current_tile->hash;
+        memset(s_button_states, BUTTON_STATE_UNKNOWN, sizeof(s_button_states));
         s_action_window = window_create();
         window_set_background_color(s_action_window, tile->color);
         window_set_window_handlers(s_action_window, (WindowHandlers) {
@@ -263,7 +384,10 @@ void action_window_push(Tile *current_tile, uint8_t index) {
             .unload = action_window_unload,
         });
 
+        uint32_t start_ms = perf_now_ms();
         window_stack_push(s_action_window, true);
+        perf_window_loaded(PERF_WINDOW_ACTION, start_ms);
+        comm_state_request(index);
     }
 
 }
@@ -1,8 +1,21 @@
 #pragma once
 #include <pebble.h>
 #include "c/modules/data.h"
-void action_window_push(Tile *current_tile, uint8_t index);
+
+// ButtonStates entry of a button without a status endpoint, or whose status matched neither value
+#define BUTTON_STATE_UNKNOWN 0xff
+
+// label frames of both button pages of a tile, reused for as long as the tile hash is unchanged
+typedef struct __attribute__((__packed__)) {
+  uint32_t hash;
+  uint32_t last_used;
+  GRect frames[2][3];
+} ActionLayout;
+
+void action_window_push(Tile *current_tile, uint16_t index);
+void action_window_refresh_tile();
 void action_window_pop();
 void action_window_set_color(int type);
+void action_window_set_states(uint16_t index, uint8_t *states, uint16_t size);
 void action_window_inset_highlight(ButtonId button_id);
 void action_window_refresh_icons();
\ No newline at end of file
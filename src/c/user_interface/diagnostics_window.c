@@ -0,0 +1,87 @@
+#include <pebble.h>
+#include "c/user_interface/diagnostics_window.h"
+#include "c/modules/comm.h"
+#include "c/modules/perf.h"
+#include "c/stateful.h"
+// refresh period of the counters while the window is open
+#define DIAGNOSTICS_REFRESH_TIMEOUT 1000
+
+static Window *s_window;
+static ScrollLayer *s_scroll_layer;
+static TextLayer *s_text_layer;
+static AppTimer *s_refresh_timer;
+static char s_text[400];
+
+static void diagnostics_window_update() {
+  PerfCounters *counters = perf_counters();
+  snprintf(s_text, sizeof(s_text),
+           "Tiles %lu B / %u\nDeltas %lu B / %u\nIcons %lu B / %u\n"
+           "First tile %lu ms\nIcon hit %lu miss %lu\nIcon stored %u\n"
+           "Outbox sent %u queued %u\nfailed %u dropped %u\nHeap low %lu B\n"
+           "Load ms %u/%u/%u\nMax ms %u/%u/%u\n\nSelect: send to phone",
+           counters->transfer_bytes[PERF_TRANSFER_TILE], counters->transfer_chunks[PERF_TRANSFER_TILE],
+           counters->transfer_bytes[PERF_TRANSFER_TILE_DELTA], counters->transfer_chunks[PERF_TRANSFER_TILE_DELTA],
+           counters->transfer_bytes[PERF_TRANSFER_ICON_BATCH], counters->transfer_chunks[PERF_TRANSFER_ICON_BATCH],
+           counters->first_tile_ms, counters->icon_hits, counters->icon_misses, counters->icon_stored,
+           counters->outbox.sent, counters->outbox.queued, counters->outbox.failed, counters->outbox.dropped, counters->heap_low,
+           counters->window_load_ms[PERF_WINDOW_LOADING], counters->window_load_ms[PERF_WINDOW_MENU],
+           counters->window_load_ms[PERF_WINDOW_ACTION], counters->window_load_max_ms[PERF_WINDOW_LOADING],
+           counters->window_load_max_ms[PERF_WINDOW_MENU], counters->window_load_max_ms[PERF_WINDOW_ACTION]);
+  text_layer_set_text(s_text_layer, s_text);
+  GSize size = text_layer_get_content_size(s_text_layer);
+  scroll_layer_set_content_size(s_scroll_layer, GSize(size.w, size.h + 8));
+}
+
+static void refresh_callback(void *data) {
+  diagnostics_window_update();
+  s_refresh_timer = app_timer_register(DIAGNOSTICS_REFRESH_TIMEOUT, refresh_callback, NULL);
+}
+
+static void select_callback(ClickRecognizerRef ref, void *ctx) {
+  comm_perf_send();
+  SHORT_VIBE();
+}
+
+static void click_config_handler(void *ctx) {
+  window_single_click_subscribe(BUTTON_ID_SELECT, select_callback);
+}
+
+static void diagnostics_window_load(Window *window) {
+  Layer *window_layer = window_get_root_layer(window);
+  GRect bounds = layer_get_bounds(window_layer);
+  s_scroll_layer = scroll_layer_create(bounds);
+  // up and down scroll, select is ours
+  scroll_layer_set_callbacks(s_scroll_layer, (ScrollLayerCallbacks) {.click_config_provider = click_config_handler});
+  scroll_layer_set_click_config_onto_window(s_scroll_layer, window);
+  s_text_layer = text_layer_create(GRect(PBL_IF_ROUND_ELSE(24, 4), 0, bounds.size.w - PBL_IF_ROUND_ELSE(48, 8), 2000));
+  text_layer_set_font(s_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
+  text_layer_set_text_color(s_text_layer, GColorWhite);
+  text_layer_set_background_color(s_text_layer, GColorClear);
+  text_layer_set_text_alignment(s_text_layer, PBL_IF_ROUND_ELSE(GTextAlignmentCenter, GTextAlignmentLeft));
+  scroll_layer_add_child(s_scroll_layer, text_layer_get_layer(s_text_layer));
+  layer_add_child(window_layer, scroll_layer_get_layer(s_scroll_layer));
+  refresh_callback(NULL);
+}
+
+static void diagnostics_window_unload(Window *window) {
+  if (s_window) {
+    if (s_refresh_timer) { app_timer_cancel(s_refresh_timer); }
+    s_refresh_timer = NULL;
+    text_layer_destroy(s_text_layer);
+    scroll_layer_destroy(s_scroll_layer);
+    window_destroy(s_window);
+    s_window = NULL;
+  }
+}
+
+//! Shows the perf counters, opened by holding select in the menu
+void diagnostics_window_push() {
+  if (s_window) { return; }
+  s_window = window_create();
+  window_set_background_color(s_window, GColorBlack);
+  window_set_window_handlers(s_window, (WindowHandlers) {
+    .load = diagnostics_window_load,
+    .unload = diagnostics_window_unload,
+  });
+  window_stack_push(s_window, true);
+}
@@ -0,0 +1,2 @@
+#pragma once
+void diagnostics_window_push();
@@ -1,6 +1,8 @@
 #include <pebble.h>
 #include "c/user_interface/loading_window.h"
 #include "c/modules/comm.h"
+#include "c/modules/storage.h"
+#include "c/modules/perf.h"
 #include "c/stateful.h"
 
 static GBitmap *loading_bitmap;
@@ -180,7 +182,7 @@ void loading_window_push(char *text) {
     GColor8 color = GColorBlack;
     #ifdef PBL_COLOR
       srand(time(0));
-      if(persist_read_data(0, &color, sizeof(GColor8)) == E_DOES_NOT_EXIST) {
+      if(persist_read_data(PERSIST_KEY_COLOR, &color, sizeof(GColor8)) == E_DOES_NOT_EXIST) {
         GColor8 colors[] = {GColorCobaltBlue, GColorIslamicGreen, GColorImperialPurple, GColorFolly, GColorChromeYellow};
         color = colors[rand() % ARRAY_LENGTH(colors)]; 
       }
@@ -191,7 +193,9 @@ void loading_window_push(char *text) {
       .disappear = window_disappear,
       .unload = window_unload
     });
+    uint32_t start_ms = perf_now_ms();
     window_stack_push(s_window, true);
+    perf_window_loaded(PERF_WINDOW_LOADING, start_ms);
   }
 }
 
@@ -1,16 +1,23 @@
 #include <pebble.h>
 #include "c/user_interface/action_window.h"
 #include "c/modules/comm.h"
+#include "c/modules/storage.h"
 #include "c/stateful.h"
 #include "c/user_interface/loading_window.h"
+#include "c/user_interface/diagnostics_window.h"
+#include "c/modules/perf.h"
 #define CELL_HEIGHT ((const int16_t) 36)
+// rows past the edge of the screen whose icons are fetched ahead of scrolling
+#define MENU_PREFETCH_ROWS 2
+// rows from the edge of the window of tiles we hold at which the next page is fetched, less for a narrower window
+#define MENU_PAGE_MARGIN (MAX_TILES / 4)
 
 static Window *s_menu_window;
 static MenuLayer *s_menu_layer;
 
 static uint16_t get_num_rows_callback(MenuLayer *menu_layer, uint16_t section_index, void *context) {
   if (tile_array) {
-  return tile_array->used;
+  return tile_array->total;
   } else {
     return 0;
   }
@@ -18,8 +25,16 @@ static uint16_t get_num_rows_callback(MenuLayer *menu_layer, uint16_t section_in
 
 static void draw_row_callback(GContext *ctx, const Layer *cell_layer, MenuIndex *cell_index, void *context) {
   if (tile_array) {
-    Tile *tile = tile_array->tiles[cell_index->row];
-    GBitmap *icon = data_icon_array_search(tile->icon_key[6]);
+    Tile *tile = data_tile_array_get_tile(cell_index->row);
+    if (!tile) {
+      // the row is outside the window of tiles we hold, selection_changed_callback and menu_window_reload ask
+      // for its page and it is drawn once pebblekit has sent it
+      GRect bounds = layer_get_bounds(cell_layer);
+      GRect text_rect = GRect(PBL_IF_RECT_ELSE(CELL_HEIGHT *.9, CELL_HEIGHT * 1.5), (bounds.size.h - 24) / 2, bounds.size.w - CELL_HEIGHT, 24);
+      graphics_draw_text(ctx, "...", ubuntu18, text_rect, GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+      return;
+    }
+    GBitmap *icon = data_icon_array_search(data_tile_get_icon_key(tile, TITLE), ICON_PRIORITY_MENU);
     GRect icon_bounds = gbitmap_get_bounds(icon);
     GRect bounds =  layer_get_bounds(cell_layer);
     bounds.origin.x = PBL_IF_RECT_ELSE(bounds.origin.x, CELL_HEIGHT / 2);
@@ -27,24 +42,87 @@ static void draw_row_callback(GContext *ctx, const Layer *cell_layer, MenuIndex
     bounds.size.w *= 0.8f;
     grect_align(&icon_bounds, &bounds, GAlignCenter, true);
     graphics_context_set_compositing_mode(ctx, GCompOpSet);
-    graphics_draw_bitmap_in_rect(ctx, data_icon_array_search(tile->icon_key[6]), icon_bounds);
+    graphics_draw_bitmap_in_rect(ctx, icon, icon_bounds);
     bounds =  layer_get_bounds(cell_layer);
     bounds.origin.x = PBL_IF_RECT_ELSE(CELL_HEIGHT *.9, CELL_HEIGHT * 1.5);
     bounds.size.w = bounds.size.w - CELL_HEIGHT; 
     GSize text_size = GSize(0, 24);
     GRect text_rect = GRect(bounds.origin.x, (bounds.size.h - text_size.h) /2, bounds.size.w, text_size.h);
 
-    graphics_draw_text(ctx, tile->texts[6], ubuntu18, text_rect, GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+    graphics_draw_text(ctx, data_tile_get_text(tile, TITLE), ubuntu18, text_rect, GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+    perf_first_tile();
 
   }
 }
 
 
+// rows whose icons are currently pinned or prefetched, including the prefetched rows past the screen edge
+static int16_t s_window_first = 0;
+static int16_t s_window_last = -1;
+
+// rows outside the window of tiles we hold have no icon yet
+static char *menu_window_row_icon_key(int16_t row) {
+  Tile *tile = data_tile_array_get_tile(row);
+  return (tile) ? data_tile_get_icon_key(tile, TITLE) : "";
+}
+
+static bool menu_window_rows_use_icon(char *key, int16_t first_row, int16_t last_row) {
+  for(int16_t row = first_row; row <= last_row; row++) {
+    if (strcmp(menu_window_row_icon_key(row), key) == 0) { return true; }
+  }
+  return false;
+}
+
+//! Pins the icons of rows around the selection so scrolling does not evict what is on screen, prefetches the
+//! icons of the next rows in the direction of scrolling and cancels icon requests for rows that have left the window
+//! @param selected_row Row now selected
+//! @param direction 1 when scrolling down, -1 when scrolling up, 0 to prefetch on both sides
+static void menu_window_update_viewport(uint16_t selected_row, int8_t direction) {
+  if (!tile_array) { return; }
+  int16_t visible_rows = layer_get_bounds(window_get_root_layer(s_menu_window)).size.h / CELL_HEIGHT + 1;
+  int16_t first_row = MAX(0, selected_row - visible_rows / 2);
+  int16_t last_row = MIN(tile_array->total - 1, selected_row + visible_rows / 2);
+  // only prefetch what the icon array can hold next to the pinned rows, or prefetching would evict them
+  int16_t prefetch_rows = (visible_rows + MENU_PREFETCH_ROWS <= ICON_ARRAY_SIZE) ? MENU_PREFETCH_ROWS : 0;
+  int16_t window_first = MAX(0, first_row - ((direction <= 0) ? prefetch_rows : 0));
+  int16_t window_last = MIN(tile_array->total - 1, last_row + ((direction >= 0) ? prefetch_rows : 0));
+
+  data_icon_array_unpin_all();
+  for(int16_t row = first_row; row <= last_row; row++) {
+    data_icon_array_pin(menu_window_row_icon_key(row), ICON_PRIORITY_MENU);
+  }
+  for(int16_t row = window_first; row <= window_last; row++) {
+    if (row >= first_row && row <= last_row) { continue; }
+    data_icon_array_search(menu_window_row_icon_key(row), ICON_PRIORITY_PREFETCH);
+  }
+  for(int16_t row = MAX(0, s_window_first); row <= MIN(tile_array->total - 1, s_window_last); row++) {
+    if (row >= window_first && row <= window_last) { continue; }
+    char *key = menu_window_row_icon_key(row);
+    if (!menu_window_rows_use_icon(key, window_first, window_last)) { data_icon_array_cancel(key); }
+  }
+  s_window_first = window_first;
+  s_window_last = window_last;
+}
+
 static void selection_changed_callback(struct MenuLayer *menu_layer, MenuIndex cell_index, MenuIndex cell_old_index, void *context) {
   if (tile_array) {
-    Tile *tile = tile_array->tiles[cell_index.row];
-    menu_layer_set_highlight_colors(s_menu_layer, tile->color, GColorWhite);
-    menu_layer_set_normal_colors(s_menu_layer, tile->highlight,PBL_IF_COLOR_ELSE(GColorWhite, GColorBlack));
+    // a jump of more than one row is a wrap around, which scrolls the opposite way
+    int16_t delta = cell_index.row - cell_old_index.row;
+    int8_t direction = (delta > 0) ? 1 : (delta < 0) ? -1 : 0;
+    if (delta > 1 || delta < -1) { direction = -direction; }
+    menu_window_update_viewport(cell_index.row, direction);
+    // fetch the next page before the selection runs off the window of tiles we hold
+    uint16_t window_end = tile_array->first + tile_array->used;
+    uint16_t margin = MIN(MENU_PAGE_MARGIN, tile_array->used / 4);
+    if ((tile_array->first > 0 && cell_index.row < tile_array->first + margin) ||
+        (window_end < tile_array->total && cell_index.row + margin >= window_end)) {
+      comm_tile_page_request(cell_index.row);
+    }
+    Tile *tile = data_tile_array_get_tile(cell_index.row);
+    if (tile) {
+      menu_layer_set_highlight_colors(s_menu_layer, tile->color, GColorWhite);
+      menu_layer_set_normal_colors(s_menu_layer, tile->highlight,PBL_IF_COLOR_ELSE(GColorWhite, GColorBlack));
+    }
     layer_mark_dirty(menu_layer_get_layer(menu_layer));
   }
 }
@@ -57,22 +135,28 @@ static int16_t get_cell_height_callback(struct MenuLayer *menu_layer, MenuIndex
 
 static void open_default(void *data) {
   if (tile_array && tile_array->open_default) { 
-    Tile *default_tile = tile_array->tiles[tile_array->default_idx];
-    action_window_push(default_tile, tile_array->default_idx); 
+    Tile *default_tile = data_tile_array_get_tile(tile_array->default_idx);
+    if (default_tile) { action_window_push(default_tile, tile_array->default_idx); }
    } 
 }
 
 static void select_callback(ClickRecognizerRef ref, void *ctx) {
   if (tile_array) {
-    uint8_t selected_row = menu_layer_get_selected_index(s_menu_layer).row;
-    action_window_push(tile_array->tiles[selected_row], selected_row);
+    uint16_t selected_row = menu_layer_get_selected_index(s_menu_layer).row;
+    Tile *tile = data_tile_array_get_tile(selected_row);
+    if (tile) { action_window_push(tile, selected_row); }
   }
 }
 
+// holding select opens the diagnostics window, it isn't listed anywhere
+static void select_long_callback(ClickRecognizerRef ref, void *ctx) {
+  diagnostics_window_push();
+}
+
 static void up_callback(ClickRecognizerRef ref, void *ctx){
   if (!tile_array) { return; }
   if (menu_layer_get_selected_index(s_menu_layer).row == 0) {
-    menu_layer_set_selected_index(s_menu_layer,(MenuIndex) {.row = tile_array->used - 1, .section = 0},MenuRowAlignCenter, true);
+    menu_layer_set_selected_index(s_menu_layer,(MenuIndex) {.row = tile_array->total - 1, .section = 0},MenuRowAlignCenter, true);
   } else {
     menu_layer_set_selected_next(s_menu_layer, true, MenuRowAlignCenter, true);
   }
@@ -80,7 +164,7 @@ static void up_callback(ClickRecognizerRef ref, void *ctx){
 
 static void down_callback(ClickRecognizerRef ref, void *ctx){
   if (!tile_array) { return; }
-  if (menu_layer_get_selected_index(s_menu_layer).row == tile_array->used - 1) {
+  if (menu_layer_get_selected_index(s_menu_layer).row == tile_array->total - 1) {
     menu_layer_set_selected_index(s_menu_layer,(MenuIndex) {.row = 0, .section = 0},MenuRowAlignCenter, true);
   } else {
     menu_layer_set_selected_next(s_menu_layer, false, MenuRowAlignCenter, true);
@@ -91,6 +175,7 @@ static void click_config_handler(void *ctx) {
   window_single_repeating_click_subscribe(BUTTON_ID_UP, 200, up_callback);
   window_single_repeating_click_subscribe(BUTTON_ID_DOWN, 200, down_callback);
   window_single_click_subscribe(BUTTON_ID_SELECT, select_callback);
+  window_long_click_subscribe(BUTTON_ID_SELECT, 1500, select_long_callback, NULL);
 }
 
 static void menu_window_load(Window *window) {
@@ -112,10 +197,12 @@ static void menu_window_load(Window *window) {
   Layer *menu_layer_root = menu_layer_get_layer(s_menu_layer);
 
   if (tile_array) {
-    Tile *default_tile = tile_array->tiles[tile_array->default_idx];
-    persist_write_data(0, &(default_tile->color), sizeof(GColor8));
-    menu_layer_set_highlight_colors(s_menu_layer, default_tile->color, GColorWhite);
-    menu_layer_set_normal_colors(s_menu_layer, default_tile->highlight,PBL_IF_COLOR_ELSE(GColorWhite, GColorBlack));
+    Tile *default_tile = data_tile_array_get_tile(tile_array->default_idx);
+    if (default_tile) {
+      persist_write_data(PERSIST_KEY_COLOR, &(default_tile->color), sizeof(GColor8));
+      menu_layer_set_highlight_colors(s_menu_layer, default_tile->color, GColorWhite);
+      menu_layer_set_normal_colors(s_menu_layer, default_tile->highlight,PBL_IF_COLOR_ELSE(GColorWhite, GColorBlack));
+    }
     menu_layer_set_selected_index(s_menu_layer, (MenuIndex) {.section = 0, .row = tile_array->default_idx}, MenuRowAlignCenter, false);
     layer_add_child(window_layer, menu_layer_root);
     // workaround to delay secondary tile window push as SDK does not set up callbacks correctly if window is init'd directly
@@ -124,6 +211,10 @@ static void menu_window_load(Window *window) {
 
 }
 
+static void menu_window_appear(Window *window) {
+  menu_window_update_viewport(menu_layer_get_selected_index(s_menu_layer).row, 0);
+}
+
 static void menu_window_unload(Window *window) {
   if (s_menu_window) {
     menu_layer_destroy(s_menu_layer);
@@ -142,15 +233,43 @@ void menu_window_pop() {
   menu_window_unload(s_menu_window);
 }
 
+// the menu stays open while tile_array is replaced, so a new page of tiles keeps the selection
+static void menu_window_reload() {
+  menu_layer_reload_data(s_menu_layer);
+  if (!tile_array) { return; }
+  MenuIndex selected = menu_layer_get_selected_index(s_menu_layer);
+  if (selected.row >= tile_array->total) {
+    menu_layer_set_selected_index(s_menu_layer, (MenuIndex) {.section = 0, .row = tile_array->default_idx}, MenuRowAlignCenter, false);
+  }
+  Tile *tile = data_tile_array_get_tile(menu_layer_get_selected_index(s_menu_layer).row);
+  if (tile) {
+    menu_layer_set_highlight_colors(s_menu_layer, tile->color, GColorWhite);
+    menu_layer_set_normal_colors(s_menu_layer, tile->highlight,PBL_IF_COLOR_ELSE(GColorWhite, GColorBlack));
+  } else {
+    // the page that arrived doesn't hold the selection, the menu moved on while it was in flight
+    comm_tile_page_request(menu_layer_get_selected_index(s_menu_layer).row);
+  }
+  if (window_stack_get_top_window() == s_menu_window) {
+    menu_window_update_viewport(menu_layer_get_selected_index(s_menu_layer).row, 0);
+  }
+}
+
 void menu_window_push() {
-  if (!s_menu_window) {
+  if (s_menu_window) {
+    menu_window_reload();
+  } else {
+    s_window_first = 0;
+    s_window_last = -1;
     s_menu_window = window_create();
     window_set_background_color(s_menu_window, GColorBlack);
     window_set_window_handlers(s_menu_window, (WindowHandlers) {
       .load = menu_window_load,
+      .appear = menu_window_appear,
       .unload = menu_window_unload,
     });
+    uint32_t start_ms = perf_now_ms();
     window_stack_push(s_menu_window, true);
+    perf_window_loaded(PERF_WINDOW_MENU, start_ms);
   }
 }
 
@@ -0,0 +1,201 @@
+// Converts PNG icons into the watch's native GBitmap layout so the watch can skip PNG decoding,
+// see data_icon_create_native() for the layout produced
+var inflate = require('tiny-inflate');
+
+// values of GBitmapFormat in pebble.h
+var GBitmapFormat = {
+  "1BIT": 0,
+  "8BIT": 1,
+  "1BIT_PALETTE": 2,
+  "2BIT_PALETTE": 3,
+  "4BIT_PALETTE": 4
+};
+
+var PNG_SIGNATURE = [137, 80, 78, 71, 13, 10, 26, 10];
+
+function readUint32(bytes, ptr) {
+  return ((bytes[ptr] << 24) | (bytes[ptr + 1] << 16) | (bytes[ptr + 2] << 8) | bytes[ptr + 3]) >>> 0;
+}
+
+function paeth(a, b, c) {
+  var p = a + b - c;
+  var pa = Math.abs(p - a), pb = Math.abs(p - b), pc = Math.abs(p - c);
+  if (pa <= pb && pa <= pc) { return a; }
+  return (pb <= pc) ? b : c;
+}
+
+//! Decodes a non-interlaced PNG into RGBA pixels
+//! @param bytes PNG file contents
+//! @return {width, height, pixels} with 4 bytes per pixel, or null if the PNG isn't supported
+function decodePng(bytes) {
+  for (var i = 0; i < PNG_SIGNATURE.length; i++) {
+    if (bytes[i] != PNG_SIGNATURE[i]) { return null; }
+  }
+  var ptr = PNG_SIGNATURE.length;
+  var width = 0, height = 0, bitDepth = 0, colorType = 0, interlace = 0;
+  var palette = [], transparency = [], idat = [];
+  while (ptr + 8 <= bytes.length) {
+    var length = readUint32(bytes, ptr);
+    var type = String.fromCharCode(bytes[ptr + 4], bytes[ptr + 5], bytes[ptr + 6], bytes[ptr + 7]);
+    var data = ptr + 8;
+    if (data + length > bytes.length) { return null; }
+    if (type == 'IHDR') {
+      width = readUint32(bytes, data);
+      height = readUint32(bytes, data + 4);
+      bitDepth = bytes[data + 8];
+      colorType = bytes[data + 9];
+      interlace = bytes[data + 12];
+    } else if (type == 'PLTE') {
+      for (var i = 0; i + 2 < length; i += 3) {
+        palette.push([bytes[data + i], bytes[data + i + 1], bytes[data + i + 2]]);
+      }
+    } else if (type == 'tRNS') {
+      for (var i = 0; i < length; i++) { transparency.push(bytes[data + i]); }
+    } else if (type == 'IDAT') {
+      for (var i = 0; i < length; i++) { idat.push(bytes[data + i]); }
+    } else if (type == 'IEND') {
+      break;
+    }
+    ptr = data + length + 4;
+  }
+  var channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[colorType];
+  if (!channels || interlace != 0 || width == 0 || height == 0 || width > 255 || height > 255 || idat.length < 2) {
+    return null;
+  }
+
+  // bytes per complete pixel for filtering, and per row of the scanline
+  var bitsPerPixel = channels * bitDepth;
+  var filterBpp = Math.max(1, bitsPerPixel >> 3);
+  var rowBytes = (width * bitsPerPixel + 7) >> 3;
+  var raw = new Uint8Array(height * (rowBytes + 1));
+  try {
+    // skip the 2 byte zlib header, tiny-inflate handles raw deflate
+    inflate(new Uint8Array(idat.slice(2)), raw);
+  } catch (e) {
+    return null;
+  }
+
+  var rows = new Uint8Array(height * rowBytes);
+  for (var y = 0; y < height; y++) {
+    var filter = raw[y * (rowBytes + 1)];
+    var src = y * (rowBytes + 1) + 1;
+    var dst = y * rowBytes;
+    for (var x = 0; x < rowBytes; x++) {
+      var a = (x >= filterBpp) ? rows[dst + x - filterBpp] : 0;
+      var b = (y > 0) ? rows[dst + x - rowBytes] : 0;
+      var c = (x >= filterBpp && y > 0) ? rows[dst + x - filterBpp - rowBytes] : 0;
+      var value = raw[src + x];
+      switch (filter) {
+        case 1: value += a; break;
+        case 2: value += b; break;
+        case 3: value += (a + b) >> 1; break;
+        case 4: value += paeth(a, b, c); break;
+      }
+      rows[dst + x] = value & 0xff;
+    }
+  }
+
+  // reads sample n of a row, samples narrower than a byte are packed most significant first
+  function sample(row, n) {
+    if (bitDepth == 8) { return rows[row * rowBytes + n]; }
+    if (bitDepth == 16) { return rows[row * rowBytes + n * 2]; }
+    var bit = n * bitDepth;
+    var shift = 8 - bitDepth - (bit & 7);
+    return (rows[row * rowBytes + (bit >> 3)] >> shift) & ((1 << bitDepth) - 1);
+  }
+  // scales low bit depth grey levels up to 8 bits
+  var scale = (bitDepth < 8) ? 255 / ((1 << bitDepth) - 1) : 1;
+
+  var pixels = new Uint8Array(width * height * 4);
+  for (var y = 0; y < height; y++) {
+    for (var x = 0; x < width; x++) {
+      var out = (y * width + x) * 4;
+      var r, g, b, alpha = 255;
+      if (colorType == 3) {
+        var index = sample(y, x);
+        var entry = palette[index] || [0, 0, 0];
+        r = entry[0]; g = entry[1]; b = entry[2];
+        if (index < transparency.length) { alpha = transparency[index]; }
+      } else if (colorType == 0 || colorType == 4) {
+        r = g = b = Math.round(sample(y, x * channels) * scale);
+        if (colorType == 4) { alpha = sample(y, x * channels + 1); }
+      } else {
+        r = sample(y, x * channels);
+        g = sample(y, x * channels + 1);
+        b = sample(y, x * channels + 2);
+        if (colorType == 6) { alpha = sample(y, x * channels + 3); }
+      }
+      pixels[out] = r; pixels[out + 1] = g; pixels[out + 2] = b; pixels[out + 3] = alpha;
+    }
+  }
+  return {"width": width, "height": height, "pixels": pixels};
+}
+
+//! Reduces an RGBA pixel to a GColor8, argb with 2 bits per channel
+//! @param blackAndWhite Limit colours to black, white and clear
+function toGColor8(r, g, b, alpha, blackAndWhite) {
+  if (alpha < 128) { return 0; }
+  if (blackAndWhite) {
+    return (r * 299 + g * 587 + b * 114 >= 128000) ? 0xff : 0xc0;
+  }
+  return 0xc0 | (Math.round(r / 85) << 4) | (Math.round(g / 85) << 2) | Math.round(b / 85);
+}
+
+//! Converts a PNG into the native bitmap layout of a platform: the GBitmapFormat, width, height, palette size,
+//! the palette as GColor8 and rows packed to whole bytes, most significant pixel first. Uses the smallest
+//! palette that holds every colour, or 8 bit colour beyond 16 colours
+//! @param bytes PNG file contents
+//! @param platform Platform name as reported by Pebble.getActiveWatchInfo()
+//! @return Array of bytes, or null if the PNG can't be converted and should be sent as is
+function pngToNative(bytes, platform) {
+  // aplite has no palettized formats and receives resource icons only
+  if (platform == 'aplite') { return null; }
+  var image = decodePng(bytes);
+  if (!image) { return null; }
+  var blackAndWhite = (platform == 'diorite');
+
+  var colors = [];
+  var indexes = {};
+  var pixelColors = new Uint8Array(image.width * image.height);
+  for (var i = 0; i < pixelColors.length; i++) {
+    var p = image.pixels;
+    var color = toGColor8(p[i * 4], p[i * 4 + 1], p[i * 4 + 2], p[i * 4 + 3], blackAndWhite);
+    if (!(color in indexes)) {
+      indexes[color] = colors.length;
+      colors.push(color);
+    }
+    pixelColors[i] = color;
+  }
+
+  var format, bits;
+  if (colors.length <= 2) {
+    format = GBitmapFormat["1BIT_PALETTE"]; bits = 1;
+  } else if (colors.length <= 4) {
+    format = GBitmapFormat["2BIT_PALETTE"]; bits = 2;
+  } else if (colors.length <= 16) {
+    format = GBitmapFormat["4BIT_PALETTE"]; bits = 4;
+  } else {
+    format = GBitmapFormat["8BIT"]; bits = 8;
+    colors = [];
+  }
+
+  var out = [format, image.width, image.height, colors.length].concat(colors);
+  var rowSize = (image.width * bits + 7) >> 3;
+  for (var y = 0; y < image.height; y++) {
+    var row = new Array(rowSize);
+    for (var i = 0; i < rowSize; i++) { row[i] = 0; }
+    for (var x = 0; x < image.width; x++) {
+      var color = pixelColors[y * image.width + x];
+      var value = (bits == 8) ? color : indexes[color];
+      var bit = x * bits;
+      row[bit >> 3] |= value << (8 - bits - (bit & 7));
+    }
+    for (var i = 0; i < rowSize; i++) { out.push(row[i]); }
+  }
+  return out;
+}
+
+module.exports = {
+  "decodePng": decodePng,
+  "pngToNative": pngToNative
+};
@@ -4,16 +4,96 @@ require('./polyfills/strings');
 var Buffer = require('buffer/').Buffer;
 var Clay = require('pebble-clay');
 var customClay = require('./custom-clay');
+var bitmap = require('./bitmap');
 var clayConfig = require('./config')
 var messageKeys = require('message_keys')
 var clay = new Clay(clayConfig, customClay, {autoHandleEvents: false});
-var keepAliveTimeout;
 
 var DEBUG = 0; 
-var MAX_CHUNK_SIZE = (Pebble.getActiveWatchInfo().model.indexOf('aplite') != -1) ? 256 : 8200;
-var ICON_BUFFER_SIZE = (Pebble.getActiveWatchInfo().model.indexOf('aplite') != -1) ? 4 : 10;
+// .model names the hardware, pebble_black for example, only .platform reliably says aplite
+var APLITE = (Pebble.getActiveWatchInfo().platform == 'aplite');
+// inbox size of the watch until it reports its own, see chunkSizeLimit()
+var MAX_CHUNK_SIZE = APLITE ? 256 : 8200;
+var ICON_BUFFER_SIZE = APLITE ? 4 : 10;
+// bytes of icon data packed into one batch transfer, the watch holds the whole batch in memory while decoding it
+var ICON_BATCH_MAX_BYTES = APLITE ? 1024 : 8192;
+// tiles the watch holds at once until it reports its own, longer configs are sent a window at a time, see packTiles()
+var MAX_TILES = APLITE ? 16 : 64;
+var MAX_TOTAL_TILES = 0xffff;
+// tile blob formats, see encodeTiles()
+var TILE_FORMAT_INLINE = 1;
+var TILE_FORMAT_TABLE = 2;
+var TILE_TABLE_COMPRESSED = 0x01;
+var TILE_TABLE_WIDE = 0x02;
+// strings per tile of each kind, texts then icon keys, the last of each is the menu title
+var TILE_STRING_COUNT = 7;
+var TILE_TITLE = 6;
+var TILE_FORMAT = TILE_FORMAT_TABLE;
+// compress the string table when that makes it smaller
+var TILE_COMPRESSION = true;
+// chunks kept in flight by a windowed transfer, 1 selects stop-and-wait
+var TRANSFER_WINDOW = 4;
+// the watch tracks received chunks in a 64 bit mask, longer transfers use stop-and-wait
+var TRANSFER_MAX_CHUNKS = 64;
+// failed sends of a single chunk before a windowed transfer restarts as stop-and-wait
+var TRANSFER_RETRIES = 3;
+var TRANSFER_RETRY_DELAY = 1000;
+// failed sends in a row before a transfer is given up on, the watch asks for it again once its own timeout passes
+var TRANSFER_MAX_FAILURES = 10;
+// heap the watch keeps free beyond a transfer and about as much again to decode it, see TRANSFER_HEAP_RESERVE
+// in stateful.h. Transfers are sized to fit, the watch refuses any that don't
+var TRANSFER_HEAP_RESERVE = 2048;
+// protocol version of index.js, see PROTOCOL_VERSION in stateful.h
+var PROTOCOL_VERSION = 1;
+// features the watch reports with READY and tile requests, see CAPABILITIES in stateful.h
+var Capability = {
+  "TILE_TABLE": 0x01,
+  "TILE_COMPRESSION": 0x02,
+  "TRANSFER_WINDOW": 0x04,
+  "NATIVE_ICONS": 0x08
+};
+// delay before cycling button indexes are written back to localStorage, presses within it share one write
+var BUTTON_INDEX_FLUSH_DELAY = 2000;
+// keep-alive pings start every keep_alive_interval seconds and back off to KEEP_ALIVE_MAX_INTERVAL while the
+// user is idle, see keepAliveTick()
+var KEEP_ALIVE_INTERVAL = 5000;
+var KEEP_ALIVE_MAX_INTERVAL = 60000;
+// pings stop once the watch app has sent nothing for this long, its next message starts them again
+var KEEP_ALIVE_IDLE_TIMEOUT = 300000;
+// a request this long after the previous one would have found the connection cold without a ping in between
+var KEEP_ALIVE_COLD_AFTER = 10000;
  
 var no_transfer_lock = false;
+// capabilities of the watch app, null until it has reported them
+var watchCapabilities = null;
+// largest inbox the watch could open, the one it did and its free heap as of its last request, null until reported
+var watchLimits = {"inboxMax": null, "inboxSize": null, "heapFree": null};
+// tiles in the last window sent, see packTiles()
+var tileWindowSent = MAX_TILES;
+// last tile transfer and icon batch the watch refused as too large, Infinity if it hasn't, see refusedLimit()
+var refusedBytes = {"tile": Infinity, "icon": Infinity};
+// when each phase of the handshake with the watch completed, see handshakeMark()
+var handshake = {"start": Date.now()};
+// tiles object parsed once and its buttons resolved for the press path, see loadConfig()
+var config = null;
+// next data index of each cycling button, written back after BUTTON_INDEX_FLUSH_DELAY
+var buttonIndexes = null;
+var buttonIndexTimeout = null;
+// status poll loops in flight, keyed by endpointKey(), see xhrStatus()
+var statusPolls = {};
+// when the transfer of each type under way was started, and the totals of those completed, see transferDone()
+var transferStarts = {};
+// array being sent for each transfer type, flagged cancelled if the watch refuses it
+var transfersInFlight = {};
+var transferStats = {};
+// keep-alive state, url is null while keep_alive is off
+var keepAlive = {
+  "url": null, "headers": null, "timeout": null,
+  "interval": KEEP_ALIVE_INTERVAL, "baseInterval": KEEP_ALIVE_INTERVAL,
+  "lastRequest": 0, "lastPing": 0, "lastActive": 0,
+  // pings sent and skipped, requests that a ping had kept warm, and requests and pings that still timed out
+  "stats": {"pings": 0, "skipped": 0, "warm": 0, "timeouts": 0, "pingTimeouts": 0}
+};
 
 
 
@@ -46,12 +126,25 @@ const TransferType = {
   "READY": 6,
   "NO_CLAY": 7,
   "REFRESH": 8,
+  "CACHE_VALID": 9,
+  "TILE_DELTA": 10,
+  "ICON_BATCH": 11,
+  "STATE": 12,
+  "PERF": 13,
+  "REFUSED": 14,
+};
+const IconFormat = {
+  "RESOURCE": 0,
+  "PNG": 1,
+  "NATIVE": 2,
 };
 const Color = {
   "GOOD": 0,
   "BAD": 1,
   "ERROR": 2,
 };
+// ButtonStates entry of a button without a status, or whose status matched neither good nor bad
+var BUTTON_STATE_UNKNOWN = 0xff;
 const Button = {
   "0": "up",
   "1": "up_hold",
@@ -71,6 +164,9 @@ const CallType = {
   "DISABLED": 3
 };
 
+// converted icon bytes by key, see iconBytes()
+var nativeIcons = {};
+
 var icons = {
   "356a192b": 1,
   "da4b9237": 2,
@@ -113,6 +209,7 @@ function keyStartsWith(obj, substring) {
 function clayToTiles() {
   no_transfer_lock = true;
   localStorage.setItem("tiles", "");
+  resetConfig();
   var tiles = {}
   var claySettings = JSON.parse(localStorage.getItem('clay-settings'));
 
@@ -131,9 +228,8 @@ function clayToTiles() {
   // if tiles object has at least 1 tile
   if (tiles != null && Object.keys(tiles).length != 0  && tiles.tiles != null && tiles.tiles.length != 0) {
     localStorage.setItem('tiles', JSON.stringify(tiles));
-    Pebble.sendAppMessage({"TransferType": TransferType.REFRESH },function() {
-      Pebble.sendAppMessage({"TransferType": TransferType.READY }, messageSuccessCallback, messageFailureCallback);
-    }, messageFailureCallback);
+    resetConfig();
+    Pebble.sendAppMessage({"TransferType": TransferType.REFRESH }, sendReady, messageFailureCallback);
   } else {
     claySettings['pebblekit_message'] = "No tiles present in JSON";
     localStorage.setItem('clay-settings', JSON.stringify(claySettings));
@@ -144,53 +240,282 @@ function clayToTiles() {
   no_transfer_lock = false;
 }
 
-function packIcon(key, index) {
-  if (no_transfer_lock) {return;}
-  var buffer = new ArrayBuffer(1000000);
-  var uint8 = new Uint8Array(buffer);
-  var ptr = 0;
+//! Checks a capability of the watch app, a watch that hasn't reported any yet is taken to be this version
+function watchSupports(capability) {
+  return watchCapabilities == null || (watchCapabilities & capability) != 0;
+}
 
-  var icon = icons[key];
+//! Keeps the tile window, inbox and heap figures the watch sends with its hello and its requests
+function updateWatchLimits(dict) {
+  if (dict.MaxTiles != null) { MAX_TILES = dict.MaxTiles; }
+  if (dict.InboxMax != null) { watchLimits.inboxMax = dict.InboxMax; }
+  if (dict.InboxSize != null) { watchLimits.inboxSize = dict.InboxSize; }
+  if (dict.HeapFree != null) { watchLimits.heapFree = dict.HeapFree; }
+}
+
+//! @return Largest message the watch's inbox takes
+function chunkSizeLimit() {
+  return watchLimits.inboxSize || MAX_CHUNK_SIZE;
+}
+
+//! @return Largest transfer the watch can afford as of its last report
+function transferBudget() {
+  if (watchLimits.heapFree == null) { return Infinity; }
+  return Math.max(0, Math.floor((watchLimits.heapFree - TRANSFER_HEAP_RESERVE) / 2));
+}
+
+//! Keeps transfers to half of one the watch refused until it reports enough heap for the refused one again
+//! @param refused Smallest transfer of the kind refused, Infinity if none was
+//! @return Largest transfer of the kind to send
+function refusedLimit(refused) {
+  var budget = transferBudget();
+  return (budget >= refused) ? budget : Math.min(budget, Math.max(1, Math.floor(refused / 2)));
+}
+
+//! @return Largest tile transfer to send, windows are halved until they fit
+function tileBytesLimit() {
+  return refusedLimit(refusedBytes.tile);
+}
+
+//! @return Largest icon batch to send
+function iconBatchLimit() {
+  return Math.min(ICON_BATCH_MAX_BYTES, refusedLimit(refusedBytes.icon));
+}
+
+//! Logs the time since startup at which a handshake phase first completed
+function handshakeMark(phase) {
+  if (phase in handshake) { return; }
+  handshake[phase] = Date.now() - handshake.start;
+  if (DEBUG > 0) { console.log("Handshake " + phase + " after " + handshake[phase] + " ms"); }
+}
+
+//! Tells the watch pebblekit is listening, it answers with a tile request
+function sendReady() {
+  Pebble.sendAppMessage({"TransferType": TransferType.READY, "Version": PROTOCOL_VERSION }, messageSuccessCallback, messageFailureCallback);
+}
+
+//! Joins an endpoint with the config's base_url and merges its headers with the config's, which take precedence
+//! @param tiles Tiles object
+//! @param endpoint Button or status object with url, method, headers, data, variable, good and bad
+function resolveEndpoint(tiles, endpoint) {
+  var headers = {};
+  var sources = [endpoint.headers, tiles.headers];
+  for (var i = 0; i < sources.length; i++) {
+    for (var key in sources[i]) {
+      if (sources[i].hasOwnProperty(key)) { headers[key] = sources[i][key]; }
+    }
+  }
+  return {
+    "method": endpoint.method,
+    "url": (tiles.base_url != null) ? tiles.base_url + endpoint.url : endpoint.url,
+    "headers": headers,
+    "data": endpoint.data,
+    "variable": endpoint.variable,
+    "good": endpoint.good,
+    "bad": endpoint.bad
+  };
+}
+
+//! Parses the tiles object once and resolves every button so a press is a single lookup
+//! @return {tiles, buttons} with buttons keyed by "tile:button", or null if no tiles are configured
+function loadConfig() {
+  if (config) { return config; }
+  var tiles;
+  try {
+    tiles = JSON.parse(localStorage.getItem('tiles'));
+  } catch(e) {
+    tiles = null;
+  }
+  if (tiles == null || Object.keys(tiles).length == 0 || tiles.tiles == null || tiles.tiles.length == 0) {
+    return null;
+  }
+
+  try {
+    buttonIndexes = JSON.parse(localStorage.getItem('button-indexes')) || {};
+  } catch(e) {
+    buttonIndexes = {};
+  }
+  var buttons = {};
+  for (var tileIdx = 0; tileIdx < tiles.tiles.length; tileIdx++) {
+    for (var name in tiles.tiles[tileIdx].buttons) {
+      var button = tiles.tiles[tileIdx].buttons[name];
+      if (!button) { continue; }
+      var key = tileIdx + ":" + name;
+      var resolved = resolveEndpoint(tiles, button);
+      resolved.key = key;
+      resolved.type = button.type;
+      resolved.status = button.status ? resolveEndpoint(tiles, button.status) : null;
+      buttons[key] = resolved;
+      // indexes used to be kept in the tiles object itself
+      if (!(key in buttonIndexes) && button.index != null) { buttonIndexes[key] = button.index; }
+    }
+  }
+  config = {"tiles": tiles, "buttons": buttons};
+  return config;
+}
+
+//! Drops the resolved config and button indexes, called whenever the tiles object is replaced
+function resetConfig() {
+  clearTimeout(buttonIndexTimeout);
+  buttonIndexTimeout = null;
+  config = null;
+  buttonIndexes = null;
+  localStorage.removeItem('button-indexes');
+}
 
+//! Returns the data to send for presses and advances the button's index if it cycles through several payloads
+//! @param button Resolved button, see loadConfig()
+//! @param count Presses the data stands for, the payload of the last of them is returned
+//! @return {data, index} where index is the position used, or -1 for a single payload
+function nextButtonData(button, count) {
+  if (!Array.isArray(button.data)) {
+    if (DEBUG > 1) { console.log("Button has single endpoint")}
+    return {"data": button.data, "index": -1};
+  }
+  var index = buttonIndexes[button.key] || 0;
+  if (index >= button.data.length) { index = 0; }
+  index = (index + count - 1) % button.data.length;
+  if (DEBUG > 1) { console.log("Button has multiple endpoints, using idx: " + index)}
+  buttonIndexes[button.key] = (index + 1) % button.data.length;
+  if (buttonIndexTimeout == null) {
+    buttonIndexTimeout = setTimeout(function() {
+      buttonIndexTimeout = null;
+      localStorage.setItem('button-indexes', JSON.stringify(buttonIndexes));
+    }, BUTTON_INDEX_FLUSH_DELAY);
+  }
+  return {"data": button.data[index], "index": index};
+}
+
+//! Replaces the $count template in request data, a string that is exactly "$count" becomes the number
+//! @param data Request data, objects and arrays are copied with their strings replaced
+//! @param count Presses the request stands for
+//! @return {data, templated} where templated is true if data used $count
+function applyCount(data, count) {
+  var templated = false;
+  function replace(value) {
+    if (typeof(value) == 'string') {
+      if (value.indexOf("$count") == -1) { return value; }
+      templated = true;
+      return (value == "$count") ? count : value.split("$count").join(String(count));
+    }
+    if (value == null || typeof(value) != 'object') { return value; }
+    var copy = Array.isArray(value) ? [] : {};
+    for (var key in value) {
+      if (value.hasOwnProperty(key)) { copy[key] = replace(value[key]); }
+    }
+    return copy;
+  }
+  data = replace(data);
+  return {"data": data, "templated": templated};
+}
+
+//! Sends the request of a button for one or more coalesced presses. A button whose data uses the $count
+//! template sends a single request for all of them, any other sends a request per press one after another
+//! @param button Resolved button, see loadConfig()
+//! @param count Presses coalesced by the watch, see action_window_press()
+//! @param callback Called with the data index used by the last press once its request succeeds
+//! @param failure Called with the number of presses left unsent once a request has failed for good, the watch
+//! has been sent Color.ERROR by then
+function xhrPress(button, count, callback, failure) {
+  var templated = Array.isArray(button.data) ? button.data.some(function(d) { return applyCount(d, count).templated; })
+                                              : applyCount(button.data, count).templated;
+  var presses = (templated) ? 1 : count;
+  var next = nextButtonData(button, (templated) ? count : 1);
+  if (DEBUG > 1 && count > 1) { console.log("Sending " + count + " presses as " + presses + " requests"); }
+  xhrRequest(button.method, button.url, button.headers, applyCount(next.data, count).data, 20, function() {
+    if (presses > 1) {
+      xhrPress(button, presses - 1, callback, failure);
+    } else if (callback) {
+      callback(next.index);
+    }
+  }, function() {
+    // the presses after it would go to an endpoint that has just run out of retries, so they are dropped
+    console.log("Request for " + button.url + " failed, " + (presses - 1) + " more presses not sent");
+    if (failure) { failure(presses); }
+  });
+}
+
+//! Looks up the bytes to send for an icon key, an ICON_FORMAT byte followed by a resource id, native bitmap or PNG
+//! @return Array of bytes, or null if the key is unknown
+function iconBytes(key) {
+  var icon = icons[key];
   if (icon == null) {
-    return;
+    return null;
+  }
+  if (typeof(icon) != 'string') {
+    return [IconFormat.RESOURCE, icon];
   }
+  var platform = Pebble.getActiveWatchInfo().platform;
+  if (platform == 'aplite') {
+    if (DEBUG > 1) { console.log("aplite detected, icon_size: " + 1); }
+    return [IconFormat.RESOURCE, 1];
+  }
+  // converting is done once per icon, the watch then creates the bitmap without decoding
+  if (!(key in nativeIcons)) {
+    var png = Buffer.from(icon, 'base64');
+    var native = watchSupports(Capability.NATIVE_ICONS) ? bitmap.pngToNative(png, platform) : null;
+    nativeIcons[key] = native ? [IconFormat.NATIVE].concat(native) : [IconFormat.PNG].concat(Array.prototype.slice.call(png));
+    if (DEBUG > 1) { console.log("Converted icon " + key + ", " + png.length + " byte png, " + (native ? native.length + " byte bitmap" : "kept as png")); }
+  }
+  return nativeIcons[key];
+}
 
-  uint8[ptr++] = index;
-  
-  if (DEBUG > 1) { console.log("Sending icon " + key); }
-  if (typeof(icon) == 'string') {
-    if(Pebble.getActiveWatchInfo().model.indexOf('aplite') != -1) {
-      if (DEBUG > 1) { console.log("aplite detected, icon_size: " + 1); }
-      uint8[ptr++] = 1;
-      uint8[ptr++] = 0;
-      uint8[ptr++] = 1;
-    } else {
-      var buff = Buffer.from(icon, 'base64');
-      if (DEBUG > 1) { console.log("icon_size: " + buff.length); }
-      uint8[ptr++] = buff.length & 0xff;
-      uint8[ptr++] = buff.length >> 8;
-      for (var i=0; i < buff.length; i++) {
-        uint8[ptr++] = buff[i];
-      }
+//! Unpacks the IconKeys byte array sent by the watch, a slot index followed by a null terminated key per icon
+function unpackIconKeys(iconKeys) {
+  var requests = [];
+  var ptr = 0;
+  while (ptr < iconKeys.length) {
+    var index = iconKeys[ptr++];
+    var key = "";
+    while (ptr < iconKeys.length && iconKeys[ptr] != 0) {
+      key += String.fromCharCode(iconKeys[ptr++]);
+    }
+    ptr++;
+    requests.push({"index": index, "key": key});
+  }
+  return requests;
+}
+
+//! Packs the requested icons into one batch transfer: a count, then per icon its slot index, key length, key,
+//! 16 bit size and bytes. Unknown keys are sent with a size of 0 so the watch stops waiting on them. Icons past
+//! ICON_BATCH_MAX_BYTES, or past what the watch can afford, are left out and the watch asks for them again
+//! @param requests Array of {index, key} as sent by the watch
+function packIcons(requests) {
+  if (no_transfer_lock) {return;}
+  var data = [0];
+  var maxBytes = iconBatchLimit();
+  for (var i=0; i < requests.length; i++) {
+    var bytes = iconBytes(requests[i].key) || [];
+    var entrySize = 4 + requests[i].key.length + bytes.length;
+    if (data[0] > 0 && data.length + entrySize > maxBytes) {
+      if (DEBUG > 1) { console.log("Batch full, leaving out " + (requests.length - i) + " icons"); }
+      break;
+    }
+    if (DEBUG > 1) { console.log("Sending icon " + requests[i].key + ", icon_size: " + bytes.length); }
+    data[0]++;
+    data.push(requests[i].index, requests[i].key.length);
+    for (var j=0; j < requests[i].key.length; j++) {
+      data.push(requests[i].key.charCodeAt(j));
+    }
+    data.push(bytes.length & 0xff, bytes.length >> 8);
+    for (var j=0; j < bytes.length; j++) {
+      data.push(bytes[j]);
     }
-  } else {
-    if (DEBUG > 1) { console.log("icon_size: " + 1); }
-    uint8[ptr++] = 1;
-    uint8[ptr++] = 0;
-    uint8[ptr++] = icon;
   }
-  var buffer_2 = buffer.slice(0, ptr);
-  var uint8_2 = new Uint8Array(buffer_2);
 
   if (DEBUG > 2) {
-    console.log(Array.apply([], uint8_2).join(","));
+    console.log(data.join(","));
   }
 
-  processData(buffer_2, TransferType.ICON, index);
+  processData(data, TransferType.ICON_BATCH);
 }
 
-function packTiles() {
+//! Packs a window of the tiles object and sends it to the watch
+//! @param watchHash Config hash of the window the watch holds, the transfer is skipped if it still matches
+//! @param watchTileHashes Byte array of per tile hashes the watch holds, used to send only changed tiles
+//! @param windowFirst Absolute index of the first tile to send, the window is centred on the default tile if not given
+//! @param watchBase Absolute index of the first tile the watch holds
+function packTiles(watchHash, watchTileHashes, windowFirst, watchBase, windowSize) {
   if (no_transfer_lock) {return;}
   // create a big temporary buffer as we don't know the size we will end up with yet
   var buffer = new ArrayBuffer(1000000);
@@ -199,53 +524,85 @@ function packTiles() {
   var ptr = 0;
   var payload;
   var icon_keys = [];
-  var tiles = localStorage.getItem('tiles');
-  try {
-    tiles = JSON.parse(tiles)
-  } catch(e) {
-    tiles = null;
-  }
-  if (tiles == null || Object.keys(tiles).length == 0  || tiles.tiles == null ||  tiles.tiles.length == 0) {
+  var tiles = loadConfig();
+  if (tiles == null) {
     Pebble.sendAppMessage({"TransferType": TransferType.NO_CLAY}, messageSuccessCallback, messageFailureCallback);
     return;
   } else {
-    clearTimeout(keepAliveTimeout);
-    if(tiles.keep_alive && typeof(tiles.base_url) == 'string' && tiles.base_url.length > 0) {
-      xhrKeepAlive(tiles.base_url, tiles.headers);
-    }
+    tiles = tiles.tiles;
+    keepAliveConfigure(tiles);
   }
 
-  // pack tile variables into the buffer object, incrementing our pointer each time
-  uint8[ptr++] = tiles.tiles.length;
-  uint8[ptr++] = Math.max(0, Math.min(tiles.tiles.length - 1, tiles.default_idx));
-  uint8[ptr++] = tiles.open_default;
-  for (var tileIdx in tiles.tiles) {
-    payload = tiles.tiles[tileIdx].payload;
+  // the watch holds a window of at most MAX_TILES tiles and pages through the rest as its menu scrolls, fewer
+  // if it couldn't afford that many
+  var total = Math.min(tiles.tiles.length, MAX_TOTAL_TILES);
+  var defaultIdx = Math.max(0, Math.min(total - 1, tiles.default_idx));
+  if (windowSize == null) { windowSize = MAX_TILES; }
+  if (windowFirst == null) { windowFirst = defaultIdx - (windowSize >> 1); }
+  var first = Math.max(0, Math.min(windowFirst, total - windowSize));
+  var tileList = tiles.tiles.slice(first, Math.min(total, first + windowSize));
+  tileWindowSent = tileList.length;
+
+  // pack tile variables into the buffer object, incrementing our pointer each time, see data_tile_read_header()
+  var header = [
+    total & 0xff, total >> 8,
+    first & 0xff, first >> 8,
+    tileList.length,
+    defaultIdx & 0xff, defaultIdx >> 8,
+    tiles.open_default ? 1 : 0
+  ];
+  for (var i = 0; i < header.length; i++) {
+    uint8[ptr++] = header[i];
+  }
+  var tileOffsets = [];
+  var tileHashes = [];
+  for (var tileIdx = 0; tileIdx < tileList.length; tileIdx++) {
+    payload = tileList[tileIdx].payload;
 
     // build an array of icon_keys, give default tile's icons priority if open_default is set
-    if (tileIdx == tiles.default_idx && tiles.open_default) {
+    if (first + tileIdx == defaultIdx && tiles.open_default) {
       icon_keys = payload.icon_keys.concat(icon_keys);
     } else {
       icon_keys = icon_keys.concat(payload.icon_keys);
     }
 
-    uint8[ptr++] = toGColor(payload.color);
-    uint8[ptr++] = toGColor(payload.highlight);
+    tileOffsets.push(ptr);
+    ptr = packTile(uint8, tileList[tileIdx], ptr);
+    tileHashes.push(fnv1a(uint8, tileOffsets[tileIdx], ptr));
+  }
+  tileOffsets.push(ptr);
 
-    for (var idx in payload.texts) {
-      t = payload.texts[idx];
-      uint8[ptr++] = t.length + 1;
-      ptr = packString(uint8, t, ptr);
-    }
+  var hash = configHash(header, tileHashes);
+  if (DEBUG > 1) { console.log("Tile hash: " + hash + ", watch hash: " + watchHash); }
+  if (watchHash != null && (watchHash >>> 0) === hash) {
+    Pebble.sendAppMessage({"TransferType": TransferType.CACHE_VALID}, messageSuccessCallback, messageFailureCallback);
+    return;
+  }
 
-    for (var idx in payload.icon_keys) {
-      k = payload.icon_keys[idx];
-      uint8[ptr++] = k.length + 1;
-      ptr = packString(uint8, k, ptr);
+  var tileIndexes = [];
+  for (var i = 0; i < tileList.length; i++) { tileIndexes.push(i); }
+  var encoded = encodeTiles(tileList, tileIndexes, uint8, tileOffsets, false);
+  var full = (encoded) ? [tileFormat()].concat(header, encoded) : null;
+  // a smaller window leaves the watch room to decode it and keeps string tables within their 16 bit offsets, a
+  // delta is never larger than the full window. A single tile always fits a table
+  if ((!full || full.length > tileBytesLimit()) && tileList.length > 1) {
+    if (DEBUG > 1) { console.log("Tiles need " + (full ? full.length : "over 64K") + " bytes of " + tileBytesLimit() + ", halving the window"); }
+    packTiles(watchHash, watchTileHashes, windowFirst, watchBase, tileList.length >> 1);
+    return;
+  }
+
+  // the watch already holds tiles, send only those whose hash differs if that is smaller than a full transfer
+  if (watchTileHashes != null) {
+    var delta = packTileDelta(tileList, uint8, header, hash, tileOffsets, tileHashes, watchTileHashes, first, watchBase || 0);
+    if (delta.length < full.length) {
+      if (DEBUG > 1) { console.log("Sending tile delta, " + delta.length + " of " + full.length + " bytes"); }
+      processData(delta, TransferType.TILE_DELTA);
+      return;
     }
   }
+
   // Aplite doesn't have the memory capacity to support external icons
-  if (!Pebble.getActiveWatchInfo().model.indexOf('aplite') != -1) {
+  if (!APLITE) {
     // Generate a unique list of icon_keys and pack as many as the icon buffer can store without looping to 
     // send alongside the tile data. This is just to try and speed up icon download a little on initial app open
     icon_keys = icon_keys.filter(function(v, i, s) {return (s.indexOf(v) === i); });
@@ -253,24 +610,283 @@ function packTiles() {
     var unique_keys_slice = icon_keys.slice(0, ICON_BUFFER_SIZE)
     for (var keyIdx in unique_keys_slice) {
       key = unique_keys_slice[keyIdx]
-      uint8[ptr++] = key.length + 1;
-      ptr = packString(uint8, key, ptr);
+      full.push(key.length + 1);
+      for (var c = 0; c < key.length; c++) { full.push(key.charCodeAt(c)); }
+      full.push(0);
     }
   }
-  
-  // We now know the size of our buffer thanks to ptr, slice our temp to create a correctly sized final buffer.
-  var buffer_2 = buffer.slice(0,ptr);
-  var uint8_2 = new Uint8Array(buffer_2);
 
+  if (DEBUG > 1) { console.log("Tile format " + tileFormat() + ", " + full.length + " bytes, " + (ptr + 1) + " with inline strings"); }
   if (DEBUG > 2) {
     for (var key in payload)
       console.log(key + ": " + payload[key]);
-    console.log(Array.apply([], uint8_2).join(","));
+    console.log(full.join(","));
+  }
+
+  processData(full, TransferType.TILE);
+}
+
+
+//! Packs which buttons of a tile coalesce presses, bit n is set for the nth of ButtonTypes
+function coalesceFlags(tile) {
+  var flags = 0;
+  for (var i = 0; i < ButtonTypes.length; i++) {
+    if (tile.buttons && tile.buttons[ButtonTypes[i]] && tile.buttons[ButtonTypes[i]].coalesce) { flags |= 1 << i; }
+  }
+  return flags;
+}
+
+/**
+ * Packs a single tile payload, the watch hashes exactly these bytes, see data_tile_decode()
+ * @param {Uint8Array} uint8Array
+ * @param {Object} tile
+ * @param {int} ptr
+ * @return {int} ptr after the tile
+ */
+function packTile(uint8Array, tile, ptr) {
+  var payload = tile.payload;
+  uint8Array[ptr++] = toGColor(payload.color);
+  uint8Array[ptr++] = toGColor(payload.highlight);
+  uint8Array[ptr++] = coalesceFlags(tile);
+
+  for (var idx in payload.texts) {
+    var t = payload.texts[idx];
+    uint8Array[ptr++] = t.length + 1;
+    ptr = packString(uint8Array, t, ptr);
+  }
+
+  for (var idx in payload.icon_keys) {
+    var k = payload.icon_keys[idx];
+    uint8Array[ptr++] = k.length + 1;
+    ptr = packString(uint8Array, k, ptr);
+  }
+  return ptr;
+}
+
+/**
+ * Hash over the tile blob header and each tile hash, replicates data_tile_array_rehash()
+ * @param {int[]} header
+ * @param {int[]} tileHashes
+ * @return {int}
+ */
+function configHash(header, tileHashes) {
+  var bytes = new Uint8Array(header.length + tileHashes.length * 4);
+  bytes.set(header);
+  for (var i = 0; i < tileHashes.length; i++) {
+    packUint32(bytes, tileHashes[i], header.length + i * 4);
+  }
+  return fnv1a(bytes, 0, bytes.length);
+}
+
+/**
+ * Packs the tiles that differ from what the watch holds, replicates data_tile_array_patch_tiles()
+ * Layout: format, the header of a full blob, the first index of the window the watch holds (uint16 LE), config
+ * hash (uint32 LE), change_count, then the changed tiles as encoded by encodeTiles() with each tile prefixed by
+ * its index within the window. The watch keeps every other tile from the same absolute index of its window
+ * @param {Object[]} tileList
+ * @param {Uint8Array} uint8Array Inline encoding of every tile
+ * @param {int[]} header
+ * @param {int} hash Config hash of the full tile blob
+ * @param {int[]} tileOffsets Start of each tile in uint8Array, plus the end of the last tile
+ * @param {int[]} tileHashes
+ * @param {int[]} watchTileHashes Byte array of little endian hashes held by the watch
+ * @param {int} first Absolute index of the first tile of tileList
+ * @param {int} watchBase Absolute index of the first tile held by the watch
+ * @return {int[]}
+ */
+function packTileDelta(tileList, uint8Array, header, hash, tileOffsets, tileHashes, watchTileHashes, first, watchBase) {
+  var changed = [];
+  for (var i = 0; i < tileHashes.length; i++) {
+    var j = first + i - watchBase;
+    var watchTileHash = (j >= 0 && j * 4 + 3 < watchTileHashes.length) ? unpackUint32(watchTileHashes, j * 4) : null;
+    if (watchTileHash !== tileHashes[i]) {
+      changed.push(i);
+    }
+  }
+  if (DEBUG > 1) { console.log("Changed tiles: " + JSON.stringify(changed)); }
+
+  var hashBytes = new Uint8Array(4);
+  packUint32(hashBytes, hash, 0);
+  return [tileFormat()].concat(header, [watchBase & 0xff, watchBase >> 8], Array.prototype.slice.call(hashBytes), [changed.length],
+    encodeTiles(tileList, changed, uint8Array, tileOffsets, true));
+}
+
+//! TILE_FORMAT, or TILE_FORMAT_INLINE for a watch that can't read string tables
+function tileFormat() {
+  return watchSupports(Capability.TILE_TABLE) ? TILE_FORMAT : TILE_FORMAT_INLINE;
+}
+
+/**
+ * Encodes tiles in TILE_FORMAT. TILE_FORMAT_INLINE writes each tile as it is hashed, TILE_FORMAT_TABLE writes
+ * a menu and a button string table followed by tiles whose strings are offsets into them, see data_tile_decode()
+ * @param {Object[]} tileList
+ * @param {int[]} indexes Tiles of tileList to encode
+ * @param {Uint8Array} uint8Array Inline encoding of every tile
+ * @param {int[]} tileOffsets Start of each tile in uint8Array, plus the end of the last tile
+ * @param {boolean} withIndex Prefix each tile with its index, as a delta does
+ * @return {int[]} null if a string table outgrows its 16 bit offsets
+ */
+function encodeTiles(tileList, indexes, uint8Array, tileOffsets, withIndex) {
+  var out = [];
+  if (tileFormat() == TILE_FORMAT_INLINE) {
+    for (var i = 0; i < indexes.length; i++) {
+      if (withIndex) { out.push(indexes[i]); }
+      var tile = uint8Array.subarray(tileOffsets[indexes[i]], tileOffsets[indexes[i] + 1]);
+      for (var j = 0; j < tile.length; j++) { out.push(tile[j]); }
+    }
+    return out;
+  }
+
+  // titles and their icons go in a menu table the watch expands straight away, every other string in a
+  // button table it only expands when a tile is opened
+  var menuTable = stringTable(), buttonTable = stringTable();
+  var tileStrings = [];
+  for (var i = 0; i < indexes.length; i++) {
+    var payload = tileList[indexes[i]].payload;
+    tileStrings.push(payload.texts.concat(payload.icon_keys).map(function(str, j) {
+      return (isMenuString(j) ? menuTable : buttonTable).intern(str);
+    }));
+  }
+
+  if (!menuTable.fits() || !buttonTable.fits()) { return null; }
+  out = out.concat(menuTable.encode(), buttonTable.encode());
+  for (var i = 0; i < indexes.length; i++) {
+    var payload = tileList[indexes[i]].payload;
+    if (withIndex) { out.push(indexes[i]); }
+    out.push(toGColor(payload.color), toGColor(payload.highlight), coalesceFlags(tileList[indexes[i]]));
+    for (var j = 0; j < tileStrings[i].length; j++) {
+      out.push(tileStrings[i][j] & 0xff);
+      if ((isMenuString(j) ? menuTable : buttonTable).wide()) { out.push(tileStrings[i][j] >> 8); }
+    }
+  }
+  return out;
+}
+
+/**
+ * @param {int} index Position of a string within a tile, its texts followed by its icon keys
+ * @return {boolean} true for the title and title icon, which the watch menu needs up front
+ */
+function isMenuString(index) {
+  return index % TILE_STRING_COUNT == TILE_TITLE;
+}
+
+/**
+ * Collects strings into a table holding every distinct string once, in order of first use
+ * @return {Object} intern(str) returns the offset of str, fits() whether the table fits its uint16 size and
+ *   offsets, encode() returns the table as the watch reads it in data_tile_table_read(): flags, size (uint16 LE),
+ *   stored size (uint16 LE) and the stored bytes
+ */
+function stringTable() {
+  var bytes = [];
+  var offsets = {};
+  return {
+    "intern": function(str) {
+      if (!(str in offsets)) {
+        offsets[str] = bytes.length;
+        for (var c = 0; c < str.length; c++) { bytes.push(str.charCodeAt(c) & 0xff); }
+        bytes.push(0);
+      }
+      return offsets[str];
+    },
+    "wide": function() { return bytes.length > 0xff; },
+    "fits": function() { return bytes.length <= 0xffff; },
+    "encode": function() {
+      var flags = this.wide() ? TILE_TABLE_WIDE : 0;
+      var stored = bytes;
+      if (TILE_COMPRESSION && watchSupports(Capability.TILE_COMPRESSION)) {
+        var compressed = compressTable(bytes);
+        if (compressed.length < bytes.length) {
+          flags |= TILE_TABLE_COMPRESSED;
+          stored = compressed;
+        }
+      }
+      if (DEBUG > 1) { console.log("String table: " + bytes.length + " bytes, " + stored.length + " stored"); }
+      return [flags, bytes.length & 0xff, bytes.length >> 8, stored.length & 0xff, stored.length >> 8].concat(stored);
+    }
+  };
+}
+
+/**
+ * LZ compresses a string table so the watch can expand it straight into its string pool, see
+ * data_tile_table_expand(). A token below 0x80 is followed by token + 1 literal bytes, any other token copies
+ * (token & 0x7f) + 3 bytes from a little endian uint16 distance back in the output
+ * @param {int[]} bytes
+ * @return {int[]}
+ */
+function compressTable(bytes) {
+  var MIN_MATCH = 3, MAX_MATCH = 0x7f + MIN_MATCH, MAX_LITERALS = 0x80;
+  var out = [];
+  var literals = [];
+  // recent positions of each 3 byte prefix, bounded so compression stays cheap on the phone
+  var positions = {};
+  function flushLiterals() {
+    while (literals.length > 0) {
+      var run = literals.splice(0, MAX_LITERALS);
+      out.push(run.length - 1);
+      out = out.concat(run);
+    }
+  }
+  function remember(i) {
+    if (i + MIN_MATCH > bytes.length) { return; }
+    var prefix = bytes[i] | bytes[i + 1] << 8 | bytes[i + 2] << 16;
+    var list = positions[prefix] || (positions[prefix] = []);
+    list.push(i);
+    if (list.length > 16) { list.shift(); }
   }
 
-  processData(buffer_2, TransferType.TILE);
+  var i = 0;
+  while (i < bytes.length) {
+    var bestLength = 0, bestDistance = 0;
+    if (i + MIN_MATCH <= bytes.length) {
+      var candidates = positions[bytes[i] | bytes[i + 1] << 8 | bytes[i + 2] << 16] || [];
+      for (var c = candidates.length - 1; c >= 0; c--) {
+        var length = 0;
+        while (length < MAX_MATCH && i + length < bytes.length && bytes[candidates[c] + length] == bytes[i + length]) {
+          length++;
+        }
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = i - candidates[c];
+        }
+      }
+    }
+    if (bestLength >= MIN_MATCH && bestDistance <= 0xffff) {
+      flushLiterals();
+      out.push(0x80 | (bestLength - MIN_MATCH), bestDistance & 0xff, bestDistance >> 8);
+      for (var j = 0; j < bestLength; j++) { remember(i + j); }
+      i += bestLength;
+    } else {
+      literals.push(bytes[i]);
+      remember(i);
+      i++;
+    }
+  }
+  flushLiterals();
+  return out;
 }
 
+/**
+ * Writes a uint32 to uint8Array in little endian order
+ * @param {Uint8Array} uint8Array
+ * @param {int} value
+ * @param {int} idx
+ */
+function packUint32(uint8Array, value, idx) {
+  uint8Array[idx] = value & 0xff;
+  uint8Array[idx + 1] = (value >>> 8) & 0xff;
+  uint8Array[idx + 2] = (value >>> 16) & 0xff;
+  uint8Array[idx + 3] = (value >>> 24) & 0xff;
+}
+
+/**
+ * Reads a little endian uint32 from a byte array
+ * @param {int[]} bytes
+ * @param {int} idx
+ * @return {int}
+ */
+function unpackUint32(bytes, idx) {
+  return (bytes[idx] | bytes[idx + 1] << 8 | bytes[idx + 2] << 16 | bytes[idx + 3] << 24) >>> 0;
+}
 
 /**
  * Returns a GColor8 (uint8_t) representation of a hex color code, replicates GColorFromHEX()
@@ -291,6 +907,23 @@ function toGColor(hexString) {
     return (parseInt(hex, 16) >> 6).toString(2).padStart(2, '0')}).join(''), 2); 
 }
 
+/**
+ * 32 bit FNV-1a hash over a byte range, replicates data_hash()
+ * @param {Uint8Array} uint8Array
+ * @param {int} start
+ * @param {int} end
+ * @return {int}
+ */
+function fnv1a(uint8Array, start, end) {
+  var hash = 0x811c9dc5;
+  for (var i = start; i < end; i++) {
+    hash ^= uint8Array[i];
+    // hash * 16777619 without overflowing the 53 bit mantissa
+    hash += (hash << 1) + (hash << 4) + (hash << 7) + (hash << 8) + (hash << 24);
+  }
+  return hash >>> 0;
+}
+
 /**
  * Assigns each byte of a string to uint8Array, including null terminator
  * @param {Uint8Array} uint8Array
@@ -302,16 +935,85 @@ function packString(uint8Array, str, idx) {
   for (var c=0; c < str.length; c++) {
     uint8Array[c+idx] = str.charCodeAt(c);
   }
-  uint8Array[c+idx+1] = 0x00;
+  uint8Array[c+idx] = 0x00;
   if (DEBUG > 2) {
     console.log("String: " + str + ", Length: " + str.length + ", c + idx: " + (c + idx) + ", uint8Length: " + uint8Array.length);
   }
   return c+idx+1
 }
 
+//! Sends one message of a transfer, counting failures against its transfer type
+function transferSend(dict, success, failure) {
+  var stats = transferStatsOf(dict.TransferType);
+  Pebble.sendAppMessage(dict, success, function(e, error) {
+    stats.failures++;
+    if (failure) { failure(e, error); }
+  });
+}
+
+function transferStatsOf(type) {
+  if (!transferStats[type]) {
+    transferStats[type] = {"transfers": 0, "bytes": 0, "lastMs": 0, "maxMs": 0, "failures": 0, "refused": 0};
+  }
+  return transferStats[type];
+}
+
+//! Records the end to end time of a transfer started by processData(), once the watch has acknowledged
+//! its complete message. A tile transfer also ends the handshake
+//! @param array The transfer, ignored if it has since been cancelled or replaced
+function transferDone(type, array) {
+  if (array.cancelled || transfersInFlight[type] !== array || transferStarts[type] == null) { return; }
+  var bytes = array.length;
+  var elapsed = Date.now() - transferStarts[type];
+  delete transferStarts[type];
+  delete transfersInFlight[type];
+  var stats = transferStatsOf(type);
+  stats.transfers++;
+  stats.bytes += bytes;
+  stats.lastMs = elapsed;
+  stats.maxMs = Math.max(stats.maxMs, elapsed);
+  if (type == TransferType.TILE || type == TransferType.TILE_DELTA) { handshakeMark("tilesLoaded"); }
+  if (DEBUG > 0) { console.log("Transfer of type " + type + ", " + bytes + " bytes in " + elapsed + " ms"); }
+}
+
+//! Drops a transfer the watch has refused, whatever is still to be sent of it is not
+//! @param type TransferType of the transfer
+//! @param size Bytes refused, see refusedLimit()
+function transferRefused(type, size) {
+  if (transfersInFlight[type]) { transferCancel(type, transfersInFlight[type]); }
+  delete transferStarts[type];
+  transferStatsOf(type).refused++;
+  var kind = (type == TransferType.ICON_BATCH) ? "icon" : "tile";
+  refusedBytes[kind] = size;
+  if (DEBUG > 0) { console.log("Watch refused " + size + " bytes of type " + type + ", " + watchLimits.heapFree + " bytes free"); }
+}
+
+//! Stops sending a transfer, its queued retries and complete message go nowhere
+function transferCancel(type, array) {
+  array.cancelled = true;
+  if (transfersInFlight[type] !== array) { return; }
+  delete transfersInFlight[type];
+  delete transferStarts[type];
+}
+
+//! Sends a failed part of a transfer again after TRANSFER_RETRY_DELAY, unless it has failed
+//! TRANSFER_MAX_FAILURES times in a row
+//! @param retry Sends the part again
+function transferRetry(type, array, retry) {
+  if (array.cancelled) { return; }
+  array.failures = (array.failures || 0) + 1;
+  if (array.failures > TRANSFER_MAX_FAILURES) {
+    if (DEBUG > 0) { console.log("Giving up on transfer of type " + type + " after " + TRANSFER_MAX_FAILURES + " failed sends"); }
+    transferCancel(type, array);
+    return;
+  }
+  setTimeout(retry, TRANSFER_RETRY_DELAY);
+}
+
 function sendChunk(array, index, arrayLength, type) {
+  if (array.cancelled) { return; }
   // Determine the next chunk size, there needs to be 5 bits of padding for every key sent to stay under threshold
-  var chunkSize = MAX_CHUNK_SIZE - (24 * 2);
+  var chunkSize = chunkSizeLimit() - (24 * 2);
   if(arrayLength - index < chunkSize) {
     // Will only need one more chunk
     chunkSize = arrayLength - index;
@@ -327,8 +1029,10 @@ function sendChunk(array, index, arrayLength, type) {
   };
 
   // Send the chunk
-  Pebble.sendAppMessage(dict, function() {
+  transferSend(dict, function() {
     // Success
+    if (array.cancelled) { return; }
+    array.failures = 0;
     index += chunkSize;
 
     if(index < arrayLength) {
@@ -336,32 +1040,113 @@ function sendChunk(array, index, arrayLength, type) {
       sendChunk(array, index, arrayLength, type);
     } else {
       // Done
-      Pebble.sendAppMessage({
+      transferSend({
         'TransferComplete': arrayLength,
-        'TransferType': type}, null, function() {
+        'TransferType': type}, function() { transferDone(type, array); }, function() {
           if (DEBUG > 1) { console.log('Failed to send complete message, reattempting'); }
-          setTimeout(1000, function() {sendChunk(array, index, arrayLength, type);});
+          transferRetry(type, array, function() {sendChunk(array, index, arrayLength, type);});
         });
     }
   }, function(obj, error) {
     if (DEBUG > 1) { console.log('Failed to send chunk, reattempting'); }
-    setTimeout(1000, function() {sendChunk(array, index, arrayLength, type);});
+    transferRetry(type, array, function() {sendChunk(array, index, arrayLength, type);});
   });
 }
 
-function transmitData(array, type) {
+//! Sends array keeping up to TRANSFER_WINDOW chunks in flight instead of waiting on each acknowledgement.
+//! Chunks carry a sequence number so only the ones that fail are resent, and the complete message carries
+//! the chunk count so the watch can check nothing went missing. Falls back to stop-and-wait if a chunk keeps failing
+//! @param chunkSize Bytes per chunk, the last chunk holds the remainder
+function sendWindow(array, type, chunkSize) {
+  var chunkCount = Math.ceil(array.length / chunkSize);
+  var next = 0, inFlight = 0, acked = 0;
+  var resend = [], retries = [];
+  var aborted = false, completeSent = false;
+
+  function sendComplete() {
+    if (array.cancelled) { return; }
+    transferSend({
+      'TransferComplete': array.length,
+      'TransferSeq': chunkCount,
+      'TransferType': type}, function() { transferDone(type, array); }, function() {
+        if (DEBUG > 1) { console.log('Failed to send complete message, reattempting'); }
+        transferRetry(type, array, sendComplete);
+      });
+  }
+
+  function send(seq) {
+    var index = seq * chunkSize;
+    var size = Math.min(chunkSize, array.length - index);
+    inFlight++;
+    transferSend({
+      'TransferChunk': array.slice(index, index + size),
+      'TransferChunkLength': size,
+      'TransferIndex': index,
+      'TransferSeq': seq,
+      'TransferType': type
+    }, function() {
+      inFlight--;
+      acked++;
+      array.failures = 0;
+      fill();
+    }, function() {
+      inFlight--;
+      if (aborted) { return; }
+      retries[seq] = (retries[seq] || 0) + 1;
+      if (retries[seq] > TRANSFER_RETRIES) {
+        if (DEBUG > 1) { console.log('Chunk ' + seq + ' keeps failing, falling back to stop-and-wait'); }
+        aborted = true;
+        setTimeout(function() {transmitData(array, type, 1);}, TRANSFER_RETRY_DELAY);
+        return;
+      }
+      if (DEBUG > 1) { console.log('Failed to send chunk ' + seq + ', reattempting'); }
+      setTimeout(function() {
+        resend.push(seq);
+        fill();
+      }, TRANSFER_RETRY_DELAY);
+    });
+  }
+
+  function fill() {
+    if (aborted || completeSent || array.cancelled) { return; }
+    while (inFlight < TRANSFER_WINDOW && (resend.length > 0 || next < chunkCount)) {
+      send((resend.length > 0) ? resend.shift() : next++);
+    }
+    if (acked == chunkCount) {
+      completeSent = true;
+      sendComplete();
+    }
+  }
+
+  if (DEBUG > 0) { console.log("Sending " + chunkCount + " chunks of " + chunkSize + ", window " + TRANSFER_WINDOW); }
+  fill();
+}
+
+//! Sends array to the watch as a chunked transfer
+//! @param windowSize Chunks to keep in flight, defaults to TRANSFER_WINDOW. 1 uses stop-and-wait
+function transmitData(array, type, windowSize) {
+  if (array.cancelled) { return; }
   var index = 0;
   var arrayLength = array.length;
+  windowSize = watchSupports(Capability.TRANSFER_WINDOW) ? (windowSize || TRANSFER_WINDOW) : 1;
+  // windowed chunks carry an extra key
+  var windowChunkSize = chunkSizeLimit() - (24 * 3);
+  var windowed = windowSize > 1 && Math.ceil(arrayLength / windowChunkSize) <= TRANSFER_MAX_CHUNKS;
   
   // Transmit the length for array allocation
-  Pebble.sendAppMessage({
+  transferSend({
     'TransferLength': arrayLength,
     'TransferType' : type}, function(e) {
     // Success, begin sending chunks
-    sendChunk(array, index, arrayLength, type);
+    array.failures = 0;
+    if (windowed) {
+      sendWindow(array, type, windowChunkSize);
+    } else {
+      sendChunk(array, index, arrayLength, type);
+    }
   }, function(e) {
     if (DEBUG > 1) { console.log('Failed to send data length to Pebble, reattempting'); }
-    setTimeout(1000, function() {transmitData(array, type);});
+    transferRetry(type, array, function() {transmitData(array, type, windowSize);});
   });
 }
 
@@ -372,7 +1157,10 @@ function processData(data, type) {
   for(var i = 0; i < byteArray.byteLength; i++) {
     array.push(byteArray[i]);
   }
-  // Send chunks to Pebble
+  // Send chunks to Pebble, a transfer of the same type still under way would write into this one's buffer
+  if (transfersInFlight[type]) { transferCancel(type, transfersInFlight[type]); }
+  transferStarts[type] = Date.now();
+  transfersInFlight[type] = array;
   transmitData(array, type);
 }
 
@@ -396,7 +1184,8 @@ function downloadImage(i, callback) {
   // }
 }
 
-function xhrRequest(method, url, headers, data, maxRetries, callback) {
+//! @param failure Called once the request has failed for good and the watch has been sent Color.ERROR
+function xhrRequest(method, url, headers, data, maxRetries, callback, failure) {
   if (typeof(maxRetries) == 'number'){
     maxRetries = [maxRetries, maxRetries];
   }
@@ -412,6 +1201,7 @@ function xhrRequest(method, url, headers, data, maxRetries, callback) {
         }
       } catch(e) {
         Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+        if (failure) { failure(); }
         return;
       }
       Pebble.sendAppMessage({"TransferType": TransferType.ACK}, messageSuccessCallback, messageFailureCallback);
@@ -420,6 +1210,7 @@ function xhrRequest(method, url, headers, data, maxRetries, callback) {
     } else {
       // Pebble.sendAppMessage({"TransferType": TransferType.ERROR}, messageSuccessCallback, messageFailureCallback);
       Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+      if (failure) { failure(); }
     }
   };
 
@@ -431,13 +1222,16 @@ function xhrRequest(method, url, headers, data, maxRetries, callback) {
   request.onerror = function(e) { 
     if (DEBUG > 1 ) { console.log("Timed out"); }
     Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+    if (failure) { failure(); }
   };
   request.ontimeout  = function(e) { 
     if (DEBUG > 1 ) { console.log("Timed out"); }
+    keepAlive.stats.timeouts++;
     if (maxRetries[1] > 0) {
-      setTimeout(function() {xhrRequest(method, url, headers, data, [maxRetries[0], maxRetries[1] - 1], callback)},  307 * (maxRetries[0] - maxRetries[1]));
+      setTimeout(function() {xhrRequest(method, url, headers, data, [maxRetries[0], maxRetries[1] - 1], callback, failure)},  307 * (maxRetries[0] - maxRetries[1]));
     } else {
       Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+      if (failure) { failure(); }
     }
   };
   request.open(method, url);
@@ -448,27 +1242,102 @@ function xhrRequest(method, url, headers, data, maxRetries, callback) {
       request.setRequestHeader(key, headers[key]);
     }
   }
+  keepAliveRequest();
   request.send(JSON.stringify(data));  
 }				
 
+//! Identifies the requests to a status endpoint that one response answers, headers included as they may carry
+//! different credentials
+//! @return {string}
+function endpointKey(method, url, headers, data, variable) {
+  var sortedHeaders = Object.keys(headers || {}).sort().map(function(name) { return [name, headers[name]]; });
+  return JSON.stringify([method, url, sortedHeaders, data, variable]);
+}
+
+//! Polls a status endpoint until it reports a good or bad value and shows the result on the watch. Polls of the
+//! same endpoint share one loop, every press waiting on it is answered by its responses
+//! @param good Value of variable that shows Color.GOOD
+//! @param bad Value of variable that shows Color.BAD
+//! @param maxRetries Polls before giving up. A press joining a running loop keeps the loop's deadline, so a
+//!   stream of presses can't keep it going forever
 function xhrStatus(method, url, headers, data, variable, good, bad, maxRetries) {
-  var request = new XMLHttpRequest();
+  var key = endpointKey(method, url, headers, data, variable);
+  var poll = statusPolls[key];
+  if (!poll) {
+    poll = statusPolls[key] = {"method": method, "url": url, "headers": headers, "data": data, "variable": variable,
+                               "waiters": [], "retries": [maxRetries, maxRetries], "seq": 0, "timer": null, "request": null};
+  } else if (DEBUG > 1) {
+    console.log("Joining status poll of " + url + ", " + (poll.waiters.length + 1) + " waiting");
+  }
+  // a response to a poll sent before this press may predate its action, so only later polls answer it
+  poll.waiters.push({"good": good, "bad": bad, "after": poll.seq});
+  if (!poll.request && poll.timer == null) { statusPollSend(key); }
+}
 
-  if (typeof(maxRetries) == 'number'){
-    maxRetries = [maxRetries, maxRetries];
+//! Ends a status poll loop, showing color on the watch for anyone still waiting
+function statusPollFinish(key, color) {
+  var poll = statusPolls[key];
+  clearTimeout(poll.timer);
+  delete statusPolls[key];
+  if (color != null) {
+    Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": color }, messageSuccessCallback, messageFailureCallback);
   }
+}
 
-  repeatCall = function() {
-    if (maxRetries[1] > 0) {
-      setTimeout(function() {xhrStatus(method, url, headers, data, variable, good, bad, [maxRetries[0], maxRetries[1] - 1])}, 100 * (maxRetries[0] - maxRetries[1]));
-    } else {
-      Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+//! Schedules the next poll of a loop with linear backoff, or ends it with Color.ERROR once out of retries
+function statusPollRepeat(key) {
+  var poll = statusPolls[key];
+  poll.request = null;
+  if (poll.retries[1] > 0) {
+    poll.retries[1]--;
+    poll.timer = setTimeout(function() {
+      poll.timer = null;
+      statusPollSend(key);
+    }, 100 * (poll.retries[0] - poll.retries[1]));
+  } else {
+    statusPollFinish(key, Color.ERROR);
+  }
+}
+
+//! Answers the presses waiting on a poll loop with a response value, each color is sent once however many
+//! presses it answers. The loop carries on while any press is still waiting
+//! @param seq Sequence number of the poll that returned value
+function statusPollResolve(key, seq, value) {
+  var poll = statusPolls[key];
+  var colors = [];
+  var waiting = [];
+  for (var i = 0; i < poll.waiters.length; i++) {
+    var waiter = poll.waiters[i];
+    var color = null;
+    if (seq > waiter.after) {
+      if (value === waiter.good) { color = Color.GOOD; }
+      else if (value === waiter.bad) { color = Color.BAD; }
     }
-  };
+    if (color == null) { waiting.push(waiter); }
+    else if (colors.indexOf(color) == -1) { colors.push(color); }
+  }
+  poll.waiters = waiting;
+  for (var i = 0; i < colors.length; i++) {
+    Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": colors[i] }, messageSuccessCallback, messageFailureCallback);
+  }
+  if (waiting.length == 0) {
+    statusPollFinish(key, null);
+  } else {
+    statusPollRepeat(key);
+  }
+}
+
+//! Fetches the value of a status variable once
+//! @param endpoint Object with method, url, headers, data and variable, see resolveEndpoint()
+//! @param callback Called with (error, value), error is null, "retry" for failures worth polling again or
+//!   "parse" if the response can't be read
+//! @return The XMLHttpRequest
+function xhrStatusValue(endpoint, callback) {
+  var request = new XMLHttpRequest();
 
   request.ontimeout = request.onerror = function(e) { 
     if (DEBUG > 1 ) { console.log("Timed out"); }
-    repeatCall();
+    callback("retry");
   };
 
   request.onload = function() {
@@ -476,7 +1345,7 @@ function xhrStatus(method, url, headers, data, variable, good, bad, maxRetries)
       var returnData = {};
       try {
         returnData = JSON.parse(this.responseText);
-        var variable_split = variable.split(".")
+        var variable_split = endpoint.variable.split(".")
         for (var j in variable_split) {
           returnData = returnData[variable_split[j]];
         }
@@ -484,65 +1353,186 @@ function xhrStatus(method, url, headers, data, variable, good, bad, maxRetries)
           console.log("Response data: " + JSON.stringify(returnData));
         }
       } catch(e) {
-        Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.ERROR }, messageSuccessCallback, messageFailureCallback);
+        callback("parse");
         return;
       }
-      if (DEBUG > 1) { 
-        console.log("Status: " + this.status);
-        console.log("result: " + returnData + " maxRetries: " + maxRetries[1])
-      }
-
-      switch(returnData) {
-        case good:
-          Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.GOOD }, messageSuccessCallback, messageFailureCallback);
-          break;
-        case bad:
-          Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": Color.BAD }, messageSuccessCallback, messageFailureCallback);
-          break;
-        default:
-          repeatCall();
-      }
-
+      if (DEBUG > 1) { console.log("Status: " + this.status); }
+      callback(null, returnData);
     } else {
-        repeatCall();
+      callback("retry");
     }
   };
 
   if (DEBUG > 1) {
-    console.log("URL: " + url);
-    console.log("Method: " + method);
-    console.log("Data: " + JSON.stringify(data));
+    console.log("URL: " + endpoint.url);
+    console.log("Method: " + endpoint.method);
+    console.log("Data: " + JSON.stringify(endpoint.data));
   }
 
-  request.open(method, url);
+  request.open(endpoint.method, endpoint.url);
   request.timeout = 4000;
-  for (var key in headers) {
-    if(headers.hasOwnProperty(key)) {
-      if (DEBUG > 1) { console.log("Setting header: " + key + ": " + headers[key]); }
-      request.setRequestHeader(key, headers[key]);
+  for (var key in endpoint.headers) {
+    if(endpoint.headers.hasOwnProperty(key)) {
+      if (DEBUG > 1) { console.log("Setting header: " + key + ": " + endpoint.headers[key]); }
+      request.setRequestHeader(key, endpoint.headers[key]);
     }
   }
-  request.send(JSON.stringify(data));  
-}				
+  keepAliveRequest();
+  request.send(JSON.stringify(endpoint.data));
+  return request;
+}
 
-//! Issues a dud XHR on a timer, this is to work around battery saving optimisations on android
+//! Sends one poll of a status loop
+function statusPollSend(key) {
+  var poll = statusPolls[key];
+  var seq = ++poll.seq;
+  poll.request = xhrStatusValue(poll, function(error, value) {
+    if (error == "parse") {
+      statusPollFinish(key, Color.ERROR);
+    } else if (error) {
+      statusPollRepeat(key);
+    } else {
+      if (DEBUG > 1) { console.log("result: " + value + " maxRetries: " + poll.retries[1] + " waiting: " + poll.waiters.length) }
+      statusPollResolve(key, seq, value);
+    }
+  });
+}
+
+//! Fetches the status of every STATEFUL and STATUS_ONLY button of a tile in parallel and answers with a single
+//! TransferType.STATE message holding a Color per button, or BUTTON_STATE_UNKNOWN, see action_window_set_states()
+//! @param index Absolute index of the tile
+function packState(index) {
+  var resolved = loadConfig();
+  if (!resolved) { return; }
+  var states = [];
+  // buttons sharing a status endpoint are answered by one request
+  var fetches = {};
+  for (var i = 0; i < ButtonTypes.length; i++) {
+    states.push(BUTTON_STATE_UNKNOWN);
+    var button = resolved.buttons[index + ":" + ButtonTypes[i]];
+    var endpoint = null;
+    if (button && button.type == CallType.STATEFUL) { endpoint = button.status; }
+    if (button && button.type == CallType.STATUS_ONLY) { endpoint = button; }
+    if (!endpoint || !endpoint.variable) { continue; }
+    var key = endpointKey(endpoint.method, endpoint.url, endpoint.headers, endpoint.data, endpoint.variable);
+    if (!fetches[key]) { fetches[key] = {"endpoint": endpoint, "buttons": []}; }
+    fetches[key].buttons.push({"index": i, "good": endpoint.good, "bad": endpoint.bad});
+  }
+
+  var outstanding = Object.keys(fetches).length;
+  if (outstanding == 0) { return; }
+  if (DEBUG > 1) { console.log("Fetching " + outstanding + " states of tile " + index); }
+  Object.keys(fetches).forEach(function(key) {
+    var fetch = fetches[key];
+    xhrStatusValue(fetch.endpoint, function(error, value) {
+      for (var i = 0; i < fetch.buttons.length; i++) {
+        var button = fetch.buttons[i];
+        if (error) { states[button.index] = Color.ERROR; }
+        else if (value === button.good) { states[button.index] = Color.GOOD; }
+        else if (value === button.bad) { states[button.index] = Color.BAD; }
+      }
+      if (--outstanding == 0) {
+        Pebble.sendAppMessage({"TransferType": TransferType.STATE, "RequestIndex": index, "ButtonStates": states }, messageSuccessCallback, messageFailureCallback);
+      }
+    });
+  });
+}
+
+//! Unpacks the PerfCounters struct sent by the watch, see perf.h for the layout
+//! @param bytes PerfCounters byte array
+//! @return Object of counters
+function unpackPerf(bytes) {
+  var ptr = 0;
+  function uint16() { ptr += 2; return bytes[ptr - 2] | bytes[ptr - 1] << 8; }
+  function uint32() { ptr += 4; return unpackUint32(bytes, ptr - 4); }
+  var transferBytes = [uint32(), uint32(), uint32()];
+  var transferChunks = [uint16(), uint16(), uint16()];
+  var perf = {"transfers": {}};
+  ["tile", "delta", "icons"].forEach(function(type, i) {
+    perf.transfers[type] = {"bytes": transferBytes[i], "chunks": transferChunks[i]};
+  });
+  perf.firstTileMs = uint32();
+  perf.icons = {"hits": uint32(), "misses": uint32(), "stored": uint16()};
+  perf.outbox = {"queued": uint16(), "sent": uint16(), "failed": uint16(), "dropped": uint16()};
+  perf.heapLow = uint32();
+  var loadMs = [uint16(), uint16(), uint16()];
+  var loadMaxMs = [uint16(), uint16(), uint16()];
+  perf.windowLoadMs = {};
+  ["loading", "menu", "action"].forEach(function(window, i) {
+    perf.windowLoadMs[window] = {"last": loadMs[i], "max": loadMaxMs[i]};
+  });
+  return perf;
+}
+
+//! Sets up keep-alive pings from the config, this is to work around battery saving optimisations on android
 //! that limit connectivity when the screen is off, eventually causing timeouts for valid XHR requests
-//! @param url URL to initiate XHR GET to
-//! @param Any headers required to authenticate, probably redundant for this use case
-function xhrKeepAlive(url, headers) {
-  var request = new XMLHttpRequest();
-  request.ontimeout = request.onerror = request.onload = function() {
-    keepAliveTimeout = setTimeout(function() {
-      if (DEBUG > 2) { console.log('xhrKeepAlive fired'); }
-      xhrKeepAlive(url, headers);
-    }, 5000);
+//! @param tiles Tiles object, pings go to base_url with headers while keep_alive is set
+function keepAliveConfigure(tiles) {
+  clearTimeout(keepAlive.timeout);
+  keepAlive.timeout = null;
+  keepAlive.url = null;
+  if (!tiles.keep_alive || typeof(tiles.base_url) != 'string' || tiles.base_url.length == 0) { return; }
+  keepAlive.url = tiles.base_url;
+  keepAlive.headers = tiles.headers;
+  keepAlive.baseInterval = (tiles.keep_alive_interval > 0) ? tiles.keep_alive_interval * 1000 : KEEP_ALIVE_INTERVAL;
+  keepAliveActivity();
+}
 
+//! Called for every message from the watch app, pings run at their base interval while it is in use
+function keepAliveActivity() {
+  keepAlive.lastActive = Date.now();
+  keepAlive.interval = keepAlive.baseInterval;
+  if (keepAlive.url && keepAlive.timeout == null) {
+    keepAlive.timeout = setTimeout(keepAliveTick, keepAlive.interval);
   }
-  request.open('GET', url);
-  for (var key in headers) {
-    if(headers.hasOwnProperty(key)) {
-      if (DEBUG > 2) { console.log("Setting header: " + key + ": " + headers[key]); }
-      request.setRequestHeader(key, headers[key]);
+}
+
+//! Called as a real request goes out, it keeps the connection warm in place of the next ping
+function keepAliveRequest() {
+  var now = Date.now();
+  if (keepAlive.url && now - keepAlive.lastRequest > KEEP_ALIVE_COLD_AFTER && keepAlive.lastPing > keepAlive.lastRequest &&
+      now - keepAlive.lastPing < keepAlive.interval) {
+    keepAlive.stats.warm++;
+  }
+  keepAlive.lastRequest = now;
+}
+
+//! Sends a dud XHR GET unless a real request has gone out within the interval. The interval doubles with every
+//! ping up to KEEP_ALIVE_MAX_INTERVAL and pings stop once the watch app has been idle for KEEP_ALIVE_IDLE_TIMEOUT
+function keepAliveTick() {
+  keepAlive.timeout = null;
+  var now = Date.now();
+  if (!keepAlive.url || now - keepAlive.lastActive > KEEP_ALIVE_IDLE_TIMEOUT) {
+    if (DEBUG > 1) { console.log("Keep-alive stopped: " + JSON.stringify(keepAlive.stats)); }
+    return;
+  }
+  if (now - keepAlive.lastRequest < keepAlive.interval) {
+    keepAlive.stats.skipped++;
+    keepAlive.timeout = setTimeout(keepAliveTick, keepAlive.lastRequest + keepAlive.interval - now);
+    return;
+  }
+
+  var request = new XMLHttpRequest();
+  request.onerror = request.onload = function() {
+    keepAlive.lastPing = Date.now();
+    keepAlive.interval = Math.min(keepAlive.interval * 2, Math.max(KEEP_ALIVE_MAX_INTERVAL, keepAlive.baseInterval));
+    if (DEBUG > 2) { console.log("Keep-alive sent, next in " + keepAlive.interval + " ms: " + JSON.stringify(keepAlive.stats)); }
+    if (keepAlive.url && keepAlive.timeout == null) {
+      keepAlive.timeout = setTimeout(keepAliveTick, keepAlive.interval);
+    }
+  };
+  // a ping left hanging would never schedule the next one
+  request.ontimeout = function() {
+    keepAlive.stats.pingTimeouts++;
+    request.onload();
+  };
+  keepAlive.stats.pings++;
+  request.open('GET', keepAlive.url);
+  request.timeout = 4000;
+  for (var key in keepAlive.headers) {
+    if(keepAlive.headers.hasOwnProperty(key)) {
+      if (DEBUG > 2) { console.log("Setting header: " + key + ": " + keepAlive.headers[key]); }
+      request.setRequestHeader(key, keepAlive.headers[key]);
     }
   }
   request.send();  
@@ -553,24 +1543,46 @@ Pebble.addEventListener("appmessage", function(e) {
   var dict = e.payload;
   if (DEBUG > 1) 
     console.log('Got message: ' + JSON.stringify(dict));
+  keepAliveActivity();
+  if (dict.Capabilities != null) { watchCapabilities = dict.Capabilities; }
+  updateWatchLimits(dict);
 
   switch(dict.TransferType) {
-    case TransferType.ICON:
-      if (!(dict.hasOwnProperty("IconKey")) || !(dict.hasOwnProperty("IconIndex"))) {
+    case TransferType.ICON_BATCH:
+      if (!(dict.hasOwnProperty("IconKeys"))) {
         if (DEBUG > 1)
           console.log("didn't receive expected data");
         return;
       }
-      packIcon(dict.IconKey, dict.IconIndex);
+      packIcons(unpackIconKeys(dict.IconKeys));
     break;
     case TransferType.TILE:
-      packTiles();
+      handshakeMark("tileRequest");
+      packTiles(dict.TileHash, dict.TileHashes, dict.TileWindow, dict.TileBase);
+      break;
+    case TransferType.STATE:
+      if (dict.hasOwnProperty("RequestIndex")) { packState(dict.RequestIndex); }
+      break;
+    case TransferType.REFUSED:
+      if (dict.RefusedType != null) { transferRefused(dict.RefusedType, dict.TransferLength || 0); }
+      break;
+    case TransferType.PERF:
+      if (dict.PerfCounters) {
+        var perf = unpackPerf(dict.PerfCounters);
+        perf.keepAlive = keepAlive.stats;
+        perf.pebblekit = {"transfers": transferStats, "handshake": handshake, "watchLimits": watchLimits,
+                          "tileWindow": tileWindowSent, "iconBatchBytes": iconBatchLimit()};
+        console.log("Watch perf counters: " + JSON.stringify(perf));
+      }
       break;
     case TransferType.READY:
+      handshakeMark("watchHello");
+      if (dict.Version != null && dict.Version != PROTOCOL_VERSION) {
+        console.log("Watch protocol " + dict.Version + ", expected " + PROTOCOL_VERSION);
+      }
       if (DEBUG > 1)
         console.log("Sending Ready message");
-      Pebble.sendAppMessage({"TransferType": TransferType.READY }, messageSuccessCallback, messageFailureCallback);
-      // packTiles(tiles);
+      sendReady();
     break;
 
     case TransferType.XHR:
@@ -581,72 +1593,42 @@ Pebble.addEventListener("appmessage", function(e) {
       }
 
 
-      // find the tile that matches the id recieved from appmessage
-      var tiles = JSON.parse(localStorage.getItem('tiles'));
-      var tile = tiles.tiles[dict.RequestIndex];
-      if (tile == null) { 
-        if (DEBUG > 1) { console.log("Could not locate tile with id " + id); }
-        return;
-      }
-      var button = tile.buttons[Button[dict.RequestButton]];
+      // find the button that matches the tile index and button recieved from appmessage
+      var resolved = loadConfig();
+      var button = resolved ? resolved.buttons[dict.RequestIndex + ":" + Button[dict.RequestButton]] : null;
       if (button == null) { 
         if (DEBUG > 1) 
-          console.log('Got message: ' + JSON.stringify(dict));
+          console.log("Could not locate button " + Button[dict.RequestButton] + " of tile " + dict.RequestIndex);
         return;
       }
 
-      var url = (tiles.base_url != null) ? tiles.base_url + button.url : button.url;
-      var headers = (tiles.headers != null) ? tiles.headers : button.headers;
       switch(button.type) {
         case CallType.STATEFUL:
-          var status = button.status
-          var status_url = (tiles.base_url != null) ? tiles.base_url + status.url : status.url;
-          var status_headers = (tiles.headers != null) ? tiles.headers : status.headers;
-          var data = {};
-          if (Array.isArray(button.data)) {
-            if (button.index == null) { 
-              button.index = 0;
+          var status = button.status;
+          var presses = dict.RequestRepeat || 1;
+          xhrPress(button, presses, function() { 
+            xhrStatus(status.method, status.url, status.headers, status.data, status.variable, status.good, status.bad, 25); 
+          }, function(unsent) {
+            // presses that went through before the failure have still changed the state
+            if (unsent < presses) {
+              xhrStatus(status.method, status.url, status.headers, status.data, status.variable, status.good, status.bad, 25);
             }
-            data = button.data[button.index];
-            if (DEBUG > 1) { console.log("Button has multiple endpoints, using idx: " + button.index)}
-            button.index = (button.index + 1) % button.data.length;
-            
-          } else {
-            if (DEBUG > 1) { console.log("Button has single endpoint")}
-            data = button.data;
-          }
-          xhrRequest(button.method, url, headers, data, 20, function() { 
-            xhrStatus(status.method, status_url, status_headers, status.data, status.variable, status.good, status.bad, 25); 
           });
           break;
         case CallType.LOCAL:
-          var data = {};
-          var highlight_idx = -2;
-          if (Array.isArray(button.data)) {
-            if (button.index == null) { 
-              button.index = 0;
-            }
-            data = button.data[button.index];
-            if (DEBUG > 1) { console.log("Button has multiple endpoints, using idx: " + button.index)}
-            if (button.data.length == 2) { highlight_idx = button.index; }
-            button.index = (button.index + 1) % button.data.length;
-          } else {
-            if (DEBUG > 1) { console.log("Button has single endpoint")}
-            data = button.data;
-          }
-          if (DEBUG > 1) { console.log("highlight idx: " + highlight_idx)}
-          xhrRequest(button.method, url, headers, data, 20, function() { 
+          xhrPress(button, dict.RequestRepeat || 1, function(index) { 
+            var highlight_idx = (Array.isArray(button.data) && button.data.length == 2) ? index : -2;
+            if (DEBUG > 1) { console.log("highlight idx: " + highlight_idx)}
             Pebble.sendAppMessage({"TransferType": TransferType.COLOR, "Color": highlight_idx }, messageSuccessCallback, messageFailureCallback);
           });
           break;
         case CallType.STATUS_ONLY:
-          xhrStatus(button.method, url, headers, button.data, button.variable, button.good, button.bad, 25); 
+          xhrStatus(button.method, button.url, button.headers, button.data, button.variable, button.good, button.bad, 25); 
           break;
         default:
           if (DEBUG > 1) { console.log("Unknown type: " + button.type); }
           break;
       }
-      localStorage.setItem('tiles', JSON.stringify(tiles)); // Commits any changes to index trackers to localStorage
     break;
   }
 });
@@ -654,11 +1636,14 @@ Pebble.addEventListener("appmessage", function(e) {
 
 Pebble.addEventListener('ready', function() {
   console.log("And we're back");
-  Pebble.sendAppMessage({"TransferType": TransferType.READY }, messageSuccessCallback, messageFailureCallback);
+  handshakeMark("ready");
+  sendReady();
 });
 
 
 Pebble.addEventListener('showConfiguration', function(e) {
+  // the watch's counters end up in the log next to whatever is about to be reconfigured
+  Pebble.sendAppMessage({"TransferType": TransferType.PERF}, messageSuccessCallback, messageFailureCallback);
   Pebble.openURL(clay.generateUrl());
 });
 
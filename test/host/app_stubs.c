@@ -0,0 +1,54 @@
+// Stand-ins for the app's windows and stateful.c, which the modules call into
+#include <pebble.h>
+#include "c/modules/data.h"
+#include "c/modules/comm.h"
+#include "c/user_interface/action_window.h"
+#include "c/user_interface/loading_window.h"
+#include "c/user_interface/menu_window.h"
+#include "host.h"
+
+static HostWindows s_windows = {.color = -1};
+
+HostWindows *host_windows() {
+  return &s_windows;
+}
+
+void menu_window_push() {
+  if (!s_windows.menu_shown_ms) { s_windows.menu_shown_ms = host_time_now(); }
+  s_windows.menu_pushes++;
+}
+
+void menu_window_pop() {}
+
+void menu_window_refresh_icons() {
+  s_windows.icon_refreshes++;
+}
+
+void action_window_refresh_tile() {}
+
+void action_window_pop() {}
+
+void action_window_set_color(int type) {
+  s_windows.color = type;
+}
+
+void action_window_set_states(uint16_t index, uint8_t *states, uint16_t size) {}
+
+void action_window_refresh_icons() {}
+
+void loading_window_push(char *text) {
+  s_windows.loading = true;
+}
+
+void loading_window_pop() {
+  s_windows.loading = false;
+}
+
+// as in stateful.c
+void pebblekit_connection_callback(bool connected) {
+  loading_window_pop();
+  action_window_pop();
+  menu_window_pop();
+  loading_window_push(NULL);
+  comm_callback_start();
+}
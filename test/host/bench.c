@@ -0,0 +1,179 @@
+// Decode throughput and heap use of the transfers written by blobs.js. Each transfer is decoded repeatedly from
+// a fresh copy, as comm.c decodes the buffer it received it into, with the heap limited as on the watch.
+// Usage: bench <seed directory>
+#include <pebble.h>
+#include "c/modules/data.h"
+#include "c/modules/storage.h"
+#include "c/stateful.h"
+#include "host.h"
+
+// each measurement repeats for at least this long
+#define BENCH_MIN_NS 200000000ull
+#define BENCH_MAX_SIZE 65536
+
+typedef struct {
+  const char *name;
+  uint8_t data[BENCH_MAX_SIZE];
+  int size;
+} Seed;
+
+typedef struct {
+  uint64_t ns;
+  uint32_t runs;
+  uint32_t allocations;
+  // most bytes held at once on top of what was held before the transfer arrived
+  size_t peak;
+  bool ok;
+} Measurement;
+
+// tile window the delta seed was made against
+static Seed s_table = {.name = "tile_table.bin"};
+
+static uint64_t bench_now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static bool bench_read(const char *dir, Seed *seed) {
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", dir, seed->name);
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "missing %s, see blobs.js\n", path);
+    return false;
+  }
+  seed->size = fread(seed->data, 1, BENCH_MAX_SIZE, file);
+  fclose(file);
+  return true;
+}
+
+//! Copies a seed into the app heap as comm.c would have received it
+static uint8_t *bench_receive(Seed *seed) {
+  uint8_t *data = malloc(seed->size);
+  if (data) { memcpy(data, seed->data, seed->size); }
+  return data;
+}
+
+static bool bench_pack(Seed *seed) {
+  uint8_t *data = bench_receive(seed);
+  bool ok = data && data_tile_array_pack_tiles(data, seed->size);
+  free(data);
+  return ok;
+}
+
+static void bench_unpack(Seed *seed) {
+  data_tile_array_free();
+}
+
+static void bench_repack(Seed *seed) {
+  bench_pack(&s_table);
+}
+
+static bool bench_patch(Seed *seed) {
+  uint8_t *data = bench_receive(seed);
+  bool ok = data && data_tile_array_patch_tiles(data, seed->size);
+  free(data);
+  return ok;
+}
+
+static bool bench_open_tiles(Seed *seed) {
+  bool ok = true;
+  for(uint16_t i=tile_array->first; i < tile_array->first + tile_array->used; i++) {
+    Tile *tile = data_tile_array_get_tile(i);
+    ok &= data_tile_materialize(tile);
+    for(uint8_t j=0; j < TILE_STRING_COUNT; j++) {
+      ok &= data_tile_get_text(tile, j) != NULL && data_tile_get_icon_key(tile, j) != NULL;
+    }
+  }
+  return ok;
+}
+
+//! Empties the icon array and asks for the icons of a batch, in order, so they get the slots the batch was
+//! packed for
+static void bench_request_icons(Seed *seed) {
+  data_icon_array_free();
+  data_icon_array_init(ICON_ARRAY_SIZE);
+  int ptr = 1;
+  for(uint8_t i=0; i < seed->data[0] && ptr + 2 <= seed->size; i++) {
+    char key[ICON_KEY_SIZE] = {0};
+    uint8_t key_size = seed->data[ptr + 1];
+    memcpy(key, &seed->data[ptr + 2], MIN(key_size, ICON_KEY_SIZE - 1));
+    data_icon_array_search(key, ICON_PRIORITY_MENU);
+    ptr += 2 + key_size;
+    ptr += 2 + (seed->data[ptr] | seed->data[ptr + 1] << 8);
+  }
+}
+
+static bool bench_add_icons(Seed *seed) {
+  uint8_t *data = bench_receive(seed);
+  if (data) { data_icon_array_add_icons(data, seed->size); }
+  free(data);
+  return data != NULL;
+}
+
+//! Repeats decode for at least BENCH_MIN_NS, running setup untimed before each. Allocations and the peak are
+//! counted from after setup, so they include the buffer the transfer arrives in
+static Measurement bench_measure(void (*setup)(Seed*), bool (*decode)(Seed*), Seed *seed) {
+  Measurement result = {.ok = true};
+  uint64_t start = bench_now_ns();
+  while (bench_now_ns() - start < BENCH_MIN_NS) {
+    if (setup) { setup(seed); }
+    size_t base = host_heap_stats()->used;
+    host_heap_mark();
+    uint64_t decode_start = bench_now_ns();
+    result.ok &= decode(seed);
+    result.ns += bench_now_ns() - decode_start;
+    result.runs++;
+    result.allocations = host_heap_stats()->allocations;
+    size_t peak = host_heap_stats()->peak - base;
+    result.peak = (peak > result.peak) ? peak : result.peak;
+  }
+  return result;
+}
+
+static void bench_report(const char *name, Seed *seed, Measurement *measurement) {
+  double us = (double) measurement->ns / measurement->runs / 1000;
+  printf("%-24s %6d %6d %9.2f %8.2f %7u %7zu %7u %s\n", name, seed->size, tile_array ? tile_array->used : 0, us,
+         seed->size / us, measurement->allocations, measurement->peak, tile_array ? (unsigned) tile_array->bytes : 0,
+         measurement->ok ? "" : "FAILED");
+}
+
+int main(int argc, char **argv) {
+  const char *dir = (argc > 1) ? argv[1] : "build/seeds/basalt";
+  static Seed uncompressed = {.name = "tile_table_uncompressed.bin"}, inline_tiles = {.name = "tile_inline.bin"},
+              delta = {.name = "tile_delta.bin"}, icons = {.name = "icon_batch.bin"},
+              native_icons = {.name = "icon_batch_native.bin"};
+  struct {
+    const char *name;
+    void (*setup)(Seed*);
+    bool (*decode)(Seed*);
+    Seed *seed;
+  } runs[] = {
+    {"pack compressed table", bench_unpack, bench_pack, &s_table},
+    {"pack table", bench_unpack, bench_pack, &uncompressed},
+    {"pack inline", bench_unpack, bench_pack, &inline_tiles},
+    {"replace compressed table", bench_repack, bench_pack, &s_table},
+    {"patch delta", bench_repack, bench_patch, &delta},
+    {"open every tile", bench_repack, bench_open_tiles, &s_table},
+    {"add resource icons", bench_request_icons, bench_add_icons, &icons},
+    {"add native icons", bench_request_icons, bench_add_icons, &native_icons},
+  };
+  bool ok = true;
+  for(uint8_t i=0; i < ARRAY_LENGTH(runs); i++) { ok &= bench_read(dir, runs[i].seed); }
+  if (!ok) { return 1; }
+
+  host_heap_init(HOST_HEAP_DEFAULT);
+  storage_init();
+  data_icon_array_init(ICON_ARRAY_SIZE);
+  printf("heap %d bytes, MAX_TILES %d\n", HOST_HEAP_DEFAULT, MAX_TILES);
+  printf("%-24s %6s %6s %9s %8s %7s %7s %7s\n", "", "bytes", "tiles", "us", "MB/s", "allocs", "peak", "result");
+  for(uint8_t i=0; i < ARRAY_LENGTH(runs); i++) {
+    Measurement measurement = bench_measure(runs[i].setup, runs[i].decode, runs[i].seed);
+    bench_report(runs[i].name, runs[i].seed, &measurement);
+    ok &= measurement.ok;
+  }
+  data_tile_array_free();
+  data_icon_array_free();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+// Writes the transfers pebblekit makes for a sample config to a directory, as seeds for the fuzzer and input
+// for the benchmark. Usage: node blobs.js <directory> [platform]
+var fs = require('fs');
+var path = require('path');
+var pebblekit = require('./pebblekit');
+var bitmap = require('../../src/pkjs/bitmap');
+
+var TILE_COUNT = 100;
+var DEFAULT_IDX = 50;
+// tiles the delta moves the window by
+var DELTA_SHIFT = 4;
+
+var out = process.argv[2] || 'build/seeds';
+var platform = process.argv[3] || 'basalt';
+fs.mkdirSync(out, {recursive: true});
+
+//! @return The blob pebblekit hands to processData() for the call made by send, and its TransferType
+function capture(pkjs, send) {
+  var sent = null;
+  var processData = pkjs.context.processData;
+  pkjs.context.processData = function(data, type) { sent = {"data": Array.prototype.slice.call(data), "type": type}; };
+  send();
+  pkjs.context.processData = processData;
+  return sent;
+}
+
+function write(name, blob) {
+  fs.writeFileSync(path.join(out, name), Buffer.from(blob.data));
+  console.log(name + ': type ' + blob.type + ', ' + blob.data.length + ' bytes');
+}
+
+//! Hashes of the tiles of a window as the watch reports them, little endian uint32 each
+function watchTileHashes(pkjs, tiles, first, count) {
+  var context = pkjs.context;
+  var buffer = new Uint8Array(4096);
+  var hashes = new Uint8Array(count * 4);
+  for (var i = 0; i < count; i++) {
+    var end = context.packTile(buffer, tiles.tiles[first + i], 0);
+    context.packUint32(hashes, context.fnv1a(buffer, 0, end), i * 4);
+  }
+  return hashes;
+}
+
+var tiles = pebblekit.sampleTiles(TILE_COUNT, DEFAULT_IDX);
+var pkjs = pebblekit.load({"platform": platform, "tiles": tiles});
+var context = pkjs.context;
+
+write('tile_table.bin', capture(pkjs, function() { context.packTiles(); }));
+var window = context.tileWindowSent;
+var first = Math.max(0, Math.min(DEFAULT_IDX - (window >> 1), TILE_COUNT - window));
+
+context.TILE_COMPRESSION = false;
+write('tile_table_uncompressed.bin', capture(pkjs, function() { context.packTiles(); }));
+context.TILE_COMPRESSION = true;
+context.TILE_FORMAT = context.TILE_FORMAT_INLINE;
+write('tile_inline.bin', capture(pkjs, function() { context.packTiles(); }));
+context.TILE_FORMAT = context.TILE_FORMAT_TABLE;
+
+// a few renamed tiles in a window that has scrolled on from the one above
+var hashes = watchTileHashes(pkjs, tiles, first, window);
+for (var i = first; i < first + window; i += 8) { tiles.tiles[i].payload.texts[0] = 'Renamed ' + i; }
+pkjs.storage['tiles'] = JSON.stringify(tiles);
+context.resetConfig();
+write('tile_delta.bin', capture(pkjs, function() { context.packTiles(0, hashes, first + DELTA_SHIFT, first); }));
+
+// built in icons, then a key pebblekit doesn't know
+write('icon_batch.bin', capture(pkjs, function() {
+  context.packIcons([{"index": 0, "key": '356a192b'}, {"index": 1, "key": 'da4b9237'}, {"index": 2, "key": 'ffffffff'}]);
+}));
+
+// a converted icon as bitmap.js makes it, aplite would be sent a resource so it gets the basalt conversion
+var tv = fs.readFileSync(path.join(__dirname, '../../resources/icons/tv.png'));
+pkjs.context.nativeIcons['1b645389'] = [pkjs.evaluate('IconFormat').NATIVE].concat(bitmap.pngToNative(tv, 'basalt'));
+pkjs.context.icons['1b645389'] = 'png';
+write('icon_batch_native.bin', capture(pkjs, function() { context.packIcons([{"index": 0, "key": '1b645389'}]); }));
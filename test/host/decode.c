@@ -0,0 +1,168 @@
+// The watch's side of roundtrip.js: decodes a tile blob, then any tile deltas after it, as comm.c would and
+// prints what the watch holds as JSON: {"ok", "total", "first", "used", "default_idx", "tiles": [{"hash",
+// "strings": [texts then icon keys]}]}
+// The heap is left far larger than the watch's, transfers are sized to the heap by pebblekit and this checks
+// the format alone. With --cache the tiles are written to the tile cache as comm.c would and the tiles printed
+// are the ones read back from it, as the next launch would show them.
+// With --icons the file is an icon batch instead, its icons moved to the slots a fresh icon_array hands out
+// in batch order. Each icon is printed as the bitmap it became: {"key", "format",
+// "width", "height", "bytes_per_row", "palette", "data"}, or {"key", "bitmap": false}.
+// Usage: decode [--cache] <tile blob> [tile delta]...
+//        decode --icons <icon batch>
+#include <pebble.h>
+#include "c/modules/data.h"
+#include "c/modules/storage.h"
+#include "c/stateful.h"
+#include "host.h"
+
+#define DECODE_HEAP (4 * 1024 * 1024)
+
+//! Reads a file into the app heap, as comm.c holds a transfer it has received
+static uint8_t *decode_read(const char *path, int *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) { return NULL; }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = malloc(MAX(*size, 1));
+  if (data && fread(data, 1, *size, file) != (size_t) *size) {
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+static void decode_print_string(const char *string) {
+  putchar('"');
+  for(const uint8_t *c=(const uint8_t*) string; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      printf("\\%c", *c);
+    } else if (*c < 0x20 || *c >= 0x7f) {
+      printf("\\u%04x", *c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
+
+//! Decodes an icon batch, see data_icon_array_add_icons, and prints the bitmaps made from it
+static void decode_icons(uint8_t *data, int size) {
+  data_icon_array_init(ICON_ARRAY_SIZE);
+  char keys[ICON_ARRAY_SIZE][ICON_KEY_SIZE];
+  uint8_t count = 0;
+  // the slots the batch fills have to be waiting on their keys
+  for(int ptr = 1; count < MIN(data[0], ICON_ARRAY_SIZE) && ptr + 2 <= size; count++) {
+    data[ptr] = count;
+    uint8_t key_size = MIN(data[ptr + 1], ICON_KEY_SIZE - 1);
+    memcpy(keys[count], &data[ptr + 2], key_size);
+    keys[count][key_size] = '\0';
+    ptr += 2 + data[ptr + 1];
+    if (ptr + 2 > size) { break; }
+    ptr += 2 + (data[ptr] | data[ptr + 1] << 8);
+    data_icon_array_search(keys[count], ICON_PRIORITY_VISIBLE);
+  }
+  data_icon_array_add_icons(data, size);
+
+  printf("[");
+  for(uint8_t i=0; i < count; i++) {
+    GBitmap *bitmap = data_icon_array_search(keys[i], ICON_PRIORITY_VISIBLE);
+    printf("%s{\"key\": ", (i > 0) ? ", " : "");
+    decode_print_string(keys[i]);
+    if (!bitmap) {
+      printf(", \"bitmap\": false}");
+      continue;
+    }
+    GRect bounds = gbitmap_get_bounds(bitmap);
+    uint16_t bytes_per_row = gbitmap_get_bytes_per_row(bitmap);
+    GColor *palette = gbitmap_get_palette(bitmap);
+    printf(", \"format\": %d, \"width\": %d, \"height\": %d, \"bytes_per_row\": %u, \"palette\": [",
+           gbitmap_get_format(bitmap), bounds.size.w, bounds.size.h, bytes_per_row);
+    // palettes are as large as their format allows
+    uint16_t palette_size = 0;
+    switch(gbitmap_get_format(bitmap)) {
+      case GBitmapFormat1BitPalette: palette_size = 2; break;
+      case GBitmapFormat2BitPalette: palette_size = 4; break;
+      case GBitmapFormat4BitPalette: palette_size = 16; break;
+      default: break;
+    }
+    for(uint16_t j=0; palette && j < palette_size; j++) { printf("%s%u", (j > 0) ? ", " : "", palette[j].argb); }
+    printf("], \"data\": [");
+    uint8_t *pixels = gbitmap_get_data(bitmap);
+    for(int j=0; j < bytes_per_row * bounds.size.h; j++) { printf("%s%u", (j > 0) ? ", " : "", pixels[j]); }
+    printf("]}");
+  }
+  printf("]\n");
+  data_icon_array_free();
+}
+
+//! Writes tile_array to the tile cache as comm_tile_cache_write does, then loads it back in its place
+static bool decode_cache() {
+  if (!tile_array) { return false; }
+  TileArray *image = (tile_array->bytes <= TILE_CACHE_MAX_SIZE) ? tile_array :
+      data_tile_array_window_image(TILE_CACHE_MAX_SIZE);
+  if (!image || !storage_tile_cache_write((uint8_t*) image, image->bytes, image->hash)) { return false; }
+  if (image != tile_array) { free(image); }
+  data_tile_array_free();
+  uint16_t size;
+  uint8_t *cache = storage_tile_cache_read(&size);
+  return cache && data_tile_array_load(cache, size);
+}
+
+int main(int argc, char **argv) {
+  bool cache = argc > 1 && strcmp(argv[1], "--cache") == 0;
+  bool icons = argc > 1 && strcmp(argv[1], "--icons") == 0;
+  if (argc < 2 + (cache || icons)) {
+    fprintf(stderr, "usage: %s [--cache] <tile blob> [tile delta]...\n       %s --icons <icon batch>\n", argv[0], argv[0]);
+    return 1;
+  }
+  host_heap_init(DECODE_HEAP);
+  storage_init();
+  if (icons) {
+    int size = 0;
+    uint8_t *data = decode_read(argv[2], &size);
+    if (!data || size < 1) {
+      fprintf(stderr, "can't read %s\n", argv[2]);
+      return 1;
+    }
+    decode_icons(data, size);
+    free(data);
+    storage_deinit();
+    return 0;
+  }
+  bool ok = true;
+  for(int i=1 + cache; i < argc && ok; i++) {
+    int size = 0;
+    uint8_t *data = decode_read(argv[i], &size);
+    if (!data) {
+      fprintf(stderr, "can't read %s\n", argv[i]);
+      return 1;
+    }
+    ok = (i == 1 + cache) ? data_tile_array_pack_tiles(data, size) : data_tile_array_patch_tiles(data, size);
+    free(data);
+  }
+  if (ok && cache) { ok = decode_cache(); }
+
+  printf("{\"ok\": %s", (ok && tile_array) ? "true" : "false");
+  if (tile_array) {
+    printf(", \"total\": %u, \"first\": %u, \"used\": %u, \"default_idx\": %u, \"tiles\": [", tile_array->total,
+           tile_array->first, tile_array->used, tile_array->default_idx);
+    for(uint16_t i=tile_array->first; i < tile_array->first + tile_array->used; i++) {
+      Tile *tile = data_tile_array_get_tile(i);
+      data_tile_materialize(tile);
+      printf("%s{\"hash\": %u, \"strings\": [", (i > tile_array->first) ? ", " : "", (unsigned) tile->hash);
+      for(uint8_t j=0; j < TILE_STRING_COUNT * 2; j++) {
+        if (j > 0) { printf(", "); }
+        decode_print_string((j < TILE_STRING_COUNT) ? data_tile_get_text(tile, j) :
+                            data_tile_get_icon_key(tile, j - TILE_STRING_COUNT));
+      }
+      printf("]}");
+    }
+    printf("]");
+  }
+  printf("}\n");
+  data_tile_array_free();
+  storage_deinit();
+  return 0;
+}
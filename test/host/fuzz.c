@@ -0,0 +1,313 @@
+// Fuzzes the watch's end of the transfer protocol. Tile, delta and icon transfers built from the blobs.js seeds
+// are truncated and mutated and sent through the inbox handler with lying TransferLength, TransferIndex,
+// TransferChunkLength and TransferSeq values, mixed with handshake messages, outbox failures, timeouts and
+// relaunches from a corrupted tile cache.
+// After every message the tiles the watch holds are read back in full, so the sanitizers catch any decode that
+// left them pointing outside their allocation.
+// Usage: fuzz <seed directory> <iterations> <random seed>
+// Built with -DHOST_LIBFUZZER the same decisions are read from libFuzzer's input instead
+#include <pebble.h>
+#include "c/modules/comm.h"
+#include "c/modules/data.h"
+#include "c/modules/storage.h"
+#include "c/stateful.h"
+#include "host.h"
+
+#define FUZZ_MAX_SIZE 65536
+// room for a chunk and the keys around it, as large as the biggest inbox
+#define FUZZ_MESSAGE_SIZE (HOST_INBOX_MAX + 64)
+
+void pebblekit_connection_callback(bool connected);
+
+typedef struct {
+  const char *name;
+  uint8_t type;
+  uint8_t data[FUZZ_MAX_SIZE];
+  int size;
+} Seed;
+
+static Seed s_seeds[] = {
+  {.name = "tile_table.bin", .type = TRANSFER_TYPE_TILE},
+  {.name = "tile_table_uncompressed.bin", .type = TRANSFER_TYPE_TILE},
+  {.name = "tile_inline.bin", .type = TRANSFER_TYPE_TILE},
+  {.name = "tile_delta.bin", .type = TRANSFER_TYPE_TILE_DELTA},
+  {.name = "icon_batch.bin", .type = TRANSFER_TYPE_ICON_BATCH},
+  {.name = "icon_batch_native.bin", .type = TRANSFER_TYPE_ICON_BATCH},
+};
+
+// where decisions come from, a xorshift32 sequence or libFuzzer's input
+static uint32_t s_random = 1;
+static const uint8_t *s_input = NULL;
+static size_t s_input_size = 0;
+
+static uint32_t fuzz_next() {
+  if (s_input) {
+    uint32_t value = 0;
+    for(uint8_t i=0; i < 4; i++) {
+      value = value << 8 | ((s_input_size > 0) ? *s_input++ : 0);
+      s_input_size -= (s_input_size > 0);
+    }
+    return value;
+  }
+  s_random ^= s_random << 13;
+  s_random ^= s_random >> 17;
+  s_random ^= s_random << 5;
+  return s_random;
+}
+
+//! @return A number in [0, range)
+static uint32_t fuzz_below(uint32_t range) {
+  return (range) ? fuzz_next() % range : 0;
+}
+
+static bool fuzz_chance(uint32_t percent) {
+  return fuzz_below(100) < percent;
+}
+
+//! A value near one a well behaved pebblekit would send, or one far off it
+static int32_t fuzz_lie(int32_t value) {
+  switch(fuzz_below(6)) {
+    case 0: return -1 - (int32_t) fuzz_below(4);
+    case 1: return 0;
+    case 2: return value + 1 + fuzz_below(8);
+    case 3: return value - 1 - fuzz_below(8);
+    case 4: return INT32_MAX - fuzz_below(4);
+    default: return fuzz_next();
+  }
+}
+
+//! Starts a message from pebblekit, integers are sent as int32 as pebblekit js does
+static void fuzz_message(DictionaryIterator *iter, uint8_t *buffer, uint8_t type) {
+  dict_write_begin(iter, buffer, FUZZ_MESSAGE_SIZE);
+  // a message without a type is as malformed as one with a type it doesn't expect
+  if (!fuzz_chance(1)) { dict_write_int32(iter, MESSAGE_KEY_TransferType, type); }
+}
+
+static void fuzz_deliver(DictionaryIterator *iter) {
+  host_inbox_deliver((uint8_t*) iter->dictionary, dict_write_end(iter));
+}
+
+//! Acknowledges whatever the watch has sent, now and then as a failure
+static void fuzz_outbox() {
+  for(uint8_t i=0; i < 8 && host_outbox_pending(NULL); i++) {
+    host_outbox_complete(fuzz_chance(90) ? APP_MSG_OK : APP_MSG_SEND_TIMEOUT);
+  }
+}
+
+//! A copy of a seed that is truncated, has bytes overwritten or has a stretch of itself copied elsewhere
+static int fuzz_mutate(Seed *seed, uint8_t *out) {
+  int size = seed->size;
+  memcpy(out, seed->data, size);
+  switch(fuzz_below(4)) {
+    case 0:
+      return size;
+    case 1:
+      return fuzz_below(size + 1);
+    case 2:
+      for(uint32_t i=fuzz_below(8) + 1; i > 0 && size > 0; i--) { out[fuzz_below(size)] = fuzz_next(); }
+      return size;
+    default: {
+      if (size == 0) { return 0; }
+      int from = fuzz_below(size), to = fuzz_below(size);
+      int length = fuzz_below(size - ((from > to) ? from : to)) + 1;
+      memmove(&out[to], &out[from], length);
+      return size;
+    }
+  }
+}
+
+//! Sends data as a transfer the way transmitData() in index.js does, then breaks it
+static void fuzz_transfer(uint8_t type, uint8_t *data, int size) {
+  static uint8_t buffer[FUZZ_MESSAGE_SIZE];
+  DictionaryIterator iter;
+  bool windowed = fuzz_chance(50);
+  int chunk_size = HOST_INBOX_MAX - 24 * (windowed ? 3 : 2);
+  if (fuzz_chance(20)) { chunk_size = fuzz_below(chunk_size) + 1; }
+  int chunk_count = (size + chunk_size - 1) / chunk_size;
+
+  if (!fuzz_chance(5)) {
+    fuzz_message(&iter, buffer, type);
+    dict_write_int32(&iter, MESSAGE_KEY_TransferLength, fuzz_chance(10) ? fuzz_lie(size) : size);
+    fuzz_deliver(&iter);
+    fuzz_outbox();
+  }
+  for(int seq=0; seq < chunk_count; seq++) {
+    // chunks go missing, arrive twice, or late
+    if (fuzz_chance(3)) { continue; }
+    int send_seq = (fuzz_chance(3)) ? fuzz_below(chunk_count) : seq;
+    int index = send_seq * chunk_size;
+    int length = (size - index < chunk_size) ? size - index : chunk_size;
+    for(uint8_t copies = fuzz_chance(3) ? 2 : 1; copies > 0; copies--) {
+      fuzz_message(&iter, buffer, type);
+      uint16_t tuple_length = (fuzz_chance(5)) ? fuzz_below(length + 1) : length;
+      dict_write_data(&iter, MESSAGE_KEY_TransferChunk, &data[index], tuple_length);
+      if (!fuzz_chance(2)) {
+        dict_write_int32(&iter, MESSAGE_KEY_TransferChunkLength, fuzz_chance(5) ? fuzz_lie(length) : length);
+      }
+      if (!fuzz_chance(2)) { dict_write_int32(&iter, MESSAGE_KEY_TransferIndex, fuzz_chance(5) ? fuzz_lie(index) : index); }
+      if (windowed) { dict_write_int32(&iter, MESSAGE_KEY_TransferSeq, fuzz_chance(5) ? fuzz_lie(send_seq) : send_seq); }
+      fuzz_deliver(&iter);
+      fuzz_outbox();
+    }
+    // the transfer times out part way through
+    if (fuzz_chance(1)) { host_time_advance(TRANSFER_TIMEOUT); }
+  }
+  fuzz_message(&iter, buffer, type);
+  dict_write_int32(&iter, MESSAGE_KEY_TransferComplete, fuzz_chance(5) ? fuzz_lie(size) : size);
+  if (windowed) { dict_write_int32(&iter, MESSAGE_KEY_TransferSeq, fuzz_chance(5) ? fuzz_lie(chunk_count) : chunk_count); }
+  fuzz_deliver(&iter);
+  fuzz_outbox();
+}
+
+//! Any of the single messages pebblekit sends, now and then with its keys missing or garbled
+static void fuzz_control() {
+  static uint8_t buffer[FUZZ_MESSAGE_SIZE];
+  static const uint8_t types[] = {
+    TRANSFER_TYPE_ICON, TRANSFER_TYPE_XHR, TRANSFER_TYPE_COLOR, TRANSFER_TYPE_ERROR, TRANSFER_TYPE_ACK,
+    TRANSFER_TYPE_READY, TRANSFER_TYPE_NO_CLAY, TRANSFER_TYPE_REFRESH, TRANSFER_TYPE_CACHE_VALID,
+    TRANSFER_TYPE_STATE, TRANSFER_TYPE_PERF, TRANSFER_TYPE_REFUSED, 0xff
+  };
+  DictionaryIterator iter;
+  fuzz_message(&iter, buffer, types[fuzz_below(ARRAY_LENGTH(types))]);
+  dict_write_int32(&iter, MESSAGE_KEY_Version, fuzz_chance(90) ? PROTOCOL_VERSION : fuzz_next());
+  dict_write_int32(&iter, MESSAGE_KEY_Color, fuzz_below(4));
+  dict_write_int32(&iter, MESSAGE_KEY_RequestIndex, fuzz_chance(50) ? fuzz_below(MAX_TILES * 2) : fuzz_next());
+  uint8_t states[8];
+  for(uint8_t i=0; i < sizeof(states); i++) { states[i] = fuzz_next(); }
+  dict_write_data(&iter, MESSAGE_KEY_ButtonStates, states, fuzz_below(sizeof(states) + 1));
+  fuzz_deliver(&iter);
+  fuzz_outbox();
+}
+
+//! Reads back every string of every tile held and scrolls the menu over them
+static void fuzz_check() {
+  if (host_dict_overflows()) {
+    fprintf(stderr, "the watch wrote past its outbox, see OUTBOX_SIZE\n");
+    abort();
+  }
+  if (!tile_array) { return; }
+  if (tile_array->used > MAX_TILES || tile_array->first + tile_array->used > tile_array->total) {
+    fprintf(stderr, "window of %d tiles from %d of %d\n", tile_array->used, tile_array->first, tile_array->total);
+    abort();
+  }
+  size_t length = 0;
+  for(uint16_t i=tile_array->first; i < tile_array->first + tile_array->used; i++) {
+    Tile *tile = data_tile_array_get_tile(i);
+    data_tile_materialize(tile);
+    for(uint8_t j=0; j < TILE_STRING_COUNT; j++) {
+      length += strlen(data_tile_get_text(tile, j)) + strlen(data_tile_get_icon_key(tile, j));
+    }
+    data_icon_array_search(data_tile_get_icon_key(tile, TITLE), ICON_PRIORITY_MENU);
+  }
+  if (fuzz_chance(10)) { comm_tile_page_request(fuzz_below(tile_array->total + 1)); }
+  (void) length;
+}
+
+//! Overwrites a few bytes of the cached tiles, as a flash write cut short might, for the next launch to read
+static void fuzz_corrupt_cache() {
+  uint8_t slot[PERSIST_DATA_MAX_LENGTH];
+  uint32_t key = fuzz_chance(20) ? PERSIST_KEY_TILE_CACHE : PERSIST_KEY_TILE_CACHE_DATA + fuzz_below(TILE_CACHE_SLOTS);
+  int size = persist_read_data(key, slot, sizeof(slot));
+  if (size <= 0) { return; }
+  for(uint32_t i=fuzz_below(4) + 1; i > 0; i--) { slot[fuzz_below(size)] = fuzz_next(); }
+  persist_write_data(key, slot, size);
+}
+
+static void fuzz_step() {
+  static uint8_t data[FUZZ_MAX_SIZE];
+  switch(fuzz_below(8)) {
+    case 0:
+      fuzz_control();
+      break;
+    case 1:
+      host_time_advance(fuzz_below(TRANSFER_TIMEOUT + 1000));
+      fuzz_outbox();
+      break;
+    case 2:
+      if (fuzz_chance(10)) { fuzz_corrupt_cache(); }
+      if (fuzz_chance(20)) { pebblekit_connection_callback(true); }
+      if (fuzz_chance(20)) { host_heap_init(fuzz_chance(50) ? HOST_HEAP_DEFAULT : HOST_HEAP_DEFAULT / 4); }
+      fuzz_outbox();
+      break;
+    default: {
+      Seed *seed = &s_seeds[fuzz_below(ARRAY_LENGTH(s_seeds))];
+      int size = fuzz_mutate(seed, data);
+      // mostly the type the blob was made for
+      uint8_t type = fuzz_chance(90) ? seed->type : s_seeds[fuzz_below(ARRAY_LENGTH(s_seeds))].type;
+      fuzz_transfer(type, data, size);
+      break;
+    }
+  }
+  fuzz_check();
+}
+
+static void fuzz_start() {
+  host_heap_init(HOST_HEAP_DEFAULT);
+  storage_init();
+  comm_init();
+  pebblekit_connection_callback(true);
+  fuzz_outbox();
+}
+
+static void fuzz_stop() {
+  comm_deinit();
+  storage_deinit();
+}
+
+#ifdef HOST_LIBFUZZER
+// seeds are read once from FUZZ_SEEDS, or build/seeds/basalt
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static bool loaded = false;
+  if (!loaded) {
+    loaded = true;
+    const char *dir = getenv("FUZZ_SEEDS") ? getenv("FUZZ_SEEDS") : "build/seeds/basalt";
+    for(uint8_t i=0; i < ARRAY_LENGTH(s_seeds); i++) {
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", dir, s_seeds[i].name);
+      FILE *file = fopen(path, "rb");
+      if (file) {
+        s_seeds[i].size = fread(s_seeds[i].data, 1, FUZZ_MAX_SIZE, file);
+        fclose(file);
+      }
+    }
+  }
+  s_input = data;
+  s_input_size = size;
+  fuzz_start();
+  while (s_input_size > 0) { fuzz_step(); }
+  fuzz_stop();
+  return 0;
+}
+#else
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <seed directory> [iterations] [random seed]\n", argv[0]);
+    return 1;
+  }
+  uint32_t iterations = (argc > 2) ? strtoul(argv[2], NULL, 10) : 10000;
+  s_random = (argc > 3) ? strtoul(argv[3], NULL, 10) : 1;
+  s_random = s_random ? s_random : 1;
+  for(uint8_t i=0; i < ARRAY_LENGTH(s_seeds); i++) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", argv[1], s_seeds[i].name);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+      fprintf(stderr, "missing %s, see blobs.js\n", path);
+      return 1;
+    }
+    s_seeds[i].size = fread(s_seeds[i].data, 1, FUZZ_MAX_SIZE, file);
+    fclose(file);
+  }
+
+  fuzz_start();
+  uint32_t tiles_held = 0;
+  for(uint32_t i=0; i < iterations; i++) {
+    fuzz_step();
+    tiles_held += tile_array != NULL;
+  }
+  printf("%u iterations, tiles held after %u, %u bytes of heap in use, %u failed allocations\n", iterations,
+         tiles_held, (unsigned) host_heap_stats()->used, host_heap_stats()->failures);
+  fuzz_stop();
+  return 0;
+}
+#endif
@@ -0,0 +1,73 @@
+// Controls of the host build that the watch has no equivalent for: the heap limit and its counters, a clock
+// that only moves when told to, and both ends of the app message link
+#pragma once
+#include <pebble.h>
+
+// heap available to the app once its code is loaded, an approximation as the sdk doesn't publish one
+#define HOST_HEAP_APLITE (24 * 1024)
+#define HOST_HEAP_BASALT (64 * 1024)
+#ifdef PBL_PLATFORM_APLITE
+#define HOST_HEAP_DEFAULT HOST_HEAP_APLITE
+#else
+#define HOST_HEAP_DEFAULT HOST_HEAP_BASALT
+#endif
+
+// largest inbox app_message_inbox_size_maximum() reports
+#ifdef PBL_PLATFORM_APLITE
+#define HOST_INBOX_MAX 256
+#else
+#define HOST_INBOX_MAX 8200
+#endif
+
+typedef struct {
+  size_t limit;
+  size_t used;
+  size_t peak;
+  uint32_t allocations;
+  uint32_t failures;
+} HostHeapStats;
+
+//! Sets how many bytes the app may allocate and resets the counters, allocations past limit return NULL
+void host_heap_init(size_t limit);
+HostHeapStats *host_heap_stats();
+//! Starts peak and allocation counts again from the current use
+void host_heap_mark();
+
+//! Milliseconds since the host build started, the clock only moves with host_time_advance
+uint32_t host_time_now();
+//! Moves the clock forward, firing every timer that falls due in order
+void host_time_advance(uint32_t ms);
+//! @return Milliseconds until the next timer fires, UINT32_MAX if none is scheduled
+uint32_t host_time_next();
+
+//! Sets what app_message_inbox_size_maximum() reports, HOST_INBOX_MAX until called. Takes effect at the next
+//! app_message_open
+void host_inbox_maximum(uint32_t size);
+//! Hands a message to the app's inbox handler as if pebblekit had sent it
+//! @param data A serialized dictionary, see dict_write_begin
+//! @param size Size of data in bytes
+//! @return APP_MSG_OK, or why the watch would have dropped it. A dropped message is reported to the inbox dropped
+//! handler, pebblekit sees a nack
+AppMessageResult host_inbox_deliver(const uint8_t *data, uint16_t size);
+//! @return The message the app has sent and is waiting on, NULL if the outbox is idle
+DictionaryIterator *host_outbox_pending(uint16_t *size);
+//! Completes the pending message with APP_MSG_OK or a failure, calling the app's outbox handler
+void host_outbox_complete(AppMessageResult result);
+//! Dictionary writes that ran past their buffer, an outbox too small for what the app puts in it
+uint32_t host_dict_overflows();
+
+//! Messages logged with APP_LOG are printed only once enabled
+void host_log_enable(bool enabled);
+
+// what the app's windows were asked to do, the windows themselves aren't part of the host build
+typedef struct {
+  // host_time_now() when the menu was first pushed, 0 until it has been
+  uint32_t menu_shown_ms;
+  uint16_t menu_pushes;
+  uint16_t icon_refreshes;
+  bool loading;
+  // last action_window_set_color, -1 until called
+  int color;
+} HostWindows;
+
+HostWindows *host_windows();
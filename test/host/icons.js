@@ -0,0 +1,154 @@
+// Converts PNGs with bitmap.js, sends them through packIcons() and checks the bitmaps the watch's decoder,
+// build/decode --icons from decode.c, makes of them. A small PNG built here pins the exact bytes
+// data_icon_create_native() is handed on each platform, the icons in resources/icons have to come out as the
+// pixels pngToNative() made of them.
+// Usage: node icons.js [decode binary] [aplite decode binary]
+var assert = require('assert');
+var childProcess = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var zlib = require('zlib');
+var pebblekit = require('./pebblekit');
+
+var DECODE = process.argv[2] || path.join(__dirname, 'build', 'decode');
+var DECODE_APLITE = process.argv[3] || path.join(__dirname, 'build', 'decode_aplite');
+var OUT = path.join(__dirname, 'build', 'icons');
+var ICONS = path.join(__dirname, '../../resources/icons');
+fs.mkdirSync(OUT, {recursive: true});
+
+var RED = [255, 0, 0, 255], WHITE = [255, 255, 255, 255], BLUE = [0, 0, 255, 255];
+// 5x3 so rows end part way through a byte, 3 colours in colour and 2 once reduced to black and white
+var PIXELS = [
+  [RED, WHITE, BLUE, WHITE, RED],
+  [WHITE, RED, RED, RED, WHITE],
+  [BLUE, BLUE, WHITE, BLUE, BLUE]
+];
+// what data_icon_create_native() is handed: GBitmapFormat, width, height, palette size, palette, rows
+var EXPECTED = {
+  // 2 bit palettized, red 0xf0, white 0xff and blue 0xc3 in the order they first appear, rows of 2 bytes
+  "basalt": [3, 5, 3, 3, 0xf0, 0xff, 0xc3, 0x19, 0x00, 0x40, 0x40, 0xa6, 0x80],
+  // 1 bit palettized, red and blue are both dark enough to become black
+  "diorite": [2, 5, 3, 2, 0xc0, 0xff, 0x50, 0x88, 0x20]
+};
+// GBitmapFormat8Bit, what the host gbitmap_create_with_resource() makes of the resource id aplite is sent
+var APLITE_RESOURCE_FORMAT = 1;
+
+var CRC_TABLE = [];
+for (var n = 0; n < 256; n++) {
+  var c = n;
+  for (var k = 0; k < 8; k++) { c = (c & 1) ? (0xedb88320 ^ (c >>> 1)) : (c >>> 1); }
+  CRC_TABLE.push(c >>> 0);
+}
+
+function chunk(type, data) {
+  var body = Buffer.concat([Buffer.from(type, 'ascii'), data]);
+  var crc = 0xffffffff;
+  for (var i = 0; i < body.length; i++) { crc = CRC_TABLE[(crc ^ body[i]) & 0xff] ^ (crc >>> 8); }
+  var length = Buffer.alloc(4), sum = Buffer.alloc(4);
+  length.writeUInt32BE(data.length);
+  sum.writeUInt32BE((crc ^ 0xffffffff) >>> 0);
+  return Buffer.concat([length, body, sum]);
+}
+
+//! An 8 bit RGBA PNG of rows of [r, g, b, a] pixels
+function png(rows) {
+  var header = Buffer.alloc(13);
+  header.writeUInt32BE(rows[0].length, 0);
+  header.writeUInt32BE(rows.length, 4);
+  header[8] = 8;
+  header[9] = 6;
+  var raw = [];
+  rows.forEach(function(row) {
+    raw.push(0);
+    row.forEach(function(pixel) { raw.push.apply(raw, pixel); });
+  });
+  return Buffer.concat([Buffer.from([137, 80, 78, 71, 13, 10, 26, 10]), chunk('IHDR', header),
+                        chunk('IDAT', zlib.deflateSync(Buffer.from(raw))), chunk('IEND', Buffer.alloc(0))]);
+}
+
+//! Sends icons, an object of key to PNG, to a watch of platform
+//! @return The sent bytes of each icon and the bitmaps the watch made of them, by key
+function send(name, platform, icons) {
+  var pkjs = pebblekit.load({"platform": platform});
+  var keys = Object.keys(icons);
+  keys.forEach(function(key) { pkjs.context.icons[key] = icons[key].toString('base64'); });
+  var sent = null;
+  pkjs.context.processData = function(data) { sent = Array.prototype.slice.call(data); };
+  pkjs.context.packIcons(keys.map(function(key, i) { return {"index": i, "key": key}; }));
+  assert(sent, name + ': nothing sent');
+
+  var file = path.join(OUT, name.replace(/\W+/g, '_') + '.bin');
+  fs.writeFileSync(file, Buffer.from(sent));
+  var decode = (platform == 'aplite') ? DECODE_APLITE : DECODE;
+  var result = childProcess.spawnSync(decode, ['--icons', file], {"encoding": 'utf8'});
+  if (result.status !== 0) { throw new Error(decode + ' failed: ' + (result.error || result.stderr)); }
+  var bitmaps = {};
+  JSON.parse(result.stdout).forEach(function(bitmap) { bitmaps[bitmap.key] = bitmap; });
+  var found = {};
+  keys.forEach(function(key) {
+    assert(bitmaps[key] && bitmaps[key].bitmap !== false, name + ': no bitmap for ' + key);
+    // copied out of the context of index.js, whose arrays deepStrictEqual() takes for another type
+    found[key] = {"bytes": Array.prototype.slice.call(pkjs.context.iconBytes(key)), "bitmap": bitmaps[key]};
+  });
+  return found;
+}
+
+//! Checks bitmap is the one data_icon_create_native() makes of native
+function checkNative(name, native, bitmap) {
+  var format = native[0], width = native[1], height = native[2], paletteSize = native[3];
+  var bits = {1: 8, 2: 1, 3: 2, 4: 4}[format];
+  var rowSize = (width * bits + 7) >> 3;
+  assert.deepStrictEqual([bitmap.format, bitmap.width, bitmap.height], [format, width, height], name + ': bitmap');
+  assert.deepStrictEqual(bitmap.palette.slice(0, paletteSize), native.slice(4, 4 + paletteSize), name + ': palette');
+  bitmap.palette.slice(paletteSize).forEach(function(color) { assert.strictEqual(color, 0, name + ': unused palette entry'); });
+  for (var row = 0; row < height; row++) {
+    var pixels = native.slice(4 + paletteSize + row * rowSize, 4 + paletteSize + (row + 1) * rowSize);
+    var data = bitmap.data.slice(row * bitmap.bytes_per_row, row * bitmap.bytes_per_row + rowSize);
+    assert.deepStrictEqual(data, pixels, name + ': row ' + row);
+  }
+}
+
+var IconFormat = pebblekit.load().evaluate('IconFormat');
+
+var cases = {
+  "known png on basalt and diorite": function() {
+    Object.keys(EXPECTED).forEach(function(platform) {
+      var icon = send('known ' + platform, platform, {"5x3": png(PIXELS)})['5x3'];
+      assert.deepStrictEqual(icon.bytes, [IconFormat.NATIVE].concat(EXPECTED[platform]), platform + ': sent bytes');
+      checkNative('known ' + platform, EXPECTED[platform], icon.bitmap);
+    });
+  },
+
+  "known png on aplite": function() {
+    // aplite can't draw palettized bitmaps and gets a built in icon in place of the PNG
+    var icon = send('known aplite', 'aplite', {"5x3": png(PIXELS)})['5x3'];
+    assert.strictEqual(icon.bytes[0], IconFormat.RESOURCE, 'aplite: sent format');
+    assert.strictEqual(icon.bitmap.format, APLITE_RESOURCE_FORMAT, 'aplite: bitmap format');
+  },
+
+  "resource icons": function() {
+    var icons = {};
+    fs.readdirSync(ICONS).filter(function(file) { return /\.png$/.test(file); }).forEach(function(file) {
+      icons[file.replace(/\.png$/, '').replace(/\W/g, '').slice(0, 8)] = fs.readFileSync(path.join(ICONS, file));
+    });
+    ['basalt', 'diorite'].forEach(function(platform) {
+      var found = send('resource icons ' + platform, platform, icons);
+      Object.keys(found).forEach(function(key) {
+        assert.strictEqual(found[key].bytes[0], IconFormat.NATIVE, platform + ' ' + key + ': kept as png');
+        checkNative(platform + ' ' + key, found[key].bytes.slice(1), found[key].bitmap);
+      });
+    });
+  }
+};
+
+var failed = 0;
+Object.keys(cases).forEach(function(name) {
+  try {
+    cases[name]();
+    console.log('ok   ' + name);
+  } catch(e) {
+    failed++;
+    console.log('FAIL ' + name + ': ' + e.message);
+  }
+});
+process.exitCode = failed ? 1 : 0;
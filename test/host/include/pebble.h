@@ -0,0 +1,330 @@
+// The parts of the pebble sdk used by src/c, declared for a host build. pebble.c implements what the modules
+// under test call, the user interface only needs to compile, see the syntax target of the Makefile
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "message_keys.auto.h"
+
+// the app heap is a fixed size on the watch, allocations are counted against host_heap_limit, see host.h
+#ifndef HOST_HEAP_INTERNAL
+void *host_malloc(size_t size);
+void *host_calloc(size_t count, size_t size);
+void *host_realloc(void *ptr, size_t size);
+void host_free(void *ptr);
+#define malloc(size) host_malloc(size)
+#define calloc(count, size) host_calloc(count, size)
+#define realloc(ptr, size) host_realloc(ptr, size)
+#define free(ptr) host_free(ptr)
+#endif
+
+#ifdef PBL_PLATFORM_APLITE
+#define PBL_BW 1
+#define PBL_IF_COLOR_ELSE(a, b) (b)
+#define PBL_IF_BW_ELSE(a, b) (a)
+#else
+#define PBL_COLOR 1
+#define PBL_PLATFORM_BASALT 1
+#define PBL_IF_COLOR_ELSE(a, b) (a)
+#define PBL_IF_BW_ELSE(a, b) (b)
+#endif
+#define PBL_RECT 1
+#define PBL_IF_RECT_ELSE(a, b) (a)
+#define PBL_IF_ROUND_ELSE(a, b) (b)
+#define ARRAY_LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+
+#define APP_LOG_LEVEL_ERROR 1
+#define APP_LOG_LEVEL_WARNING 50
+#define APP_LOG_LEVEL_INFO 100
+#define APP_LOG_LEVEL_DEBUG 200
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...);
+#define APP_LOG(level, fmt, args...) app_log(level, __FILE__, __LINE__, fmt, ## args)
+
+#define PERSIST_DATA_MAX_LENGTH 256
+#define PERSIST_STRING_MAX_LENGTH PERSIST_DATA_MAX_LENGTH
+#define APP_MESSAGE_INBOX_SIZE_MINIMUM 124
+#define APP_MESSAGE_OUTBOX_SIZE_MINIMUM 636
+#define ACTION_BAR_WIDTH 30
+#define MENU_CELL_ROUND_FOCUSED_SHORT_CELL_HEIGHT 68
+#define MENU_CELL_ROUND_UNFOCUSED_TALL_CELL_HEIGHT 38
+
+// graphics
+typedef union { uint8_t argb; } GColor8;
+typedef GColor8 GColor;
+#define GColorBlack ((GColor) {0xC0})
+#define GColorWhite ((GColor) {0xFF})
+#define GColorClear ((GColor) {0x00})
+#define GColorIslamicGreen ((GColor) {0xC4})
+#define GColorMayGreen ((GColor) {0xD9})
+#define GColorMintGreen ((GColor) {0xEE})
+#define GColorMelon ((GColor) {0xFA})
+#define GColorIcterine ((GColor) {0xFD})
+#define GColorFolly ((GColor) {0xF1})
+#define GColorSunsetOrange ((GColor) {0xF5})
+#define GColorChromeYellow ((GColor) {0xF8})
+#define GColorRajah ((GColor) {0xF9})
+#define GColorCobaltBlue ((GColor) {0xC7})
+#define GColorImperialPurple ((GColor) {0xD1})
+#define GColorDarkGray ((GColor) {0xD5})
+#define GColorLightGray ((GColor) {0xEA})
+typedef struct { int16_t x, y; } GPoint;
+typedef struct { int16_t w, h; } GSize;
+typedef struct { GPoint origin; GSize size; } GRect;
+typedef struct { int16_t top, right, bottom, left; } GEdgeInsets;
+#define GRect(x, y, w, h) ((GRect) {{(x), (y)}, {(w), (h)}})
+#define GSize(w, h) ((GSize) {(w), (h)})
+#define GPoint(x, y) ((GPoint) {(x), (y)})
+#define GRectZero GRect(0, 0, 0, 0)
+typedef enum { GTextOverflowModeWordWrap, GTextOverflowModeTrailingEllipsis, GTextOverflowModeFill } GTextOverflowMode;
+typedef enum { GTextAlignmentLeft, GTextAlignmentCenter, GTextAlignmentRight } GTextAlignment;
+typedef enum { GAlignCenter } GAlign;
+typedef enum { GCompOpAssign, GCompOpSet } GCompOp;
+typedef enum {
+  GBitmapFormat1Bit, GBitmapFormat8Bit, GBitmapFormat1BitPalette, GBitmapFormat2BitPalette, GBitmapFormat4BitPalette,
+  GBitmapFormat8BitCircular
+} GBitmapFormat;
+typedef struct GBitmap GBitmap;
+typedef struct GBitmapSequence GBitmapSequence;
+typedef struct GFont_s *GFont;
+typedef struct GContext GContext;
+typedef uint32_t ResHandle;
+
+// fonts and resources
+#define FONT_KEY_GOTHIC_14 "RESOURCE_ID_GOTHIC_14"
+#define FONT_KEY_GOTHIC_18 "RESOURCE_ID_GOTHIC_18"
+#define FONT_KEY_GOTHIC_18_BOLD "RESOURCE_ID_GOTHIC_18_BOLD"
+enum {
+  RESOURCE_ID_ICON_DEFAULT = 1, RESOURCE_ID_ICON_TV, RESOURCE_ID_ICON_BULB, RESOURCE_ID_ICON_MONITOR,
+  RESOURCE_ID_ICON_TEST, RESOURCE_ID_LOADING_ANIMATION, RESOURCE_ID_FONT_UBUNTU_MEDIUM_18,
+  RESOURCE_ID_FONT_UBUNTU_BOLD_18, RESOURCE_ID_IMAGE_MENU_ICON
+};
+GFont fonts_get_system_font(const char *font_key);
+GFont fonts_load_custom_font(ResHandle handle);
+void fonts_unload_custom_font(GFont font);
+ResHandle resource_get_handle(uint32_t resource_id);
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+GBitmap *gbitmap_create_from_png_data(const uint8_t *png_data, size_t png_data_size);
+GBitmap *gbitmap_create_blank(GSize size, GBitmapFormat format);
+GBitmap *gbitmap_create_blank_with_palette(GSize size, GBitmapFormat format, GColor *palette, bool free_on_destroy);
+void gbitmap_destroy(GBitmap *bitmap);
+GRect gbitmap_get_bounds(const GBitmap *bitmap);
+uint8_t *gbitmap_get_data(const GBitmap *bitmap);
+uint16_t gbitmap_get_bytes_per_row(const GBitmap *bitmap);
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap);
+GColor *gbitmap_get_palette(const GBitmap *bitmap);
+void gbitmap_set_data(GBitmap *bitmap, uint8_t *data, GBitmapFormat format, uint16_t row_size_bytes, bool free_on_destroy);
+GBitmapSequence *gbitmap_sequence_create_with_resource(uint32_t resource_id);
+void gbitmap_sequence_destroy(GBitmapSequence *bitmap_sequence);
+bool gbitmap_sequence_update_bitmap_next_frame(GBitmapSequence *bitmap_sequence, GBitmap *bitmap, uint32_t *delay_ms);
+GSize gbitmap_sequence_get_bitmap_size(GBitmapSequence *bitmap_sequence);
+
+GSize graphics_text_layout_get_content_size(const char *text, const GFont font, const GRect box,
+                                            const GTextOverflowMode overflow_mode, const GTextAlignment alignment);
+void graphics_draw_text(GContext *ctx, const char *text, const GFont font, const GRect box,
+                        const GTextOverflowMode overflow_mode, const GTextAlignment alignment, void *text_attributes);
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+void grect_align(GRect *rect, const GRect *inside_rect, const GAlign alignment, const bool clip);
+GRect grect_inset(GRect rect, GEdgeInsets insets);
+
+// windows and layers
+typedef struct Layer Layer;
+typedef struct Window Window;
+typedef struct MenuLayer MenuLayer;
+typedef struct TextLayer TextLayer;
+typedef struct BitmapLayer BitmapLayer;
+typedef struct ActionBarLayer ActionBarLayer;
+typedef struct ScrollLayer ScrollLayer;
+typedef void *ClickRecognizerRef;
+typedef enum { BUTTON_ID_BACK, BUTTON_ID_UP, BUTTON_ID_SELECT, BUTTON_ID_DOWN } ButtonId;
+typedef enum { MenuRowAlignNone, MenuRowAlignCenter, MenuRowAlignTop, MenuRowAlignBottom } MenuRowAlign;
+typedef struct { uint16_t section; uint16_t row; } MenuIndex;
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+typedef void (*WindowHandler)(Window *window);
+typedef struct { WindowHandler load, appear, disappear, unload; } WindowHandlers;
+typedef struct {
+  uint16_t (*get_num_sections)(MenuLayer *menu_layer, void *context);
+  uint16_t (*get_num_rows)(MenuLayer *menu_layer, uint16_t section_index, void *context);
+  int16_t (*get_header_height)(MenuLayer *menu_layer, uint16_t section_index, void *context);
+  void (*draw_header)(GContext *ctx, const Layer *cell_layer, uint16_t section_index, void *context);
+  int16_t (*get_cell_height)(struct MenuLayer *menu_layer, MenuIndex *cell_index, void *context);
+  void (*draw_row)(GContext *ctx, const Layer *cell_layer, MenuIndex *cell_index, void *context);
+  void (*select_click)(MenuLayer *menu_layer, MenuIndex *cell_index, void *context);
+  void (*select_long_click)(MenuLayer *menu_layer, MenuIndex *cell_index, void *context);
+  void (*selection_changed)(struct MenuLayer *menu_layer, MenuIndex new_index, MenuIndex old_index, void *context);
+} MenuLayerCallbacks;
+typedef struct {
+  ClickConfigProvider click_config_provider;
+  void (*content_offset_changed_handler)(ScrollLayer *scroll_layer, void *context);
+} ScrollLayerCallbacks;
+
+Layer *window_get_root_layer(const Window *window);
+GRect layer_get_bounds(const Layer *layer);
+GRect layer_get_frame(const Layer *layer);
+void layer_set_frame(Layer *layer, GRect frame);
+void layer_mark_dirty(Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_set_hidden(Layer *layer, bool hidden);
+Window *window_create(void);
+void window_destroy(Window *window);
+void window_set_background_color(Window *window, GColor background_color);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_stack_push(Window *window, bool animated);
+bool window_stack_remove(Window *window, bool animated);
+Window *window_stack_get_top_window(void);
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+void window_single_repeating_click_subscribe(ButtonId button_id, uint16_t repeat_interval_ms, ClickHandler handler);
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler, ClickHandler up_handler);
+void window_set_user_data(Window *window, void *data);
+void *window_get_user_data(const Window *window);
+MenuLayer *menu_layer_create(GRect frame);
+void menu_layer_destroy(MenuLayer *menu_layer);
+void menu_layer_pad_bottom_enable(MenuLayer *menu_layer, bool enable);
+void menu_layer_set_callbacks(MenuLayer *menu_layer, void *callback_context, MenuLayerCallbacks callbacks);
+Layer *menu_layer_get_layer(const MenuLayer *menu_layer);
+void menu_layer_set_highlight_colors(MenuLayer *menu_layer, GColor background, GColor foreground);
+void menu_layer_set_normal_colors(MenuLayer *menu_layer, GColor background, GColor foreground);
+void menu_layer_set_selected_index(MenuLayer *menu_layer, MenuIndex index, MenuRowAlign scroll_align, bool animated);
+MenuIndex menu_layer_get_selected_index(const MenuLayer *menu_layer);
+void menu_layer_set_selected_next(MenuLayer *menu_layer, bool up, MenuRowAlign scroll_align, bool animated);
+bool menu_layer_is_index_selected(const MenuLayer *menu_layer, MenuIndex *index);
+void menu_layer_reload_data(MenuLayer *menu_layer);
+void menu_layer_set_click_config_onto_window(MenuLayer *menu_layer, Window *window);
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_overflow_mode(TextLayer *text_layer, GTextOverflowMode line_mode);
+GSize text_layer_get_content_size(TextLayer *text_layer);
+BitmapLayer *bitmap_layer_create(GRect frame);
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+void bitmap_layer_set_alignment(BitmapLayer *bitmap_layer, GAlign alignment);
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode);
+ActionBarLayer *action_bar_layer_create(void);
+void action_bar_layer_destroy(ActionBarLayer *action_bar);
+Layer *action_bar_layer_get_layer(ActionBarLayer *action_bar);
+void action_bar_layer_set_icon(ActionBarLayer *action_bar, ButtonId button_id, const GBitmap *icon);
+void action_bar_layer_set_icon_animated(ActionBarLayer *action_bar, ButtonId button_id, const GBitmap *icon, bool animated);
+void action_bar_layer_set_background_color(ActionBarLayer *action_bar, GColor background_color);
+void action_bar_layer_set_click_config_provider(ActionBarLayer *action_bar, ClickConfigProvider click_config_provider);
+void action_bar_layer_add_to_window(ActionBarLayer *action_bar, Window *window);
+ScrollLayer *scroll_layer_create(GRect frame);
+void scroll_layer_destroy(ScrollLayer *scroll_layer);
+Layer *scroll_layer_get_layer(const ScrollLayer *scroll_layer);
+void scroll_layer_set_callbacks(ScrollLayer *scroll_layer, ScrollLayerCallbacks callbacks);
+void scroll_layer_set_click_config_onto_window(ScrollLayer *scroll_layer, Window *window);
+void scroll_layer_add_child(ScrollLayer *scroll_layer, Layer *child);
+void scroll_layer_set_content_size(ScrollLayer *scroll_layer, GSize size);
+
+// services
+typedef struct { uint32_t *durations; uint32_t num_segments; } VibePattern;
+typedef struct {
+  void (*pebblekit_connection_handler)(bool connected);
+  void (*app_connection_handler)(bool connected);
+} ConnectionHandlers;
+void vibes_enqueue_custom_pattern(VibePattern pattern);
+void light_enable_interaction(void);
+void connection_service_subscribe(ConnectionHandlers conn_handlers);
+void connection_service_unsubscribe(void);
+bool connection_service_peek_pebblekit_connection(void);
+void app_event_loop(void);
+
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer_handle);
+time_t time(time_t *tloc);
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms);
+size_t heap_bytes_free(void);
+size_t heap_bytes_used(void);
+
+// dictionaries, serialized as on the watch: a tuple count, then each tuple's key, type, length and value
+typedef enum { TUPLE_BYTE_ARRAY = 0, TUPLE_CSTRING = 1, TUPLE_UINT = 2, TUPLE_INT = 3 } TupleType;
+typedef struct __attribute__((__packed__)) {
+  uint32_t key;
+  TupleType type:8;
+  uint16_t length;
+  union {
+    uint8_t data[0];
+    char cstring[0];
+    uint8_t uint8;
+    uint16_t uint16;
+    uint32_t uint32;
+    int8_t int8;
+    int16_t int16;
+    int32_t int32;
+  } value[];
+} Tuple;
+typedef struct __attribute__((__packed__)) {
+  uint8_t count;
+  Tuple head[];
+} Dictionary;
+typedef struct {
+  Dictionary *dictionary;
+  const void *end;
+  Tuple *cursor;
+} DictionaryIterator;
+typedef enum {
+  DICT_OK = 0, DICT_NOT_ENOUGH_STORAGE = 1 << 1, DICT_INVALID_ARGS = 1 << 2, DICT_INTERNAL_INCONSISTENCY = 1 << 3
+} DictionaryResult;
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *const buffer, const uint16_t size);
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *const data, const uint16_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *const cstring);
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value);
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value);
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value);
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value);
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value);
+uint32_t dict_write_end(DictionaryIterator *iter);
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *const buffer, const uint16_t size);
+Tuple *dict_read_first(DictionaryIterator *iter);
+Tuple *dict_read_next(DictionaryIterator *iter);
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key);
+
+typedef enum {
+  APP_MSG_OK = 0, APP_MSG_SEND_TIMEOUT = 1 << 1, APP_MSG_SEND_REJECTED = 1 << 2, APP_MSG_NOT_CONNECTED = 1 << 3,
+  APP_MSG_APP_NOT_RUNNING = 1 << 4, APP_MSG_INVALID_ARGS = 1 << 5, APP_MSG_BUSY = 1 << 6,
+  APP_MSG_BUFFER_OVERFLOW = 1 << 7, APP_MSG_ALREADY_RELEASED = 1 << 9, APP_MSG_CALLBACK_ALREADY_REGISTERED = 1 << 10,
+  APP_MSG_CALLBACK_NOT_REGISTERED = 1 << 11, APP_MSG_OUT_OF_MEMORY = 1 << 12, APP_MSG_CLOSED = 1 << 13,
+  APP_MSG_INTERNAL_ERROR = 1 << 14, APP_MSG_INVALID_STATE = 1 << 15
+} AppMessageResult;
+typedef void (*AppMessageInboxReceived)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageInboxDropped)(AppMessageResult reason, void *context);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator, AppMessageResult reason, void *context);
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound);
+uint32_t app_message_inbox_size_maximum(void);
+uint32_t app_message_outbox_size_maximum(void);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback);
+void app_message_deregister_callbacks(void);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+
+typedef enum { S_SUCCESS = 0, E_ERROR = -1, E_INVALID_ARGUMENT = -2, E_OUT_OF_STORAGE = -7, E_DOES_NOT_EXIST = -10 } StatusCode;
+bool persist_exists(const uint32_t key);
+int persist_get_size(const uint32_t key);
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size);
+int persist_write_data(const uint32_t key, const void *data, const size_t size);
+int32_t persist_read_int(const uint32_t key);
+StatusCode persist_write_int(const uint32_t key, const int32_t value);
+bool persist_read_bool(const uint32_t key);
+StatusCode persist_write_bool(const uint32_t key, const bool value);
+StatusCode persist_delete(const uint32_t key);
@@ -0,0 +1,26 @@
+// Message keys of package.json numbered the way the pebble sdk numbers them, shared by the generated
+// message_keys.auto.h/.c of the host build and by the node harnesses.
+// Usage: node message_keys.js h|c > out
+var path = require('path');
+
+var MESSAGE_KEY_BASE = 10000;
+
+var names = require(path.join(__dirname, '../../package.json')).pebble.messageKeys.map(function(key) {
+  return key.split('[')[0];
+});
+
+var keys = {};
+names.forEach(function(name, i) { keys[name] = MESSAGE_KEY_BASE + i; });
+
+module.exports = keys;
+
+if (require.main === module) {
+  var lines = ['// generated from package.json by message_keys.js', '#pragma once', '#include <stdint.h>'];
+  if (process.argv[2] == 'c') {
+    lines = ['// generated from package.json by message_keys.js', '#include <stdint.h>'];
+    names.forEach(function(name) { lines.push('const uint32_t MESSAGE_KEY_' + name + ' = ' + keys[name] + ';'); });
+  } else {
+    names.forEach(function(name) { lines.push('extern const uint32_t MESSAGE_KEY_' + name + ';'); });
+  }
+  console.log(lines.join('\n'));
+}
@@ -0,0 +1,551 @@
+// Host implementation of the pebble sdk calls made by src/c/modules, see include/pebble.h
+#define HOST_HEAP_INTERNAL
+#include <pebble.h>
+#include <stdarg.h>
+#include "host.h"
+
+// heap
+
+typedef struct {
+  size_t size;
+  // keeps the block after the header as aligned as malloc's
+  max_align_t align;
+} HeapHeader;
+
+static HostHeapStats s_heap = {.limit = HOST_HEAP_DEFAULT};
+
+void host_heap_init(size_t limit) {
+  s_heap.limit = limit;
+  host_heap_mark();
+}
+
+HostHeapStats *host_heap_stats() {
+  return &s_heap;
+}
+
+void host_heap_mark() {
+  s_heap.peak = s_heap.used;
+  s_heap.allocations = 0;
+  s_heap.failures = 0;
+}
+
+void *host_malloc(size_t size) {
+  if (s_heap.used > s_heap.limit || size > s_heap.limit - s_heap.used) {
+    s_heap.failures++;
+    return NULL;
+  }
+  HeapHeader *header = malloc(sizeof(HeapHeader) + size);
+  if (!header) { return NULL; }
+  header->size = size;
+  s_heap.used += size;
+  s_heap.peak = (s_heap.used > s_heap.peak) ? s_heap.used : s_heap.peak;
+  s_heap.allocations++;
+  return &header[1];
+}
+
+void *host_calloc(size_t count, size_t size) {
+  void *ptr = host_malloc(count * size);
+  if (ptr) { memset(ptr, 0, count * size); }
+  return ptr;
+}
+
+void host_free(void *ptr) {
+  if (!ptr) { return; }
+  HeapHeader *header = &((HeapHeader*) ptr)[-1];
+  s_heap.used -= header->size;
+  free(header);
+}
+
+void *host_realloc(void *ptr, size_t size) {
+  void *resized = host_malloc(size);
+  if (!resized || !ptr) { return resized; }
+  size_t old_size = ((HeapHeader*) ptr)[-1].size;
+  memcpy(resized, ptr, (old_size < size) ? old_size : size);
+  host_free(ptr);
+  return resized;
+}
+
+size_t heap_bytes_free() {
+  return (s_heap.used < s_heap.limit) ? s_heap.limit - s_heap.used : 0;
+}
+
+size_t heap_bytes_used() {
+  return s_heap.used;
+}
+
+// logging
+
+static bool s_log_enabled = false;
+
+void host_log_enable(bool enabled) {
+  s_log_enabled = enabled;
+}
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+  if (!s_log_enabled) { return; }
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[%u] %s:%d ", (unsigned) host_time_now(), src_filename, src_line_number);
+  vfprintf(stderr, fmt, args);
+  fputc('\n', stderr);
+  va_end(args);
+}
+
+// timers, kept in a list in the order they were registered
+
+struct AppTimer {
+  uint32_t due;
+  AppTimerCallback callback;
+  void *data;
+  AppTimer *next;
+};
+
+static AppTimer *s_timers = NULL;
+static uint32_t s_now = 0;
+
+uint32_t host_time_now() {
+  return s_now;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  AppTimer *timer = malloc(sizeof(AppTimer));
+  *timer = (AppTimer) {.due = s_now + timeout_ms, .callback = callback, .data = callback_data, .next = s_timers};
+  s_timers = timer;
+  return timer;
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+  for(AppTimer *timer = s_timers; timer; timer = timer->next) {
+    if (timer == timer_handle) {
+      timer->due = s_now + new_timeout_ms;
+      return true;
+    }
+  }
+  return false;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+  for(AppTimer **timer = &s_timers; *timer; timer = &(*timer)->next) {
+    if (*timer == timer_handle) {
+      *timer = timer_handle->next;
+      free(timer_handle);
+      return;
+    }
+  }
+}
+
+uint32_t host_time_next() {
+  uint32_t next = UINT32_MAX;
+  for(AppTimer *timer = s_timers; timer; timer = timer->next) {
+    uint32_t wait = (timer->due > s_now) ? timer->due - s_now : 0;
+    next = (wait < next) ? wait : next;
+  }
+  return next;
+}
+
+void host_time_advance(uint32_t ms) {
+  uint32_t end = s_now + ms;
+  for(;;) {
+    // the earliest due timer, the oldest of those due at once
+    AppTimer **earliest = NULL;
+    for(AppTimer **timer = &s_timers; *timer; timer = &(*timer)->next) {
+      if ((*timer)->due <= end && (!earliest || (*timer)->due <= (*earliest)->due)) { earliest = timer; }
+    }
+    if (!earliest) { break; }
+    AppTimer *timer = *earliest;
+    *earliest = timer->next;
+    s_now = (timer->due > s_now) ? timer->due : s_now;
+    AppTimerCallback callback = timer->callback;
+    void *data = timer->data;
+    free(timer);
+    callback(data);
+  }
+  s_now = end;
+}
+
+time_t time(time_t *tloc) {
+  time_t now = s_now / 1000;
+  if (tloc) { *tloc = now; }
+  return now;
+}
+
+uint16_t time_ms(time_t *t_utc, uint16_t *out_ms) {
+  if (t_utc) { *t_utc = s_now / 1000; }
+  if (out_ms) { *out_ms = s_now % 1000; }
+  return s_now % 1000;
+}
+
+// dictionaries
+
+static uint32_t s_dict_overflows = 0;
+
+uint32_t host_dict_overflows() {
+  return s_dict_overflows;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *const buffer, const uint16_t size) {
+  if (!iter || !buffer || size < sizeof(Dictionary)) { return DICT_INVALID_ARGS; }
+  iter->dictionary = (Dictionary*) buffer;
+  iter->dictionary->count = 0;
+  iter->cursor = iter->dictionary->head;
+  iter->end = buffer + size;
+  return DICT_OK;
+}
+
+static DictionaryResult dict_write_tuple(DictionaryIterator *iter, const uint32_t key, TupleType type,
+                                         const void *data, const uint16_t size) {
+  uint8_t *value = (uint8_t*) iter->cursor + sizeof(Tuple);
+  if (value + size > (uint8_t*) iter->end) {
+    s_dict_overflows++;
+    return DICT_NOT_ENOUGH_STORAGE;
+  }
+  iter->cursor->key = key;
+  iter->cursor->type = type;
+  iter->cursor->length = size;
+  memcpy(value, data, size);
+  iter->cursor = (Tuple*) (value + size);
+  iter->dictionary->count++;
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t *const data, const uint16_t size) {
+  return dict_write_tuple(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char *const cstring) {
+  return dict_write_tuple(iter, key, TUPLE_CSTRING, cstring, cstring ? strlen(cstring) + 1 : 0);
+}
+
+// the watch and pebblekit are both little endian, so integers are written as they are held
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+  return dict_write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value) {
+  return dict_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+  return dict_write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+  iter->end = iter->cursor;
+  return (uint8_t*) iter->end - (uint8_t*) iter->dictionary;
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *const buffer, const uint16_t size) {
+  iter->dictionary = (Dictionary*) buffer;
+  iter->end = buffer + size;
+  return dict_read_first(iter);
+}
+
+static bool dict_tuple_fits(DictionaryIterator *iter, Tuple *tuple) {
+  uint8_t *end = (uint8_t*) iter->end;
+  return (uint8_t*) tuple + sizeof(Tuple) <= end && (uint8_t*) tuple + sizeof(Tuple) + tuple->length <= end;
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+  iter->cursor = iter->dictionary->head;
+  if ((uint8_t*) iter->end < (uint8_t*) iter->dictionary + sizeof(Dictionary) || iter->dictionary->count == 0 ||
+      !dict_tuple_fits(iter, iter->cursor)) { return NULL; }
+  return iter->cursor;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+  Tuple *next = (Tuple*) ((uint8_t*) iter->cursor + sizeof(Tuple) + iter->cursor->length);
+  if (!dict_tuple_fits(iter, next)) { return NULL; }
+  iter->cursor = next;
+  return next;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+  DictionaryIterator search = *iter;
+  for(Tuple *tuple = dict_read_first(&search); tuple; tuple = dict_read_next(&search)) {
+    if (tuple->key == key) { return tuple; }
+  }
+  return NULL;
+}
+
+// app message, the inbox is handed whatever the harness delivers and the outbox holds one message until the
+// harness completes it
+
+static AppMessageInboxReceived s_inbox_received;
+static AppMessageInboxDropped s_inbox_dropped;
+static AppMessageOutboxSent s_outbox_sent;
+static AppMessageOutboxFailed s_outbox_failed;
+static uint32_t s_inbox_size = 0;
+static uint32_t s_inbox_maximum = HOST_INBOX_MAX;
+static uint32_t s_outbox_size = 0;
+// both buffers come out of the app heap as on the watch
+static uint8_t *s_inbox_buffer = NULL;
+static uint8_t *s_outbox_buffer = NULL;
+static DictionaryIterator s_outbox;
+static bool s_outbox_open = false;
+static bool s_outbox_sending = false;
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+  if (size_inbound > s_inbox_maximum || size_outbound > APP_MESSAGE_OUTBOX_SIZE_MINIMUM * 13) { return APP_MSG_OUT_OF_MEMORY; }
+  host_free(s_inbox_buffer);
+  host_free(s_outbox_buffer);
+  s_inbox_buffer = host_malloc(size_inbound);
+  s_outbox_buffer = host_malloc(size_outbound);
+  if (!s_inbox_buffer || !s_outbox_buffer) { return APP_MSG_OUT_OF_MEMORY; }
+  s_inbox_size = size_inbound;
+  s_outbox_size = size_outbound;
+  s_outbox_open = false;
+  s_outbox_sending = false;
+  return APP_MSG_OK;
+}
+
+uint32_t app_message_inbox_size_maximum() {
+  return s_inbox_maximum;
+}
+
+void host_inbox_maximum(uint32_t size) {
+  s_inbox_maximum = size;
+}
+
+uint32_t app_message_outbox_size_maximum() {
+  return APP_MESSAGE_OUTBOX_SIZE_MINIMUM * 13;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+  AppMessageInboxReceived previous = s_inbox_received;
+  s_inbox_received = received_callback;
+  return previous;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback) {
+  AppMessageInboxDropped previous = s_inbox_dropped;
+  s_inbox_dropped = dropped_callback;
+  return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+  AppMessageOutboxSent previous = s_outbox_sent;
+  s_outbox_sent = sent_callback;
+  return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+  AppMessageOutboxFailed previous = s_outbox_failed;
+  s_outbox_failed = failed_callback;
+  return previous;
+}
+
+void app_message_deregister_callbacks() {
+  s_inbox_received = NULL;
+  s_inbox_dropped = NULL;
+  s_outbox_sent = NULL;
+  s_outbox_failed = NULL;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+  if (!s_outbox_buffer) { return APP_MSG_INVALID_STATE; }
+  if (s_outbox_open || s_outbox_sending) { return APP_MSG_BUSY; }
+  dict_write_begin(&s_outbox, s_outbox_buffer, s_outbox_size);
+  s_outbox_open = true;
+  *iterator = &s_outbox;
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send() {
+  if (!s_outbox_open) { return APP_MSG_INVALID_STATE; }
+  s_outbox_open = false;
+  s_outbox_sending = true;
+  return APP_MSG_OK;
+}
+
+DictionaryIterator *host_outbox_pending(uint16_t *size) {
+  if (!s_outbox_sending) { return NULL; }
+  if (size) { *size = (uint8_t*) s_outbox.end - (uint8_t*) s_outbox.dictionary; }
+  return &s_outbox;
+}
+
+void host_outbox_complete(AppMessageResult result) {
+  if (!s_outbox_sending) { return; }
+  s_outbox_sending = false;
+  if (result == APP_MSG_OK) {
+    if (s_outbox_sent) { s_outbox_sent(&s_outbox, NULL); }
+  } else if (s_outbox_failed) {
+    s_outbox_failed(&s_outbox, result, NULL);
+  }
+}
+
+AppMessageResult host_inbox_deliver(const uint8_t *data, uint16_t size) {
+  AppMessageResult result = APP_MSG_OK;
+  if (size > s_inbox_size) {
+    result = APP_MSG_BUFFER_OVERFLOW;
+  } else if (!s_inbox_received || !s_inbox_buffer) {
+    result = APP_MSG_CALLBACK_NOT_REGISTERED;
+  }
+  if (result != APP_MSG_OK) {
+    if (s_inbox_dropped) { s_inbox_dropped(result, NULL); }
+    return result;
+  }
+  // the watch receives into its own buffer, so the app can't keep pointers into the sender's
+  memcpy(s_inbox_buffer, data, size);
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, s_inbox_buffer, size);
+  s_inbox_received(&iter, NULL);
+  return result;
+}
+
+// persistent storage, each key holds up to PERSIST_DATA_MAX_LENGTH bytes
+
+#define HOST_PERSIST_KEYS 32
+
+typedef struct {
+  bool exists;
+  uint32_t key;
+  uint16_t size;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+
+static PersistEntry s_persist[HOST_PERSIST_KEYS];
+
+static PersistEntry *persist_entry(const uint32_t key, bool create) {
+  PersistEntry *empty = NULL;
+  for(uint8_t i=0; i < HOST_PERSIST_KEYS; i++) {
+    if (s_persist[i].exists && s_persist[i].key == key) { return &s_persist[i]; }
+    if (!s_persist[i].exists && !empty) { empty = &s_persist[i]; }
+  }
+  if (!create || !empty) { return NULL; }
+  *empty = (PersistEntry) {.exists = true, .key = key};
+  return empty;
+}
+
+bool persist_exists(const uint32_t key) {
+  return persist_entry(key, false) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+  PersistEntry *entry = persist_entry(key, false);
+  return (entry) ? entry->size : E_DOES_NOT_EXIST;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+  PersistEntry *entry = persist_entry(key, false);
+  if (!entry) { return E_DOES_NOT_EXIST; }
+  size_t size = (entry->size < buffer_size) ? entry->size : buffer_size;
+  memcpy(buffer, entry->data, size);
+  return size;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+  PersistEntry *entry = persist_entry(key, true);
+  if (!entry) { return E_OUT_OF_STORAGE; }
+  entry->size = (size < PERSIST_DATA_MAX_LENGTH) ? size : PERSIST_DATA_MAX_LENGTH;
+  memcpy(entry->data, data, entry->size);
+  return entry->size;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+StatusCode persist_write_int(const uint32_t key, const int32_t value) {
+  return (persist_write_data(key, &value, sizeof(value)) < 0) ? E_OUT_OF_STORAGE : S_SUCCESS;
+}
+
+bool persist_read_bool(const uint32_t key) {
+  return persist_read_int(key) != 0;
+}
+
+StatusCode persist_write_bool(const uint32_t key, const bool value) {
+  return persist_write_int(key, value);
+}
+
+StatusCode persist_delete(const uint32_t key) {
+  PersistEntry *entry = persist_entry(key, false);
+  if (!entry) { return E_DOES_NOT_EXIST; }
+  entry->exists = false;
+  return S_SUCCESS;
+}
+
+// bitmaps hold real pixel buffers, allocated from the app heap as on the watch
+
+// png icons are decoded to this size, about what the watch would allocate for them
+#define HOST_PNG_SIZE 25
+
+struct GBitmap {
+  GSize size;
+  GBitmapFormat format;
+  uint16_t row_size;
+  uint8_t *data;
+  GColor *palette;
+  bool free_palette;
+};
+
+static uint8_t gbitmap_bits(GBitmapFormat format) {
+  switch(format) {
+    case GBitmapFormat1Bit:
+    case GBitmapFormat1BitPalette: return 1;
+    case GBitmapFormat2BitPalette: return 2;
+    case GBitmapFormat4BitPalette: return 4;
+    default: return 8;
+  }
+}
+
+GBitmap *gbitmap_create_blank_with_palette(GSize size, GBitmapFormat format, GColor *palette, bool free_on_destroy) {
+  uint16_t row_size = (size.w * gbitmap_bits(format) + 7) / 8;
+  // 1 bit rows are padded to a multiple of 4 bytes
+  if (format == GBitmapFormat1Bit) { row_size = (row_size + 3) & ~3; }
+  GBitmap *bitmap = host_malloc(sizeof(GBitmap) + row_size * size.h);
+  if (!bitmap) { return NULL; }
+  *bitmap = (GBitmap) {.size = size, .format = format, .row_size = row_size, .data = (uint8_t*) &bitmap[1],
+                       .palette = palette, .free_palette = free_on_destroy};
+  memset(bitmap->data, 0, row_size * size.h);
+  return bitmap;
+}
+
+GBitmap *gbitmap_create_blank(GSize size, GBitmapFormat format) {
+  return gbitmap_create_blank_with_palette(size, format, NULL, false);
+}
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+  return gbitmap_create_blank(GSize(HOST_PNG_SIZE, HOST_PNG_SIZE), GBitmapFormat8Bit);
+}
+
+GBitmap *gbitmap_create_from_png_data(const uint8_t *png_data, size_t png_data_size) {
+  static const uint8_t signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+  if (png_data_size < sizeof(signature) || memcmp(png_data, signature, sizeof(signature)) != 0) { return NULL; }
+  return gbitmap_create_blank(GSize(HOST_PNG_SIZE, HOST_PNG_SIZE), GBitmapFormat8Bit);
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+  if (!bitmap) { return; }
+  if (bitmap->free_palette) { host_free(bitmap->palette); }
+  host_free(bitmap);
+}
+
+GRect gbitmap_get_bounds(const GBitmap *bitmap) {
+  return GRect(0, 0, bitmap->size.w, bitmap->size.h);
+}
+
+uint8_t *gbitmap_get_data(const GBitmap *bitmap) {
+  return bitmap->data;
+}
+
+uint16_t gbitmap_get_bytes_per_row(const GBitmap *bitmap) {
+  return bitmap->row_size;
+}
+
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap) {
+  return bitmap->format;
+}
+
+GColor *gbitmap_get_palette(const GBitmap *bitmap) {
+  return bitmap->palette;
+}
@@ -0,0 +1,110 @@
+// Loads src/pkjs/index.js into its own context with a stand-in for the Pebble object, localStorage and
+// XMLHttpRequest, so its functions and state can be driven from node
+var fs = require('fs');
+var path = require('path');
+var vm = require('vm');
+var messageKeys = require('./message_keys');
+
+var PKJS = path.join(__dirname, '../../src/pkjs');
+
+//! @param options platform, the watch platform (basalt by default), sendAppMessage(dict, success, failure), in
+//! place of a pebblekit that acks every message straight away, tiles, a tiles object to store as the config and
+//! xhr(request), called with {method, url, data, respond(status, body)} for each request made, and clock, an
+//! object with setTimeout, clearTimeout, setInterval, clearInterval and Date to use in place of node's
+//! @return {context, listeners, storage, emit(event, payload), evaluate(code)}, evaluate reaches the consts of
+//! index.js, which unlike its vars and functions aren't properties of context
+function load(options) {
+  options = options || {};
+  var storage = {};
+  var listeners = {};
+  var watchInfo = {"platform": options.platform || 'basalt', "model": 'qemu_platform_' + (options.platform || 'basalt')};
+
+  var clock = options.clock || {
+    setTimeout: setTimeout, clearTimeout: clearTimeout, setInterval: setInterval, clearInterval: clearInterval,
+    Date: Date
+  };
+  var context = {
+    console: console, setTimeout: clock.setTimeout, clearTimeout: clock.clearTimeout,
+    setInterval: clock.setInterval, clearInterval: clock.clearInterval, Date: clock.Date,
+    localStorage: {
+      getItem: function(key) { return (key in storage) ? storage[key] : null; },
+      setItem: function(key, value) { storage[key] = String(value); },
+      removeItem: function(key) { delete storage[key]; }
+    },
+    Pebble: {
+      getActiveWatchInfo: function() { return watchInfo; },
+      addEventListener: function(event, callback) { listeners[event] = callback; },
+      sendAppMessage: options.sendAppMessage || function(dict, success, failure) {
+        if (success) { setImmediate(function() { success({"data": dict}); }); }
+      },
+      openURL: function() {},
+      showSimpleNotificationOnPebble: function() {}
+    },
+    XMLHttpRequest: function() {
+      var request = this;
+      request.open = function(method, url) { request.method = method; request.url = url; };
+      request.setRequestHeader = function() {};
+      request.send = function(data) {
+        if (!options.xhr) { return; }
+        request.data = data;
+        request.respond = function(status, body) {
+          request.status = status;
+          request.readyState = 4;
+          request.responseText = body;
+          if (request.onload) { request.onload(); }
+          if (request.onreadystatechange) { request.onreadystatechange(); }
+        };
+        options.xhr(request);
+      };
+    }
+  };
+  context.window = context;
+  context.require = function(name) {
+    if (name == 'message_keys') { return messageKeys; }
+    if (name == 'buffer/') { return require('buffer'); }
+    if (name == 'pebble-clay') { return function() { this.generateUrl = function() { return ''; }; }; }
+    if (name.charAt(0) != '.') { return {}; }
+    try {
+      return require(path.join(PKJS, name));
+    } catch(e) {
+      // icons would quietly go out as png and bitmap.js would never run
+      if (name == './bitmap') { throw new Error('bitmap.js needs tiny-inflate, run npm install: ' + e.message); }
+      return {};
+    }
+  };
+  vm.createContext(context);
+  if (options.tiles) { storage['tiles'] = JSON.stringify(options.tiles); }
+  vm.runInContext(fs.readFileSync(path.join(PKJS, 'index.js'), 'utf8'), context, {filename: 'index.js'});
+
+  return {
+    context: context,
+    listeners: listeners,
+    storage: storage,
+    emit: function(event, payload) {
+      if (listeners[event]) { listeners[event]({"payload": payload}); }
+    },
+    evaluate: function(code) { return vm.runInContext(code, context); }
+  };
+}
+
+//! A config of count tiles that looks like a typical one, named after their index
+function sampleTiles(count, defaultIdx) {
+  var tiles = [];
+  for (var i = 0; i < count; i++) {
+    tiles.push({
+      "payload": {
+        "color": '#0055aa',
+        "highlight": '#00aaff',
+        "texts": ['Light ' + i, '', 'ON', '', 'OFF', '', 'Living room light ' + i],
+        "icon_keys": ['77de68da', '', '356a192b', '', 'da4b9237', '', '77de68da']
+      },
+      "buttons": {
+        "up": {"method": 'PUT', "url": 'lights/' + i, "data": {"on": true}, "coalesce": i % 2 == 0},
+        "down": {"method": 'PUT', "url": 'lights/' + i, "data": {"on": false}}
+      }
+    });
+  }
+  return {"default_idx": defaultIdx || 0, "open_default": false, "base_url": 'http://localhost/', "tiles": tiles};
+}
+
+module.exports = {load: load, sampleTiles: sampleTiles};
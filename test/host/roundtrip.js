@@ -0,0 +1,251 @@
+// Round trips tile blobs from index.js through the watch's decoder, build/decode from decode.c, and checks every
+// tile comes back with the strings and hash pebblekit sent. Covers the edges of the string table format: empty
+// tables, a single tile, a back reference from the far end of a full table, tables at the limit of their
+// 16 bit offsets, windows shrunk for a refused transfer and windows cut down to fit the tile cache.
+// Usage: node roundtrip.js [decode binary]
+var assert = require('assert');
+var childProcess = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var pebblekit = require('./pebblekit');
+
+var DECODE = process.argv[2] || path.join(__dirname, 'build', 'decode');
+var OUT = path.join(__dirname, 'build', 'roundtrip');
+// strings of each tile that go in the button table, see isMenuString() in index.js
+var BUTTON_STRINGS = [0, 1, 2, 3, 4, 5, 7, 8, 9, 10, 11, 12];
+// the only string starting with its first 3 bytes twice, so compressTable() can only match it with the first
+var MARKER = '#MAX#DISTANCE#';
+fs.mkdirSync(OUT, {recursive: true});
+
+//! @return The blobs pebblekit hands processData() while send runs
+function capture(pkjs, send) {
+  var sent = [];
+  var processData = pkjs.context.processData;
+  pkjs.context.processData = function(data, type) { sent.push({"data": Array.prototype.slice.call(data), "type": type}); };
+  send();
+  pkjs.context.processData = processData;
+  return sent;
+}
+
+//! @param options Arguments for the decoder ahead of the blobs, --cache for example
+function decode(name, blobs, options) {
+  var files = blobs.map(function(blob, i) {
+    var file = path.join(OUT, name.replace(/\W+/g, '_') + '_' + i + '.bin');
+    fs.writeFileSync(file, Buffer.from(blob.data));
+    return file;
+  });
+  var result = childProcess.spawnSync(DECODE, (options || []).concat(files), {"encoding": 'utf8', "maxBuffer": 64 * 1024 * 1024});
+  if (result.status !== 0) { throw new Error(DECODE + ' failed: ' + (result.error || result.stderr)); }
+  return JSON.parse(result.stdout);
+}
+
+//! The menu and button tables of a TILE_FORMAT_TABLE blob, see stringTable() in index.js
+function tables(blob, ptr) {
+  var found = [];
+  for (var i = 0; i < 2; i++) {
+    var table = {"flags": blob[ptr], "size": blob[ptr + 1] | blob[ptr + 2] << 8,
+                 "storedSize": blob[ptr + 3] | blob[ptr + 4] << 8};
+    table.stored = blob.slice(ptr + 5, ptr + 5 + table.storedSize);
+    found.push(table);
+    ptr += 5 + table.storedSize;
+  }
+  return found;
+}
+
+//! Expands a table compressed by compressTable(), as data_tile_table_expand() does
+//! @return {bytes, maxDistance}
+function expand(stored) {
+  var bytes = [], maxDistance = 0;
+  for (var i = 0; i < stored.length;) {
+    var token = stored[i++];
+    if (token < 0x80) {
+      bytes = bytes.concat(stored.slice(i, i + token + 1));
+      i += token + 1;
+    } else {
+      var distance = stored[i] | stored[i + 1] << 8;
+      i += 2;
+      assert(distance > 0 && distance <= bytes.length, 'distance ' + distance + ' at ' + bytes.length);
+      maxDistance = Math.max(maxDistance, distance);
+      for (var j = 0; j < (token & 0x7f) + 3; j++) { bytes.push(bytes[bytes.length - distance]); }
+    }
+  }
+  return {"bytes": bytes, "maxDistance": maxDistance};
+}
+
+//! Checks the watch holds the window pebblekit sent, each tile with the strings and hash pebblekit gave it
+//! @param used Tiles the watch should hold, the window pebblekit sent if not given
+function check(name, pkjs, tiles, decoded, used) {
+  var context = pkjs.context;
+  var buffer = new Uint8Array(1000000);
+  assert(decoded.ok, name + ': the watch rejected the blob');
+  assert.strictEqual(decoded.total, tiles.tiles.length, name + ': total');
+  assert.strictEqual(decoded.used, (used == null) ? context.tileWindowSent : used, name + ': tiles held');
+  for (var i = 0; i < decoded.used; i++) {
+    var tile = tiles.tiles[decoded.first + i];
+    var strings = tile.payload.texts.concat(tile.payload.icon_keys);
+    assert.deepStrictEqual(decoded.tiles[i].strings, strings, name + ': strings of tile ' + (decoded.first + i));
+    var end = context.packTile(buffer, tile, 0);
+    assert.strictEqual(decoded.tiles[i].hash, context.fnv1a(buffer, 0, end), name + ': hash of tile ' + (decoded.first + i));
+  }
+}
+
+//! Tiles whose button strings are the given strings, in the order the button table interns them
+function tilesWithButtonStrings(strings) {
+  var tiles = pebblekit.sampleTiles(Math.ceil(strings.length / BUTTON_STRINGS.length), 0);
+  strings.forEach(function(string, k) {
+    var payload = tiles.tiles[Math.floor(k / BUTTON_STRINGS.length)].payload;
+    var j = BUTTON_STRINGS[k % BUTTON_STRINGS.length];
+    if (j < 7) { payload.texts[j] = string; } else { payload.icon_keys[j - 7] = string; }
+  });
+  return tiles;
+}
+
+//! count distinct button strings taking size bytes of table with their terminators, starting with first and
+//! ending with last. The ones between repeat a phrase so the table compresses
+function buttonStrings(count, size, first, last) {
+  var strings = [first];
+  var remaining = size - (first.length + 1) - (last.length + 1);
+  var between = count - 2;
+  for (var k = 0; k < between; k++) {
+    var length = Math.floor(remaining / (between - k)) - 1;
+    var string = 'Button ' + k + ' ';
+    while (string.length < length) { string += 'turn the lights on and off '; }
+    strings.push(string.slice(0, length));
+    remaining -= length + 1;
+  }
+  strings.push(last);
+  return strings;
+}
+
+//! Loads index.js with tiles as its config, with the table format and compression as given
+function load(tiles, compression) {
+  var pkjs = pebblekit.load({"tiles": tiles});
+  pkjs.context.TILE_FORMAT = pkjs.context.TILE_FORMAT_TABLE;
+  pkjs.context.TILE_COMPRESSION = compression;
+  return pkjs;
+}
+
+var cases = {
+  "empty tables": function() {
+    // a delta with nothing changed carries a menu and a button table with no strings in them
+    var tiles = pebblekit.sampleTiles(4, 0);
+    var pkjs = load(tiles, true);
+    var full = capture(pkjs, function() { pkjs.context.packTiles(); });
+    var decoded = decode('empty tables full', full);
+    var hashes = [];
+    decoded.tiles.forEach(function(tile) { for (var b = 0; b < 4; b++) { hashes.push(tile.hash >>> (b * 8) & 0xff); } });
+    var delta = capture(pkjs, function() { pkjs.context.packTiles(0, hashes, decoded.first, decoded.first); });
+    assert.strictEqual(delta[0].type, pkjs.evaluate('TransferType').TILE_DELTA);
+    var empty = tables(delta[0].data, 1 + 8 + 2 + 4 + 1);
+    assert.deepStrictEqual(empty.map(function(table) { return table.size; }), [0, 0]);
+    check('empty tables', pkjs, tiles, decode('empty tables', full.concat(delta)));
+
+    // and a table can hold nothing but empty strings
+    tiles.tiles.forEach(function(tile) {
+      tile.payload.texts = tile.payload.texts.map(function() { return ''; });
+      tile.payload.icon_keys = tile.payload.icon_keys.map(function() { return ''; });
+    });
+    pkjs = load(tiles, true);
+    var blob = capture(pkjs, function() { pkjs.context.packTiles(); });
+    assert.deepStrictEqual(tables(blob[0].data, 1 + 8).map(function(table) { return table.size; }), [1, 1]);
+    check('empty strings', pkjs, tiles, decode('empty strings', blob));
+  },
+
+  "single tile": function() {
+    [true, false].forEach(function(compression) {
+      var tiles = pebblekit.sampleTiles(1, 0);
+      var pkjs = load(tiles, compression);
+      check('single tile', pkjs, tiles, decode('single tile', capture(pkjs, function() { pkjs.context.packTiles(); })));
+      assert.strictEqual(pkjs.context.tileWindowSent, 1);
+    });
+  },
+
+  "maximum back reference distance": function() {
+    // the table is as large as its offsets allow, and ends with the start of its first string, the longest
+    // distance a reference into a table can cover
+    var strings = buttonStrings(64 * BUTTON_STRINGS.length, 0xffff, MARKER + 'x', MARKER);
+    var tiles = tilesWithButtonStrings(strings);
+    var pkjs = load(tiles, true);
+    var blob = capture(pkjs, function() { pkjs.context.packTiles(); });
+    var buttons = tables(blob[0].data, 1 + 8)[1];
+    assert.strictEqual(buttons.size, 0xffff);
+    assert(buttons.flags & pkjs.context.TILE_TABLE_COMPRESSED, 'button table left uncompressed');
+    var expanded = expand(buttons.stored);
+    assert.strictEqual(expanded.maxDistance, 0xffff - (MARKER.length + 1));
+    assert.strictEqual(expanded.bytes.length, 0xffff);
+    check('maximum back reference distance', pkjs, tiles, decode('maximum distance', blob));
+
+    // past 0xffff the distance doesn't fit its uint16, compressTable() sends such a repeat as literals
+    var bytes = [];
+    for (var i = 0; i < 0x10010; i++) { bytes.push((i < 3 || i >= 0x10000) ? 0x41 + i % 3 : 0x61 + (i * 7919 >> 3) % 26); }
+    var far = expand(pkjs.context.compressTable(bytes));
+    assert.deepStrictEqual(far.bytes, bytes);
+    assert(far.maxDistance <= 0xffff, 'distance ' + far.maxDistance);
+  },
+
+  "16 bit offset limit": function() {
+    // a table exactly as large as its offsets reach, stored as it is
+    var strings = buttonStrings(64 * BUTTON_STRINGS.length, 0xffff, 'First', 'Last');
+    var tiles = tilesWithButtonStrings(strings);
+    var pkjs = load(tiles, false);
+    var blob = capture(pkjs, function() { pkjs.context.packTiles(); });
+    var buttons = tables(blob[0].data, 1 + 8)[1];
+    assert.strictEqual(buttons.size, 0xffff);
+    assert.strictEqual(buttons.flags, pkjs.context.TILE_TABLE_WIDE);
+    assert.strictEqual(pkjs.context.tileWindowSent, 64);
+    check('16 bit offset limit', pkjs, tiles, decode('offset limit', blob));
+
+    // a byte more and the window is halved until the tables fit
+    tiles = tilesWithButtonStrings(buttonStrings(64 * BUTTON_STRINGS.length, 0x10000, 'First', 'Last'));
+    pkjs = load(tiles, false);
+    blob = capture(pkjs, function() { pkjs.context.packTiles(); });
+    assert.strictEqual(blob.length, 1);
+    assert.strictEqual(pkjs.context.tileWindowSent, 32);
+    check('past the 16 bit offset limit', pkjs, tiles, decode('past offset limit', blob));
+  },
+
+  "window grows back after a refusal": function() {
+    // a refused window keeps the next ones to half its size only until the watch reports the heap for it again
+    var tiles = pebblekit.sampleTiles(100, 0);
+    var pkjs = load(tiles, true);
+    var context = pkjs.context;
+    var size = capture(pkjs, function() { context.packTiles(); })[0].data.length;
+    assert.strictEqual(context.tileWindowSent, 64);
+    context.updateWatchLimits({"HeapFree": context.TRANSFER_HEAP_RESERVE + size * 2 - 2});
+    context.transferRefused(pkjs.evaluate('TransferType').TILE, size);
+    var blob = capture(pkjs, function() { context.packTiles(); });
+    assert(blob[0].data.length <= size / 2, 'window of ' + blob[0].data.length + ' bytes after a refusal of ' + size);
+    check('refused window', pkjs, tiles, decode('refused window', blob));
+    context.updateWatchLimits({"HeapFree": context.TRANSFER_HEAP_RESERVE + size * 2});
+    capture(pkjs, function() { context.packTiles(); });
+    assert.strictEqual(context.tileWindowSent, 64);
+  },
+
+  "cached window around default_idx": function() {
+    // a window too large for the tile cache is cut down to the tiles around default_idx
+    var tiles = pebblekit.sampleTiles(100, 50);
+    var pkjs = load(tiles, true);
+    var blob = capture(pkjs, function() { pkjs.context.packTiles(); });
+    var cached = decode('cached window', blob, ['--cache']);
+    assert(cached.used > 0 && cached.used < pkjs.context.tileWindowSent, 'cached ' + cached.used + ' tiles');
+    assert(cached.first <= 50 && 50 < cached.first + cached.used, 'default_idx outside ' + cached.first + '+' + cached.used);
+    assert(50 - cached.first >= (cached.used >> 1) - 1, 'default_idx off centre in ' + cached.first + '+' + cached.used);
+    check('cached window', pkjs, tiles, cached, cached.used);
+    // a window that fits is cached whole
+    tiles = pebblekit.sampleTiles(4, 2);
+    pkjs = load(tiles, true);
+    check('small cached window', pkjs, tiles, decode('small cached window', capture(pkjs, function() { pkjs.context.packTiles(); }), ['--cache']));
+  }
+};
+
+var failed = 0;
+Object.keys(cases).forEach(function(name) {
+  try {
+    cases[name]();
+    console.log('ok   ' + name);
+  } catch(e) {
+    failed++;
+    console.log('FAIL ' + name + ': ' + e.message);
+  }
+});
+process.exitCode = failed ? 1 : 0;
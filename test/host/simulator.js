@@ -0,0 +1,312 @@
+// Runs src/pkjs/index.js against the host build of the watch, build/watch from watch.c, over a simulated
+// bluetooth link on a virtual clock, and reports how long the tiles and the icons of the first screen take to
+// arrive. Messages take their size over the link's bandwidth plus its latency in either direction, a seeded
+// fraction of them are lost, and the watch's inbox is capped at --inbox bytes.
+// Usage: node simulator.js [--platform basalt] [--tiles 100] [--bandwidth 4000] [--latency 40] [--drop 0]
+//        [--inbox bytes] [--timeout 3000] [--seed 1] [--rows 4] [--limit 120000] [--watch build/watch]
+// Exits non zero if the tiles and icons haven't arrived within --limit ms
+var childProcess = require('child_process');
+var path = require('path');
+var readline = require('readline');
+var messageKeys = require('./message_keys');
+var pebblekit = require('./pebblekit');
+
+var options = {
+  "platform": 'basalt',
+  "tiles": 100,
+  // bytes per second each way
+  "bandwidth": 4000,
+  // ms each way
+  "latency": 40,
+  // fraction of messages lost each way
+  "drop": 0,
+  // largest inbox the watch can open, the platform's when not given
+  "inbox": null,
+  // ms pebblekit and the watch wait on an ack before failing a lost message
+  "timeout": 3000,
+  "seed": 1,
+  // menu rows on screen, from the selected one
+  "rows": 4,
+  // virtual ms to give up after
+  "limit": 120000,
+  "watch": null
+};
+for (var i = 2; i + 1 < process.argv.length; i += 2) {
+  var name = process.argv[i].replace(/^--/, '');
+  if (!(name in options)) { throw new Error('unknown option ' + process.argv[i]); }
+  options[name] = (name == 'platform' || name == 'watch') ? process.argv[i + 1] : Number(process.argv[i + 1]);
+}
+options.watch = options.watch || path.join(__dirname, 'build', (options.platform == 'aplite') ? 'watch_aplite' : 'watch');
+
+// bytes the pebble protocol wraps around the dictionary of each app message
+var LINK_OVERHEAD = 16;
+var APP_MSG_OK = 0;
+var APP_MSG_SEND_TIMEOUT = 2;
+// any fixed date does, handshake times are relative to when index.js was loaded
+var EPOCH = Date.UTC(2024, 0, 1);
+
+// virtual clock, events run in time order and in the order they were scheduled within the same ms
+var now = 0;
+var scheduled = 0;
+var events = [];
+
+function schedule(at, run) {
+  var event = {"at": Math.max(at, now), "order": scheduled++, "run": run, "cancelled": false};
+  var low = 0, high = events.length;
+  while (low < high) {
+    var mid = (low + high) >> 1;
+    if (events[mid].at <= event.at) { low = mid + 1; } else { high = mid; }
+  }
+  events.splice(low, 0, event);
+  return event;
+}
+
+function cancel(event) {
+  if (event) { event.cancelled = true; }
+}
+
+class VirtualDate extends Date {
+  constructor() {
+    if (arguments.length) { super(...arguments); } else { super(EPOCH + now); }
+  }
+  static now() { return EPOCH + now; }
+}
+
+var clock = {
+  "setTimeout": function(callback, ms) {
+    var args = Array.prototype.slice.call(arguments, 2);
+    return schedule(now + (ms || 0), function() { callback.apply(null, args); });
+  },
+  "clearTimeout": cancel,
+  "setInterval": function(callback, ms) {
+    var interval = {};
+    function tick() {
+      interval.event = schedule(now + Math.max(1, ms || 0), function() { tick(); callback(); });
+    }
+    tick();
+    return interval;
+  },
+  "clearInterval": function(interval) { if (interval) { cancel(interval.event); } },
+  "Date": VirtualDate
+};
+
+// xorshift32, the same losses for every run with the same --seed
+var randomState = options.seed || 1;
+function random() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >>> 17;
+  randomState ^= randomState << 5;
+  return (randomState >>> 0) / 4294967296;
+}
+
+// dictionaries serialized as the watch holds them, see Tuple in include/pebble.h
+var TUPLE_BYTE_ARRAY = 0, TUPLE_CSTRING = 1, TUPLE_UINT = 2, TUPLE_INT = 3;
+var keyNames = {};
+Object.keys(messageKeys).forEach(function(name) { keyNames[messageKeys[name]] = name; });
+
+function encode(dict) {
+  var tuples = [];
+  Object.keys(dict).forEach(function(name) {
+    var value = dict[name];
+    if (value == null) { return; }
+    var type = TUPLE_INT, data;
+    if (typeof value == 'string') {
+      type = TUPLE_CSTRING;
+      data = Buffer.concat([Buffer.from(value, 'utf8'), Buffer.from([0])]);
+    } else if (typeof value == 'object') {
+      type = TUPLE_BYTE_ARRAY;
+      data = Buffer.from(Array.prototype.map.call(value, function(byte) { return byte & 0xff; }));
+    } else {
+      // pebblekit sends numbers as int32
+      data = Buffer.alloc(4);
+      data.writeInt32LE(Number(value) | 0);
+    }
+    var header = Buffer.alloc(7);
+    header.writeUInt32LE((name in messageKeys) ? messageKeys[name] : Number(name));
+    header.writeUInt8(type, 4);
+    header.writeUInt16LE(data.length, 5);
+    tuples.push(header, data);
+  });
+  return Buffer.concat([Buffer.from([tuples.length / 2])].concat(tuples));
+}
+
+//! @return The payload pebblekit hands the appmessage listener, each value under its key's name
+function decode(bytes) {
+  var payload = {};
+  var ptr = 1;
+  for (var i = 0; i < bytes[0]; i++) {
+    var key = bytes.readUInt32LE(ptr), type = bytes[ptr + 4], length = bytes.readUInt16LE(ptr + 5);
+    var data = bytes.slice(ptr + 7, ptr + 7 + length);
+    var value;
+    if (type == TUPLE_BYTE_ARRAY) {
+      value = Array.prototype.slice.call(data);
+    } else if (type == TUPLE_CSTRING) {
+      value = data.toString('utf8').replace(/\0.*$/, '');
+    } else if (length == 1) {
+      value = (type == TUPLE_INT) ? data.readInt8(0) : data.readUInt8(0);
+    } else if (length == 2) {
+      value = (type == TUPLE_INT) ? data.readInt16LE(0) : data.readUInt16LE(0);
+    } else {
+      value = (type == TUPLE_INT) ? data.readInt32LE(0) : data.readUInt32LE(0);
+    }
+    payload[keyNames[key] || key] = value;
+    ptr += 7 + length;
+  }
+  return payload;
+}
+
+// each direction of the link sends one message at a time, at its bandwidth
+var link = {
+  "down": {"free": 0, "messages": 0, "bytes": 0, "lost": 0, "nacked": 0},
+  "up": {"free": 0, "messages": 0, "bytes": 0, "lost": 0, "nacked": 0}
+};
+
+//! @return When a message of size bytes sent now arrives at the other end
+function linkArrival(direction, size) {
+  var stats = link[direction];
+  stats.messages++;
+  stats.bytes += size + LINK_OVERHEAD;
+  stats.free = Math.max(now, stats.free) + (size + LINK_OVERHEAD) * 1000 / options.bandwidth;
+  return stats.free + options.latency;
+}
+
+// the watch process, one request in flight at a time
+var child = childProcess.spawn(options.watch, options.inbox ? [String(options.inbox)] : [],
+                               {"stdio": ['pipe', 'pipe', 'inherit']});
+var replies = [];
+readline.createInterface({"input": child.stdout}).on('line', function(line) { replies.shift()(line); });
+child.on('error', function(e) {
+  console.error('can\'t run ' + options.watch + ', see make simulate: ' + e.message);
+  process.exit(1);
+});
+
+function request(line) {
+  return new Promise(function(resolve) {
+    replies.push(resolve);
+    child.stdin.write(line + '\n');
+  });
+}
+
+var watch = {"now": 0, "wake": null, "sending": false, "rowsDrawn": 0, "rowsReady": 0, "iconsMs": null};
+
+//! Runs a command on the watch once its clock has caught up, then lets it draw and send whatever it has queued
+async function watchCommand(line) {
+  await request('advance ' + (now - watch.now));
+  watch.now = now;
+  var reply = await request(line);
+  await watchPump();
+  return reply;
+}
+
+async function watchPump() {
+  var next = Number((await request('advance 0')).split(' ')[1]);
+  cancel(watch.wake);
+  watch.wake = (next < 0) ? null : schedule(now + next, function() { return watchCommand('advance 0'); });
+
+  var drew = (await request('draw ' + options.rows)).split(' ');
+  watch.rowsDrawn = Number(drew[1]);
+  watch.rowsReady = Number(drew[2]);
+  if (watch.iconsMs == null && watch.rowsDrawn > 0 && watch.rowsReady == watch.rowsDrawn) { watch.iconsMs = now; }
+
+  if (watch.sending) { return; }
+  var hex = (await request('outbox')).split(' ')[1];
+  if (hex == '-') { return; }
+  watch.sending = true;
+  var bytes = Buffer.from(hex, 'hex');
+  var arrival = linkArrival('up', bytes.length);
+  if (random() < options.drop) {
+    link.up.lost++;
+    schedule(now + options.timeout, function() {
+      watch.sending = false;
+      return watchCommand('complete ' + APP_MSG_SEND_TIMEOUT);
+    });
+    return;
+  }
+  schedule(arrival, function() { pkjs.emit('appmessage', decode(bytes)); });
+  schedule(arrival + options.latency, function() {
+    watch.sending = false;
+    return watchCommand('complete ' + APP_MSG_OK);
+  });
+}
+
+//! Pebble.sendAppMessage over the link, acked once the watch's inbox has taken the message
+function sendAppMessage(dict, success, failure) {
+  var bytes = encode(dict);
+  var arrival = linkArrival('down', bytes.length);
+  if (random() < options.drop) {
+    link.down.lost++;
+    schedule(now + options.timeout, function() { if (failure) { failure({"data": dict}, 'Timed out'); } });
+    return;
+  }
+  schedule(arrival, async function() {
+    var result = Number((await watchCommand('deliver ' + bytes.toString('hex'))).split(' ')[1]);
+    if (result != APP_MSG_OK) { link.down.nacked++; }
+    schedule(now + options.latency, function() {
+      if (result == APP_MSG_OK) {
+        if (success) { success({"data": dict}); }
+      } else if (failure) {
+        failure({"data": dict}, 'Watch dropped the message, result ' + result);
+      }
+    });
+  });
+}
+
+var pkjs = pebblekit.load({
+  "platform": options.platform,
+  "tiles": pebblekit.sampleTiles(options.tiles, options.tiles >> 1),
+  "sendAppMessage": sendAppMessage,
+  "clock": clock
+});
+
+function finished() {
+  return pkjs.context.handshake.tilesLoaded != null && watch.iconsMs != null &&
+         Object.keys(pkjs.context.transfersInFlight).length == 0;
+}
+
+function report(state) {
+  var handshake = pkjs.context.handshake;
+  function ms(value) { return (value == null) ? 'never' : Math.round(value) + ' ms'; }
+  console.log(options.platform + ', ' + options.tiles + ' tiles, ' + options.bandwidth + ' B/s, ' +
+              options.latency + ' ms latency, ' + (options.drop * 100) + '% lost, seed ' + options.seed);
+  console.log('tiles loaded     ' + ms(handshake.tilesLoaded));
+  console.log('menu shown       ' + ms(state.menuShown || null));
+  console.log('icons on screen  ' + ms(watch.iconsMs) + ', ' + watch.rowsReady + ' of ' + watch.rowsDrawn + ' rows');
+  ['down', 'up'].forEach(function(direction) {
+    var stats = link[direction];
+    console.log(((direction == 'down') ? 'phone to watch   ' : 'watch to phone   ') + stats.messages + ' messages, ' +
+                stats.bytes + ' bytes, ' + stats.lost + ' lost, ' + stats.nacked + ' dropped by the watch');
+  });
+  var transferStats = pkjs.context.transferStats;
+  Object.keys(transferStats).forEach(function(type) {
+    var stats = transferStats[type];
+    console.log('transfer type ' + type + ('   ' + stats.transfers).slice(-4) + ' done, ' + stats.bytes + ' bytes, last ' +
+                stats.lastMs + ' ms, ' + stats.failures + ' failed sends, ' + stats.refused + ' refused');
+  });
+  console.log('watch heap       ' + state.heapUsed + ' bytes in use, ' + state.heapPeak + ' at most, ' +
+              state.tilesHeld + ' of ' + state.tilesTotal + ' tiles held');
+}
+
+async function run() {
+  await watchPump();
+  pkjs.emit('ready');
+  while (events.length > 0 && !finished()) {
+    var event = events.shift();
+    if (event.cancelled) { continue; }
+    if (event.at > options.limit) { break; }
+    now = event.at;
+    await event.run();
+  }
+  var state = (await watchCommand('state')).split(' ').map(Number);
+  report({"tilesHeld": state[2], "tilesTotal": state[3], "heapUsed": state[4], "heapPeak": state[5],
+          "menuShown": state[6]});
+  child.stdin.end();
+  return finished();
+}
+
+run().then(function(ok) {
+  process.exitCode = ok ? 0 : 1;
+}, function(e) {
+  console.error(e);
+  child.kill();
+  process.exitCode = 1;
+});
@@ -0,0 +1,102 @@
+// The watch end of simulator.js: the host build driven one command per line on stdin, answering each with one
+// line on stdout. Dictionaries travel as hex.
+//
+//   deliver <hex>      hands a message to the inbox, answers "result <AppMessageResult>"
+//   outbox             answers "outbox <hex>" with the message the app is sending, or "outbox -"
+//   complete <result>  completes the outbox message with an AppMessageResult, answers "ok"
+//   advance <ms>       moves the clock on, firing timers, answers "next <ms until the next timer, -1 if none>"
+//   draw <rows>        draws rows of the menu from the selected one as menu_window.c would, answers
+//                      "drew <rows drawn> <rows with their icon>"
+//   state              answers "state <ms> <tiles held> <tiles in total> <heap used> <heap peak> <menu shown ms>"
+//
+// Usage: watch [inbox maximum]
+#include <pebble.h>
+#include "c/modules/comm.h"
+#include "c/modules/data.h"
+#include "c/modules/storage.h"
+#include "c/stateful.h"
+#include "host.h"
+
+// the longest message a watch with any inbox sends or receives, as hex
+#define WATCH_LINE_SIZE (2 * 8200 + 64)
+
+void pebblekit_connection_callback(bool connected);
+
+static void watch_hex_write(const uint8_t *data, uint16_t size) {
+  for(uint16_t i=0; i < size; i++) { printf("%02x", data[i]); }
+}
+
+static uint16_t watch_hex_read(const char *hex, uint8_t *out, uint16_t size) {
+  uint16_t length = 0;
+  unsigned int byte;
+  while (length < size && sscanf(&hex[length * 2], "%2x", &byte) == 1) { out[length++] = byte; }
+  return length;
+}
+
+static long watch_next() {
+  uint32_t next = host_time_next();
+  return (next == UINT32_MAX) ? -1 : (long) next;
+}
+
+//! Draws rows of the menu from the selected tile, asking for their icons as draw_row_callback does
+static void watch_draw(uint16_t rows) {
+  uint16_t drawn = 0, ready = 0;
+  if (tile_array && host_windows()->menu_shown_ms) {
+    for(uint16_t row=tile_array->default_idx; row < tile_array->total && drawn < rows; row++, drawn++) {
+      Tile *tile = data_tile_array_get_tile(row);
+      if (!tile) { continue; }
+      GBitmap *icon = data_icon_array_search(data_tile_get_icon_key(tile, TITLE), ICON_PRIORITY_MENU);
+      ready += icon != default_icon;
+    }
+  }
+  printf("drew %u %u\n", drawn, ready);
+}
+
+int main(int argc, char **argv) {
+  static char line[WATCH_LINE_SIZE];
+  static uint8_t data[8200];
+  host_inbox_maximum((argc > 1) ? strtoul(argv[1], NULL, 10) : HOST_INBOX_MAX);
+  host_heap_init(HOST_HEAP_DEFAULT);
+  storage_init();
+  comm_init();
+  pebblekit_connection_callback(true);
+
+  while (fgets(line, sizeof(line), stdin)) {
+    char command[16];
+    int offset = 0;
+    if (sscanf(line, "%15s %n", command, &offset) != 1) { continue; }
+    char *argument = &line[offset];
+    if (strcmp(command, "deliver") == 0) {
+      uint16_t size = watch_hex_read(argument, data, sizeof(data));
+      printf("result %d\n", host_inbox_deliver(data, size));
+    } else if (strcmp(command, "outbox") == 0) {
+      uint16_t size;
+      DictionaryIterator *iter = host_outbox_pending(&size);
+      printf("outbox ");
+      if (iter) {
+        watch_hex_write((uint8_t*) iter->dictionary, size);
+      } else {
+        printf("-");
+      }
+      printf("\n");
+    } else if (strcmp(command, "complete") == 0) {
+      host_outbox_complete(atoi(argument));
+      printf("ok\n");
+    } else if (strcmp(command, "advance") == 0) {
+      host_time_advance(strtoul(argument, NULL, 10));
+      printf("next %ld\n", watch_next());
+    } else if (strcmp(command, "draw") == 0) {
+      watch_draw(atoi(argument));
+    } else if (strcmp(command, "state") == 0) {
+      printf("state %u %u %u %zu %zu %u\n", host_time_now(), tile_array ? tile_array->used : 0,
+             tile_array ? tile_array->total : 0, host_heap_stats()->used, host_heap_stats()->peak,
+             host_windows()->menu_shown_ms);
+    } else {
+      printf("error unknown command %s\n", command);
+    }
+    fflush(stdout);
+  }
+  comm_deinit();
+  storage_deinit();
+  return 0;
+}